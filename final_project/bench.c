@@ -0,0 +1,465 @@
+// 檔案系統各指令路徑的量測工具，結果以 JSON 輸出，方便在不同版本之間比較
+// 用法：./fsbench [scale (預設 1)]，工作負載以固定亂數種子產生，每次執行都相同
+#include <time.h>
+
+#include "command.h"
+#include "snapshot.h"
+#include "bench_host.h"
+
+#define MB (1024.0 * 1024.0)
+
+static unsigned int rng;
+static FILE *report;     // JSON 輸出（指令輸出在量測期間被導向 /dev/null）
+static int first_result = 1;
+
+static unsigned int next_random(void) {
+    rng = rng * 1103515245u + 12345u;
+    return rng >> 8;
+}
+
+// 量測工具無法在失敗後繼續，結果會不完整，直接結束
+static void die(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+static void *bench_malloc(size_t size) {
+    void *p = malloc(size > 0 ? size : 1);
+    if (!p) {
+        die("malloc");
+    }
+    return p;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 一個工作負載的逐筆延遲與處理的位元組數
+typedef struct {
+    const char *name;
+    double *latencies;
+    int count, capacity;
+    double bytes;
+    double start;
+} Bench;
+
+static void bench_begin(Bench *b, const char *name) {
+    memset(b, 0, sizeof(Bench));
+    b->name = name;
+    b->start = now_seconds();
+}
+
+static void bench_record(Bench *b, double seconds, double bytes) {
+    if (b->count == b->capacity) {
+        int capacity = b->capacity ? b->capacity * 2 : 1024;
+        double *latencies = realloc(b->latencies, capacity * sizeof(double));
+        if (!latencies) {
+            die(b->name);
+        }
+        b->latencies = latencies;
+        b->capacity = capacity;
+    }
+    b->latencies[b->count++] = seconds;
+    b->bytes += bytes;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const Bench *b, double p) {
+    int i = (int)(p * (b->count - 1) + 0.5);
+    return b->latencies[i];
+}
+
+// 輸出一筆結果：吞吐量以各操作的延遲總和計算，不含工作負載中的準備步驟
+static void bench_end(Bench *b) {
+    double busy = 0;
+    for (int i = 0; i < b->count; i++) {
+        busy += b->latencies[i];
+    }
+    qsort(b->latencies, b->count, sizeof(double), compare_double);
+    fprintf(report, "%s\n    {\"name\": \"%s\", \"ops\": %d, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+            "\"mb_per_sec\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}",
+            first_result ? "" : ",", b->name, b->count, busy,
+            busy > 0 ? b->count / busy : 0, busy > 0 ? b->bytes / MB / busy : 0,
+            b->count ? percentile(b, 0.5) * 1e6 : 0, b->count ? percentile(b, 0.99) * 1e6 : 0,
+            b->count ? b->latencies[b->count - 1] * 1e6 : 0);
+    first_result = 0;
+    fflush(report);
+    free(b->latencies);
+}
+
+// 計時執行一個指令，回傳所花的秒數
+#define TIMED(b, bytes, call) do { \
+        double t0_ = now_seconds(); \
+        call; \
+        bench_record((b), now_seconds() - t0_, (bytes)); \
+    } while (0)
+
+static void fill_random(char *buffer, int size) {
+    for (int i = 0; i < size; i++) {
+        buffer[i] = 'a' + next_random() % 26;
+        if (next_random() % 16 == 0) {
+            buffer[i] = next_random() % 4 ? ' ' : '\n';
+        }
+    }
+}
+
+static void new_filesystem(FileSystem *fs, int size) {
+    rng = 12345;
+    if (init_filesystem(fs, size, 0) == -1) {
+        exit(1);
+    }
+}
+
+// 在主機上建立 put 用的檔案
+static void write_host_file(const char *path, int size) {
+    char *buffer = bench_malloc(size);
+    fill_random(buffer, size);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        die(path);
+    }
+    if (fwrite(buffer, 1, size, f) != (size_t)size || fclose(f) == EOF) {
+        die(path);
+    }
+    free(buffer);
+}
+
+// 許多小檔案：put / get / cat / create / ls / rm
+static void bench_small_files(int scale) {
+    FileSystem fs;
+    new_filesystem(&fs, 256 * 1024 * 1024);
+    Bench b;
+    char name[64];
+    int host_files = 200, dirs = 10 * scale;
+    int sizes[200];
+
+    if (host_mkdir("host") == -1) {
+        perror("host");
+        exit(1);
+    }
+    for (int i = 0; i < host_files; i++) {
+        sizes[i] = 64 + next_random() % 4000;
+        snprintf(name, sizeof(name), "host/s%d.txt", i);
+        write_host_file(name, sizes[i]);
+    }
+
+    bench_begin(&b, "put_small");
+    for (int d = 0; d < dirs; d++) {
+        snprintf(name, sizeof(name), "d%d", d);
+        mkdir(&fs, name);
+        cd(&fs, name);
+        for (int i = 0; i < host_files; i++) {
+            snprintf(name, sizeof(name), "host/s%d.txt", i);
+            TIMED(&b, sizes[i], put(&fs, name));
+        }
+        cd(&fs, "..");
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "get_small");
+    for (int d = 0; d < dirs; d++) {
+        snprintf(name, sizeof(name), "d%d", d);
+        cd(&fs, name);
+        for (int i = 0; i < host_files; i++) {
+            snprintf(name, sizeof(name), "s%d.txt", i);
+            TIMED(&b, sizes[i], get(&fs, name));
+        }
+        cd(&fs, "..");
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "cat_small");
+    cd(&fs, "d0");
+    for (int i = 0; i < host_files; i++) {
+        snprintf(name, sizeof(name), "s%d.txt", i);
+        TIMED(&b, sizes[i], cat(&fs, name));
+    }
+    cd(&fs, "..");
+    bench_end(&b);
+
+    // create 的實際寫入路徑（不經互動輸入）
+    int files = 20000 * scale;
+    char content[4096];
+    fill_random(content, sizeof(content));
+    mkdir(&fs, "many");
+    cd(&fs, "many");
+    bench_begin(&b, "create_small");
+    for (int i = 0; i < files; i++) {
+        int size = 1 + next_random() % sizeof(content);
+        snprintf(name, sizeof(name), "f%d", i);
+        TIMED(&b, size, write_new_file(&fs, name, content, size));
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "ls_large_dir");
+    for (int i = 0; i < 20; i++) {
+        TIMED(&b, 0, ls(&fs, ""));
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "rm_small");
+    for (int i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "f%d", i);
+        TIMED(&b, 0, rm(&fs, name));
+    }
+    bench_end(&b);
+
+    free_filesystem(&fs);
+}
+
+// 少數大檔案：put / get / 單點編輯 / cp
+static void bench_huge_files(int scale) {
+    FileSystem fs;
+    int file_size = 32 * 1024 * 1024;
+    int count = 4 * scale;
+    new_filesystem(&fs, (count + 2) * file_size + 16 * 1024 * 1024);
+    Bench b;
+    char name[64];
+
+    write_host_file("host/huge.bin", file_size);
+    bench_begin(&b, "put_huge");
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "h%d", i);
+        mkdir(&fs, name);
+        cd(&fs, name);
+        TIMED(&b, file_size, put(&fs, "host/huge.bin"));
+        cd(&fs, "..");
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "get_huge");
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "h%d", i);
+        cd(&fs, name);
+        TIMED(&b, file_size, get(&fs, "huge.bin"));
+        cd(&fs, "..");
+    }
+    bench_end(&b);
+
+    // 在大檔案中間做小幅修改，piece table 只寫回變動的區塊
+    cd(&fs, "h0");
+    int index = find_file(&fs, "huge.bin");
+    bench_begin(&b, "edit_huge_span");
+    for (int i = 0; i < 50 * scale; i++) {
+        PieceTable pt;
+        if (pt_open(&pt, &fs, index) == -1) {
+            break;
+        }
+        if (pt.length <= 64) {
+            pt_free(&pt);
+            break;
+        }
+        int offset = next_random() % (pt.length - 64);
+        double t0 = now_seconds();
+        pt_delete(&pt, offset, 16);
+        pt_insert(&pt, offset, "0123456789abcdef", 16);
+        int written = pt_save(&fs, index, &pt);
+        bench_record(&b, now_seconds() - t0, written * (double)BLOCK_SIZE);
+        pt_free(&pt);
+    }
+    bench_end(&b);
+
+    // cp 只共用區塊，不複製內容，所以只看 ops/s，不計位元組
+    bench_begin(&b, "cp_huge");
+    for (int i = 0; i < 20 * scale; i++) {
+        snprintf(name, sizeof(name), "copy%d", i);
+        TIMED(&b, 0, cp(&fs, "huge.bin", name));
+    }
+    bench_end(&b);
+    cd(&fs, "..");
+
+    free_filesystem(&fs);
+}
+
+// 深層目錄：mkdir + cd 一路往下、以絕對路徑切換、搬移整棵子樹
+static void bench_deep_tree(int scale) {
+    FileSystem fs;
+    new_filesystem(&fs, 64 * 1024 * 1024);
+    Bench b;
+    int depth = 100;
+    char path[MAX_PATH] = "";
+
+    bench_begin(&b, "mkdir_cd_deep");
+    for (int i = 0; i < depth; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "n%d", i);
+        TIMED(&b, 0, (mkdir(&fs, name), cd(&fs, name)));
+        strncat(path, "/", sizeof(path) - strlen(path) - 1);
+        strncat(path, name, sizeof(path) - strlen(path) - 1);
+    }
+    bench_end(&b);
+
+    // 最深的目錄放一些檔案，讓子樹不是空的
+    for (int i = 0; i < 1000; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "leaf%d", i);
+        write_new_file(&fs, name, "leaf", 4);
+    }
+
+    bench_begin(&b, "cd_absolute_deep");
+    for (int i = 0; i < 20000 * scale; i++) {
+        TIMED(&b, 0, cd(&fs, i % 2 ? "/" : path));
+    }
+    bench_end(&b);
+
+    cd(&fs, "/");
+    bench_begin(&b, "mv_subtree");
+    for (int i = 0; i < 20000 * scale; i++) {
+        TIMED(&b, 0, mv(&fs, i % 2 ? "m" : "n0", i % 2 ? "n0" : "m"));
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "mkdir_rmdir");
+    for (int i = 0; i < 20000 * scale; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "e%d", i);
+        TIMED(&b, 0, mkdir(&fs, name));
+    }
+    for (int i = 0; i < 20000 * scale; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "e%d", i);
+        TIMED(&b, 0, rmdir(&fs, name));
+    }
+    bench_end(&b);
+
+    free_filesystem(&fs);
+}
+
+// 大量隨機新增 / 刪除造成碎片，量測配置路徑與 find_free_blocks
+static void bench_churn(int scale) {
+    FileSystem fs;
+    new_filesystem(&fs, 128 * 1024 * 1024);
+    Bench b;
+    int slots = 2000;
+    char *present = calloc(slots, 1);
+    if (!present) {
+        die("calloc");
+    }
+    char *content = bench_malloc(64 * 1024);
+    fill_random(content, 64 * 1024);
+
+    bench_begin(&b, "churn_create_rm");
+    for (int i = 0; i < 20000 * scale; i++) {
+        int k = next_random() % slots;
+        char name[16];
+        snprintf(name, sizeof(name), "c%d", k);
+        if (present[k]) {
+            TIMED(&b, 0, rm(&fs, name));
+            present[k] = 0;
+        } else {
+            int size = 1 + next_random() % (64 * 1024);
+            int index;
+            TIMED(&b, size, index = write_new_file(&fs, name, content, size));
+            present[k] = index != -1;
+        }
+    }
+    bench_end(&b);
+
+    // 在碎片化的 bitmask 上只找不配置
+    bench_begin(&b, "find_free_blocks");
+    for (int i = 0; i < 100000 * scale; i++) {
+        int blocks = 1 + next_random() % 64;
+        TIMED(&b, 0, find_free_blocks(&fs, blocks));
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "grep_indexed");
+    for (int i = 0; i < 50 * scale; i++) {
+        char pattern[8];
+        for (int k = 0; k < 6; k++) {
+            pattern[k] = 'a' + next_random() % 26;
+        }
+        pattern[6] = '\0';
+        TIMED(&b, 0, grep(&fs, pattern));
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "snapshot_create_delete");
+    for (int i = 0; i < 1000 * scale; i++) {
+        TIMED(&b, 0, (snapshot_create(&fs, "bench"), snapshot_delete(&fs, "bench")));
+    }
+    bench_end(&b);
+
+    free(content);
+    free(present);
+    free_filesystem(&fs);
+}
+
+// 整個分區存成映像檔再載入
+static void bench_save_load(int scale) {
+    FileSystem fs;
+    int size = 256 * 1024 * 1024;
+    new_filesystem(&fs, size);
+    char *content = bench_malloc(256 * 1024);
+    fill_random(content, 256 * 1024);
+    for (int i = 0; i < 768; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "b%d", i);
+        write_new_file(&fs, name, content, 256 * 1024);
+    }
+    free(content);
+
+    Bench save, load;
+    bench_begin(&save, "save_filesystem");
+    bench_begin(&load, "load_filesystem");
+    for (int i = 0; i < 3 * scale; i++) {
+        int result;
+        TIMED(&save, size, result = store_filesystem(&fs, "bench.img", "bench"));
+        if (result == -1) {
+            fprintf(stderr, "save_filesystem failed\n");
+            exit(1);
+        }
+        free_filesystem(&fs);
+        TIMED(&load, size, result = restore_filesystem(&fs, "bench.img", "bench"));
+        if (result == -1) {
+            fprintf(stderr, "load_filesystem failed\n");
+            exit(1);
+        }
+    }
+    bench_end(&save);
+    bench_end(&load);
+    remove("bench.img");
+    free_filesystem(&fs);
+}
+
+int main(int argc, char *argv[]) {
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale < 1) {
+        fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    // 在暫存目錄中執行，put/get 用到的主機檔案不會留在原地
+    char dir[] = "/tmp/fsbench.XXXXXX";
+    if (host_enter_temp_dir(dir) == -1) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    // 指令都用 fs_printf 輸出，量測期間丟掉
+    report = stdout;
+    fs_output = fopen("/dev/null", "w");
+    if (!fs_output) {
+        die("/dev/null");
+    }
+
+    fprintf(report, "{\n  \"scale\": %d,\n  \"block_size\": %d,\n  \"results\": [", scale, BLOCK_SIZE);
+    bench_small_files(scale);
+    bench_huge_files(scale);
+    bench_deep_tree(scale);
+    bench_churn(scale);
+    bench_save_load(scale);
+    fprintf(report, "\n  ]\n}\n");
+
+    if (host_remove_tree(dir) == -1) {
+        perror(dir);
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#define _GNU_SOURCE // mkdtemp, nftw
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench_host.h"
+
+int host_enter_temp_dir(char *path) {
+    if (!mkdtemp(path) || chdir(path) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int host_mkdir(const char *path) {
+    if (mkdirat(AT_FDCWD, path, 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    return unlinkat(AT_FDCWD, path, type == FTW_DP ? AT_REMOVEDIR : 0);
+}
+
+int host_remove_tree(const char *path) {
+    if (chdir("/") == -1) {
+        return -1;
+    }
+    // 先刪子項目再刪目錄，不跟隨符號連結
+    return nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,17 @@
+#ifndef BENCH_HOST_H
+#define BENCH_HOST_H
+
+// fsbench 在主機上的目錄操作
+// 獨立成一個檔案：unistd.h 與 sys/stat.h 的 mkdir / rmdir 和 command.h 的指令同名，不能放在同一個檔案中
+// 連結時指令的 mkdir / rmdir 也會蓋過 libc 的同名函式，所以這裡改用 mkdirat / unlinkat
+
+// 以 mkdtemp 的樣板建立暫存目錄並切換過去，失敗回傳 -1
+int host_enter_temp_dir(char *path);
+
+// 建立目錄，已經存在不算錯誤
+int host_mkdir(const char *path);
+
+// 離開並刪除 path 與底下的所有檔案
+int host_remove_tree(const char *path);
+
+#endif
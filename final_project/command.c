@@ -1,587 +1,1006 @@
+#include <stdarg.h>
 #include "command.h"
+#include "stats.h"
 
-void ls(FileSystem *fs) {
-    printf("\033[1;34m[Directory]\033[0m   \033[0;32m[File]\033[0m\n");
-    for (int i = 0; i < fs->file_count; i++) {
-        // 只顯示當前目錄下的檔案和目錄
-        if (fs->files[i].used_blocks > 0 && 
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0) {
-            if (fs->files[i].is_directory) {
-                printf("\033[1;34m%s\033[0m\n", fs->files[i].name); // 藍色是目錄
-            }
-            else if (fs->files[i].is_directory == 0)
-            {
-                printf("\033[0;32m%s (%d bytes)\033[0m\n", fs->files[i].name, fs->files[i].size);// 綠色是檔案
-            }
+// 累積輸出，滿了才一次寫出，避免大目錄每個項目都呼叫一次 printf 寫到終端機
+typedef struct {
+    char data[16384];
+    size_t len;
+} OutputBuffer;
+
+static void output_flush(OutputBuffer *out) {
+    fwrite(out->data, 1, out->len, FS_OUT);
+    out->len = 0;
+}
+
+static void output_printf(OutputBuffer *out, const char *format, ...) {
+    if (out->len > sizeof(out->data) - 512) {
+        output_flush(out);
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->data + out->len, sizeof(out->data) - out->len, format, args);
+    va_end(args);
+    if (n > 0) {
+        out->len += (size_t)n < sizeof(out->data) - out->len ? (size_t)n : sizeof(out->data) - out->len - 1;
+    }
+}
+
+int ls(FileSystem *fs, const char *options) {
+    int order = DIR_ORDER_CREATED, reverse = 0, page = 0, per_page = LS_PAGE_SIZE;
+    char token[32], value[32];
+    const char *p = options;
+    int consumed;
+    while (sscanf(p, "%31s%n", token, &consumed) == 1) {
+        p += consumed;
+        if (strcmp(token, "-r") == 0) {
+            reverse = 1;
+            continue;
+        }
+        if (sscanf(p, "%31s%n", value, &consumed) != 1) {
+            fs_printf("Usage: ls [-s name|size] [-r] [-p page] [-n per page]\n");
+            return -1;
+        }
+        p += consumed;
+        if (strcmp(token, "-s") == 0 && strcmp(value, "name") == 0) {
+            order = DIR_ORDER_NAME;
+        } else if (strcmp(token, "-s") == 0 && strcmp(value, "size") == 0) {
+            order = DIR_ORDER_SIZE;
+        } else if (strcmp(token, "-p") == 0 && atoi(value) > 0) {
+            page = atoi(value);
+        } else if (strcmp(token, "-n") == 0 && atoi(value) > 0) {
+            per_page = atoi(value);
+        } else {
+            fs_printf("Usage: ls [-s name|size] [-r] [-p page] [-n per page]\n");
+            return -1;
+        }
+    }
+
+    DirCursor cursor;
+    if (dir_open(fs, fs->cwd, order, reverse, &cursor) == -1) {
+        fs_printf("Error: Could not allocate memory for directory listing.\n");
+        return -1;
+    }
+    // 沒有指定頁數時一頁一頁讀到底
+    int limit = cursor.count;
+    if (page > 0) {
+        long start = (long)(page - 1) * per_page;
+        dir_seek(&cursor, start < cursor.count ? (int)start : cursor.count);
+        limit = per_page;
+    }
 
+    static OutputBuffer out;
+    out.len = 0;
+    output_printf(&out, "\033[1;34m[Directory]\033[0m   \033[0;32m[File]\033[0m\n");
+    int entries[256];
+    int first = cursor.pos, shown = 0, n;
+    while (shown < limit && (n = dir_read(&cursor, entries, limit - shown < 256 ? limit - shown : 256)) > 0) {
+        for (int k = 0; k < n; k++) {
+            File *file = file_at(fs, entries[k]);
+            if (file->is_directory) {
+                output_printf(&out, "\033[1;34m%s\033[0m\n", file->name); // 藍色是目錄
+            } else {
+                output_printf(&out, "\033[0;32m%s (%d bytes)\033[0m\n", file->name, file->size); // 綠色是檔案
+            }
+        }
+        shown += n;
+    }
+    if (page > 0) {
+        int pages = (cursor.count + per_page - 1) / per_page;
+        if (shown > 0) {
+            output_printf(&out, "page %d of %d (entries %d-%d of %d)\n",
+                          page, pages, first + 1, first + shown, cursor.count);
+        } else {
+            output_printf(&out, "page %d of %d (no entries, %d in total)\n", page, pages, cursor.count);
         }
     }
-    print_bitmask(fs);
+    output_flush(&out);
+    dir_close(&cursor);
+    return 0;
 }
 
+int bitmap(FileSystem *fs, const char *options) {
+    int max_runs = BITMAP_RUNS;
+    if (sscanf(options, "%d", &max_runs) == 1 && max_runs < 0) {
+        fs_printf("Usage: bitmap [number of runs to list]\n");
+        return -1;
+    }
+    print_bitmap(fs, max_runs);
+    return 0;
+}
+
+
+int mkdir(FileSystem *fs, const char *dirname) {
+    // 名稱中的 '/' 會被當成路徑分隔
+    if (strchr(dirname, '/')) {
+        fs_printf("Error: Invalid directory name '%s'.\n", dirname);
+        return -1;
+    }
 
-void mkdir(FileSystem *fs, const char *dirname) {
     // 檢查目錄是否已存在
-    for (int i = 0; i < fs->file_count; i++) {
-        if (fs->files[i].used_blocks > 0 && strcmp(fs->files[i].name, dirname) == 0 && strcmp(fs->files[i].parent_name, fs->current_path) == 0) {
-            printf("Error: Directory '%s' already exists.\n", dirname);
-            return;
-        }
+    if (find_file(fs, dirname) != -1) {
+        fs_printf("Error: Directory '%s' already exists.\n", dirname);
+        return -1;
     }
 
     // 檢查是否有足夠的空間來創建新目錄
     if (fs->free_blocks < 1) {
-        printf("Error: Not enough space to create directory '%s'.\n", dirname);
-        return;
+        fs_printf("Error: Not enough space to create directory '%s'.\n", dirname);
+        return -1;
     }
 
     // 獲取位置
     int start_block = -1;
     start_block = find_free_blocks(fs, 1);
+    if (start_block == -1) {
+        fs_printf("Error: Not enough space to create directory '%s'.\n", dirname);
+        return -1;
+    }
 
-    // 動態分配新的文件結構
-    fs->files = (File *)realloc(fs->files, (fs->file_count + 1) * sizeof(File));
-    if (fs->files == NULL) {
-        printf("Error: Could not allocate memory for new directory.\n");
-        return;
+    // 從項目表配置新的文件結構
+    int index = file_table_alloc(fs);
+    if (index == -1) {
+        fs_printf("Error: Could not allocate memory for new directory.\n");
+        return -1;
     }
 
     // 初始化新目錄
-    File *new_dir = &fs->files[fs->file_count];
-    strncpy(new_dir->name, dirname, MAX_FILENAME);
+    File *new_dir = file_at(fs, index);
+    snprintf(new_dir->name, sizeof(new_dir->name), "%s", dirname);
     new_dir->size = 0;
     new_dir->start_block = start_block;
     new_dir->used_blocks = 1; // 目錄至少佔用一個區塊
     new_dir->is_directory = 1; // 標記為目錄
-    strncpy(new_dir->parent_name, fs->current_path, MAX_FILENAME); // 設定父目錄名稱
+    new_dir->parent = fs->cwd; // 設定父目錄
+    file_table_link(fs, index);
 
     // 更新bitmask
-    set_bitmask(fs, start_block, 1);
+    claim_extent(fs, start_block, 1);
+
+    fs_printf("Directory '%s' created.\n", dirname);
+    return 0;
+}
+
+int rmdir(FileSystem *fs, const char *dirname) {
+    // 檢查目錄是否存在於當前目錄下
+    int i = find_file(fs, dirname);
+    if (i != -1 && file_at(fs, i)->is_directory) {
+        File *dir = file_at(fs, i);
 
+        // 檢查此目錄有沒有children
+        if (dir->child_count > 0) {
+            fs_printf("Error: Directory '%s' is not empty.\n", dirname);
+            return -1;
+        }
 
-    fs->file_count++;
-    fs->free_blocks--;
+        // 移除目錄並更新bitmask（快照還在使用時保留區塊）
+        release_extent(fs, dir->start_block, 1);
 
-    printf("Directory '%s' created.\n", dirname);
-    //print_bitmask(fs);
+        // 項目變成墓碑，之後新增項目時重用
+        file_table_release(fs, i);
+
+        fs_printf("Directory '%s' removed.\n", dirname);
+        return 0;
+    }
+
+    fs_printf("Error: Directory '%s' not found in current directory.\n", dirname);
+    return -1;
 }
 
-void rmdir(FileSystem *fs, const char *dirname) {
-    // 檢查目錄是否存在
-    for (int i = 0; i < fs->file_count; i++) {
-        if (fs->files[i].used_blocks > 0 && 
-            fs->files[i].is_directory && 
-            strcmp(fs->files[i].name, dirname) == 0 && // 檢查是否為目標目錄
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0) { // 檢查是否在當前目錄下
-            
-            // 組合完整路徑
-            char full_path[MAX_PATH];
-            if (strcmp(fs->current_path, "/") == 0) {
-                snprintf(full_path, MAX_PATH, "/%s", dirname);
-            } else {
-                snprintf(full_path, MAX_PATH, "%s/%s", fs->current_path, dirname);
-            }
 
-            // 檢查此目錄有沒有children
-            for (int j = 0; j < fs->file_count; j++) {
-                if (fs->files[j].used_blocks > 0) {
-                    if (strcmp(full_path, fs->files[j].parent_name) == 0) {
-                        printf("Error: Directory '%s' is not empty.\n", dirname);
-                        return;
-                    }
-                }
-            }
+int cd(FileSystem *fs, const char *path) {
+    // 路徑可以是單一名稱、相對路徑（含 ..）或絕對路徑
+    int dir;
+    if (resolve_path(fs, path, &dir) == -1 || (dir != ROOT_DIR && !file_at(fs, dir)->is_directory)) {
+        fs_printf("Error: Directory '%s' not found.\n", path);
+        return -1;
+    }
 
-            // 移除目錄
-            fs->files[i].used_blocks = 0;
-            fs->free_blocks++;
+    char temp_path[MAX_PATH];
+    if (build_path(fs, dir, temp_path, sizeof(temp_path)) == -1) { // 檢查超過路徑長度限制
+        fs_printf("error：Exceed path lenth limitation\n");
+        return -1;
+    }
 
-            // 更新bitmask
-            clear_bitmask(fs, fs->files[i].start_block, 1);
+    set_cwd(fs, dir);
+    if (strcmp(path, "..") != 0) {
+        fs_printf("Current directory: %s\n", fs->current_path);
+    }
+    return 0;
+}
 
-            // 移除File struct並將後面的元素往前遞補
-            for (int j = i; j < fs->file_count - 1; j++) {
-                fs->files[j] = fs->files[j + 1];
-            }
-            fs->file_count--;
-            fs->files = (File *)realloc(fs->files, fs->file_count * sizeof(File));
+// 找出當前目錄下名稱為 name 的項目，回傳其索引，找不到回傳 -1
+int find_file(FileSystem *fs, const char *name) {
+    return file_table_lookup(fs, fs->cwd, name);
+}
 
-            printf("Directory '%s' removed.\n", dirname);
-            return;
-        }
+// 在當前目錄下建立一個大小為 size 的檔案項目並配置區塊（內容由呼叫者寫入）
+// 成功回傳新項目的索引，失敗回傳 -1
+int alloc_file(FileSystem *fs, const char *filename, int size) {
+    if (strchr(filename, '/')) {
+        fs_printf("Error: Invalid file name '%s'.\n", filename);
+        return -1;
     }
 
-    printf("Error: Directory '%s' not found in current directory.\n", dirname);
+    //處理同檔名問題
+    if (find_file(fs, filename) != -1) {
+        fs_printf("Error: File '%s' already exists in the current directory.\n", filename);
+        return -1;
+    }
+
+    int required_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (required_blocks > fs->free_blocks) {
+        fs_printf("Error: Not enough space to store file '%s'.\n", filename);
+        return -1;
+    }
+
+    // 檢查bitmask以找到足夠塞得下file的連續空間
+    int start_block = find_free_blocks(fs, required_blocks);
+    if (start_block == -1) {
+        fs_printf("Error: Not enough continuous space to store file '%s'.\n", filename);
+        return -1;
+    }
+
+    // 從項目表配置新的文件結構
+    int index = file_table_alloc(fs);
+    if (index == -1) {
+        fs_printf("Error: Could not allocate memory for new file.\n");
+        return -1;
+    }
+
+    // 更新bitmask
+    claim_extent(fs, start_block, required_blocks);
+
+    File *new_file = file_at(fs, index);
+    snprintf(new_file->name, sizeof(new_file->name), "%s", filename);
+    set_file_extent(new_file, start_block, required_blocks, size);
+    new_file->is_directory = 0;
+    new_file->parent = fs->cwd;
+    file_table_link(fs, index);
+    return index;
+}
+
+// 寫入內容失敗時撤銷 alloc_file：釋放區塊，項目變成墓碑
+static void discard_file(FileSystem *fs, int index) {
+    release_file_extents(fs, index);
+    file_table_release(fs, index);
 }
 
+// 建立新檔案並寫入 data
+int write_new_file(FileSystem *fs, const char *filename, const char *data, int size) {
+    int index = alloc_file(fs, filename, size);
+    if (index == -1) {
+        return -1;
+    }
+    if (storage_write((size_t)file_at(fs, index)->start_block * BLOCK_SIZE, data, size) == -1) {
+        fs_printf("Error: Could not write file '%s'.\n", filename);
+        discard_file(fs, index);
+        return -1;
+    }
+    STATS_ADD(STAT_BYTES_IN, size);
+    trigram_index_add(fs, index);
+    return index;
+}
 
-void cd(FileSystem *fs, const char *path) {
-    if (strcmp(path, "..") == 0) { //
-        // 返回上一層目錄
-        char *last_slash = strrchr(fs->current_path, '/'); // 找到最後一個斜線
-        if (last_slash && last_slash != fs->current_path) { // 如果不是根目錄
-            *last_slash = '\0'; // 移除最後一個斜線 '\0'代表結束
-        } else {
-            strcpy(fs->current_path, "/");
-        }
-    } else {
-        // 檢查目錄是否存在
-        for (int i = 0; i < fs->file_count; i++) {
-            if (fs->files[i].used_blocks > 0 && // 第i個檔案是否存在
-                fs->files[i].is_directory && // 是否為目錄
-                strcmp(fs->files[i].name, path) == 0) { // 是否為指定目錄
-
-                char temp_path[MAX_FILENAME];
-                size_t path_len;
-                
-                // 根目錄特殊處理
-                if (strcmp(fs->current_path, "/") == 0) {
-                    path_len = snprintf(temp_path, MAX_FILENAME, "/%s", path); //snprintf() 函數用來格式化輸出字串， 用法：snprintf(char *str, size_t size, const char *format, ...);
-                } else {
-                    path_len = snprintf(temp_path, MAX_FILENAME, "%s/%s", fs->current_path, path);
-                }
+// 把新內容寫到從 start_block 開始的新區塊，寫入成功後才釋放舊區塊，失敗時檔案保持原狀
+static int move_and_write(FileSystem *fs, int index, int start_block, int required_blocks, const char *data, int size) {
+    File *file = file_mut(fs, index);
+    claim_extent(fs, start_block, required_blocks);
+    if (storage_write((size_t)start_block * BLOCK_SIZE, data, size) == -1) {
+        fs_printf("Error: Could not write file '%s'.\n", file->name);
+        release_extent(fs, start_block, required_blocks);
+        return -1;
+    }
+    STATS_ADD(STAT_BYTES_IN, size);
+    release_file_extents(fs, index);
+    set_file_extent(file_mut(fs, index), start_block, required_blocks, size);
+    trigram_index_update(fs, index);
+    return 0;
+}
 
-                if (path_len >= MAX_FILENAME) { // 檢查超過路徑長度限制
-                    printf("error：Exceed path lenth limitation\n");
-                    return;
-                }
+// 以 data 覆寫既有檔案的內容，空間不足、區塊與其他檔案共用或內容分成多段 extent 時搬到新的連續區塊
+int overwrite_file(FileSystem *fs, int index, const char *data, int size) {
+    File *file = file_mut(fs, index);
+    int required_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (extent_shared(fs, file->start_block) || file->next != -1 || file->skip != 0) {
+        // copy-on-write：另一個檔案或快照保留原本的區塊
+        if (required_blocks > fs->free_blocks) {
+            fs_printf("Error: Not enough space to update file '%s'.\n", file->name);
+            return -1;
+        }
+        int start_block = find_free_blocks(fs, required_blocks);
+        if (start_block == -1) {
+            fs_printf("Error: Not enough continuous space to update file '%s'.\n", file->name);
+            return -1;
+        }
+        return move_and_write(fs, index, start_block, required_blocks, data, size);
+    } else if (required_blocks > file->used_blocks) {
+        // Check if there is enough free space
+        if (required_blocks - file->used_blocks > fs->free_blocks) {
+            fs_printf("Error: Not enough space to update file '%s'.\n", file->name);
+            return -1;
+        }
 
-                strcpy(fs->current_path, temp_path);
-                printf("Current directory: %s\n", fs->current_path);
-                return;
-            }
+        // Find new continuous space for the file
+        int start_block = find_free_blocks(fs, required_blocks);
+        if (start_block == -1) {
+            fs_printf("Error: Not enough continuous space to update file '%s'.\n", file->name);
+            return -1;
         }
-        printf("Error: Directory '%s' not found.\n", path);
+        return move_and_write(fs, index, start_block, required_blocks, data, size);
     }
+
+    // Write the new content back to the original file
+    // 就地寫入失敗時舊內容可能已被部分覆寫，仍以新的大小重新索引
+    int result = storage_write((size_t)file->start_block * BLOCK_SIZE, data, size);
+    if (result == -1) {
+        fs_printf("Error: Could not write file '%s'; its content may be incomplete.\n", file->name);
+    } else {
+        STATS_ADD(STAT_BYTES_IN, size);
+    }
+    file->size = size;
+    file->extent_size = size;
+    trigram_index_update(fs, index);
+    return result;
 }
 
-void put(FileSystem *fs, const char *filename) {
+int put(FileSystem *fs, const char *filename) {
     FILE *file = fopen(filename, "r");
     if (!file) {
-        printf("Error: Could not open file '%s'.\n", filename);
-        return;
+        fs_printf("Error: Could not open file '%s'.\n", filename);
+        return -1;
     }
 
     fseek(file, 0, SEEK_END);
     int filesize = ftell(file); // ftell() 函數用來得到文件指標的當前位置
     fseek(file, 0, SEEK_SET);
 
-    //處理同檔名問題
-    for (int i = 0; i < fs->file_count; i++) {
-        if (strcmp(fs->files[i].name, filename) == 0 &&
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0) {
-            printf("Error: File '%s' already exists in the current directory.\n", filename);
-            fclose(file);
-            return;
-        }
+    // 以主機路徑的最後一段作為檔名
+    const char *basename = strrchr(filename, '/');
+    int index = alloc_file(fs, basename ? basename + 1 : filename, filesize);
+    if (index == -1) {
+        fclose(file);
+        return -1;
     }
 
-
-    int required_blocks = (filesize + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    if (required_blocks > fs->free_blocks) {
-        printf("Error: Not enough space to store file '%s'.\n", filename);
+    if (storage_read_from(file, (size_t)file_at(fs, index)->start_block * BLOCK_SIZE, filesize) == -1) {
+        fs_printf("Error: Could not read file '%s'.\n", filename);
+        discard_file(fs, index);
         fclose(file);
-        return;
+        return -1;
     }
+    STATS_ADD(STAT_BYTES_IN, filesize);
+    fclose(file);
+    trigram_index_add(fs, index);
+    fs_printf("File '%s' added to filesystem.\n", filename);
+    return 0;
+}
 
-    fs->files = (File *)realloc(fs->files, (fs->file_count + 1) * sizeof(File));
-    if (fs->files == NULL) {
-        printf("Error: Could not allocate memory for new file.\n");
-        fclose(file);
-        return;
+int get(FileSystem *fs, const char *filename) {
+    // 檢查 dump 資料夾是否存在，若不存在則建立
+    FILE *dir = fopen("dump", "r");
+    if (!dir) { // 如果無法開啟，假設資料夾不存在
+        system("mkdir dump"); // 使用系統指令建立資料夾
+    } else {
+        fclose(dir); // 如果能開啟，說明資料夾存在，關閉檔案
     }
 
-    // 檢查bitmask以找到足夠塞得下file的連續空間
-    int start_block = -1;
-    start_block = find_free_blocks(fs, required_blocks);
+    int i = find_file(fs, filename); // 檢查檔案是否在當前目錄
+    if (i != -1) {
+        // 構建完整的輸出路徑：dump/filename
+        char output_path[MAX_FILENAME + 5];
+        snprintf(output_path, sizeof(output_path), "dump/%s", filename);
+
+        // 打開 OS 檔案系統中的檔案進行寫入
+        FILE *file = fopen(output_path, "w");
+        if (!file) {
+            fs_printf("Error: Could not create file '%s'.\n", output_path);
+            return -1;
+        }
 
+        // 從虛擬檔案系統讀取內容並寫入到檔案
+        if (file_write_to(fs, i, file) == -1) {
+            fs_printf("Error: Could not write file '%s'.\n", output_path);
+            fclose(file);
+            return -1;
+        }
+        STATS_ADD(STAT_BYTES_OUT, file_at(fs, i)->size);
 
-    if (start_block == -1) {
-        printf("Error: Not enough continuous space to store file '%s'.\n", filename);
         fclose(file);
-        return;
+        fs_printf("File '%s' retrieved from filesystem to '%s'.\n", filename, output_path);
+        return 0;
     }
 
-    // 更新bitmask
-    set_bitmask(fs, start_block, required_blocks);
+    fs_printf("Error: File '%s' not found in the current directory.\n", filename);
+    return -1;
+}
 
 
-    File *new_file = &fs->files[fs->file_count];
-    strncpy(new_file->name, filename, MAX_FILENAME);
-    new_file->size = filesize;
-    new_file->used_blocks = required_blocks;
-    new_file->start_block = start_block;
-    new_file->is_directory = 0;
-    strcpy(new_file->parent_name, fs->current_path);
 
-    fread(storage + start_block * BLOCK_SIZE, filesize, 1, file);
-    fs->free_blocks -= required_blocks;
-    fs->file_count++;
-    fclose(file);
-    printf("File '%s' added to filesystem.\n", filename);
+int rm(FileSystem *fs, const char *filename) {
+    int i = find_file(fs, filename);
+    if (i != -1 && !file_at(fs, i)->is_directory) {
+        // 區塊還有其他檔案共用時保留，否則釋放並更新bitmask
+        release_file_extents(fs, i);
+
+        // 項目變成墓碑，之後新增項目時重用
+        trigram_index_remove(fs, i);
+        file_table_release(fs, i);
+        fs_printf("File '%s' removed from filesystem.\n", filename);
+        return 0;
+    }
+
+    fs_printf("Error: File '%s' not found.\n", filename);
+    return -1;
 }
 
-void get(FileSystem *fs, const char *filename) {
-    // 檢查 dump 資料夾是否存在，若不存在則建立
-    FILE *dir = fopen("dump", "r");
-    if (!dir) { // 如果無法開啟，假設資料夾不存在
-        system("mkdir dump"); // 使用系統指令建立資料夾
-    } else {
-        fclose(dir); // 如果能開啟，說明資料夾存在，關閉檔案
+// 找出 cp/mv 的目的地：既有目錄代表放進該目錄並沿用原名，否則最後一段為新名稱
+static int resolve_destination(FileSystem *fs, const char *destination, const char *source_name,
+                               int *parent, char *name) {
+    int index;
+    if (resolve_path(fs, destination, &index) == 0) {
+        if (index != ROOT_DIR && !file_at(fs, index)->is_directory) {
+            fs_printf("Error: '%s' already exists.\n", destination);
+            return -1;
+        }
+        *parent = index;
+        strcpy(name, source_name);
+    } else if (resolve_parent(fs, destination, parent, name) == -1) {
+        fs_printf("Error: Directory for '%s' not found.\n", destination);
+        return -1;
     }
+    if (file_table_lookup(fs, *parent, name) != -1) {
+        fs_printf("Error: '%s' already exists in the destination directory.\n", name);
+        return -1;
+    }
+    return 0;
+}
 
-    for (int i = 0; i < fs->file_count; i++) {
-        if (strcmp(fs->files[i].name, filename) == 0 &&
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0) { // 檢查檔案是否在當前目錄
-            // 構建完整的輸出路徑：dump/filename
-            char output_path[MAX_FILENAME + 5];
-            snprintf(output_path, sizeof(output_path), "dump/%s", filename);
+int cp(FileSystem *fs, const char *source, const char *destination) {
+    int src;
+    if (resolve_path(fs, source, &src) == -1 || src == ROOT_DIR) {
+        fs_printf("Error: File '%s' not found.\n", source);
+        return -1;
+    }
+    if (file_at(fs, src)->is_directory) {
+        fs_printf("Error: '%s' is a directory.\n", source);
+        return -1;
+    }
 
-            // 打開 OS 檔案系統中的檔案進行寫入
-            FILE *file = fopen(output_path, "w");
-            if (!file) {
-                printf("Error: Could not create file '%s'.\n", output_path);
-                return;
-            }
+    int parent;
+    char name[MAX_FILENAME];
+    if (resolve_destination(fs, destination, file_at(fs, src)->name, &parent, name) == -1) {
+        return -1;
+    }
 
-            // 從虛擬檔案系統讀取內容並寫入到檔案
-            fwrite(storage + (fs->files[i].start_block * BLOCK_SIZE), fs->files[i].size, 1, file);
+    int index = file_table_alloc(fs);
+    if (index == -1) {
+        fs_printf("Error: Could not allocate memory for new file.\n");
+        return -1;
+    }
 
-            fclose(file);
-            printf("File '%s' retrieved from filesystem to '%s'.\n", filename, output_path);
-            return;
-        }
+    // 新項目直接指向來源的區塊，不複製內容，兩邊之後誰先修改誰就搬到新的區塊
+    File *copy = file_at(fs, index);
+    snprintf(copy->name, sizeof(copy->name), "%s", name);
+    copy->is_directory = 0;
+    copy->parent = parent;
+    file_table_link(fs, index);
+    if (share_file_extents(fs, index, src) == -1) {
+        file_table_release(fs, index);
+        fs_printf("Error: Could not allocate memory for new file.\n");
+        return -1;
     }
+    trigram_index_copy(fs, index, src);
 
-    printf("Error: File '%s' not found in the current directory.\n", filename);
+    fs_printf("File '%s' copied to '%s' (%d blocks shared).\n", source, destination,
+              (file_at(fs, index)->size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    return 0;
 }
 
+int mv(FileSystem *fs, const char *source, const char *destination) {
+    int src;
+    if (resolve_path(fs, source, &src) == -1 || src == ROOT_DIR) {
+        fs_printf("Error: '%s' not found.\n", source);
+        return -1;
+    }
 
+    int parent;
+    char name[MAX_FILENAME];
+    if (resolve_destination(fs, destination, file_at(fs, src)->name, &parent, name) == -1) {
+        return -1;
+    }
 
-void rm(FileSystem *fs, const char *filename) {
-    for (int i = 0; i < fs->file_count; i++) {
-        if (strcmp(fs->files[i].name, filename) == 0 && strcmp(fs->files[i].parent_name, fs->current_path) == 0) {
-            fs->free_blocks += fs->files[i].used_blocks;
-            // 更新bitmask
-            clear_bitmask(fs, fs->files[i].start_block, fs->files[i].used_blocks);
-
-            // 移除File struct並將後面的元素往前遞補
-            for (int j = i; j < fs->file_count - 1; j++) {
-                fs->files[j] = fs->files[j + 1];
+    // 目錄不能搬到自己底下，只需沿著目的地往上檢查，成本與子樹大小無關
+    if (file_at(fs, src)->is_directory) {
+        for (int dir = parent; dir != ROOT_DIR; dir = file_at(fs, dir)->parent) {
+            if (dir == src) {
+                fs_printf("Error: Cannot move '%s' into itself.\n", source);
+                return -1;
             }
-            fs->file_count--;
-            fs->files = (File *)realloc(fs->files, fs->file_count * sizeof(File));
-            printf("File '%s' removed from filesystem.\n", filename);
-            return;
         }
     }
 
-    printf("Error: File '%s' not found.\n", filename);
+    file_table_move(fs, src, parent, name);
+    set_cwd(fs, fs->cwd); // 目前目錄可能在搬走的子樹中，重新組出路徑
+    fs_printf("'%s' moved to '%s'.\n", source, destination);
+    return 0;
 }
 
-void cat(FileSystem *fs, const char *filename) {
-    for (int i = 0; i < fs->file_count; i++) {
-        if (strcmp(fs->files[i].name, filename) == 0 &&
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0) {
-            printf("File '%s' content:\n", filename);
-            for (int j = 0; j < fs->files[i].size; j++) {
-                 printf("%c", storage[fs->files[i].start_block * BLOCK_SIZE + j]);
-            }
-
-            printf("\n");
-            return;
+int cat(FileSystem *fs, const char *filename) {
+    int i = find_file(fs, filename);
+    if (i != -1) {
+        fs_printf("File '%s' content:\n", filename);
+        if (file_write_to(fs, i, FS_OUT) == -1) {
+            fs_printf("\nError: Could not read file '%s'.\n", filename);
+            return -1;
         }
+        STATS_ADD(STAT_BYTES_OUT, file_at(fs, i)->size);
+
+        fs_printf("\n");
+        return 0;
     }
 
     // 檔案不存在
-    printf("Error: File '%s' not found in the current directory.\n", filename);
-
+    fs_printf("Error: File '%s' not found in the current directory.\n", filename);
+    return -1;
 }
 
-void status(FileSystem *fs) {
-    int used_blocks = 0, file_blocks = 0;
+int status(FileSystem *fs) {
+    // 共用的區塊只算一次，所以已使用的區塊數直接由剩餘區塊數推得
+    int used_blocks = fs->total_blocks - fs->free_blocks, file_blocks = 0;
      for (int i = 0; i < fs->file_count; i++) {
-         if (fs->files[i].used_blocks > 0) {
-             used_blocks += fs->files[i].used_blocks;
-             file_blocks += (fs->files[i].size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+         if (file_at(fs, i)->in_use == 1) {
+             file_blocks += (file_at(fs, i)->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
          }
      }
 
-    printf("partition size: %d\n", fs->partition_size);
-    printf("total blocks: %d\n", fs->total_blocks);
-    printf("used blocks: %d\n", used_blocks);
-    printf("files' blocks: %d\n", file_blocks);
-    printf("block size: %d\n", BLOCK_SIZE);
-    printf("free space: %d\n", fs->partition_size - (used_blocks * BLOCK_SIZE));
+    fs_printf("partition size: %d\n", fs->partition_size);
+    fs_printf("total blocks: %d\n", fs->total_blocks);
+    fs_printf("used blocks: %d\n", used_blocks);
+    fs_printf("files' blocks: %d\n", file_blocks);
+    fs_printf("block size: %d\n", BLOCK_SIZE);
+    fs_printf("free space: %d\n", fs->partition_size - (used_blocks * BLOCK_SIZE));
+    storage_print_status();
+    return 0;
 }
 
+// 搜尋一個檔案時 storage_scan 的狀態
+typedef struct {
+    const char *pattern;
+    int len;
+    const char *path;
+    int line;               // 下一段內容開頭所在的行號
+    char *partial;          // 上一段結尾還沒結束的那一行
+    size_t partial_len, partial_capacity;
+    int matches;
+    int failed;             // 配置不到 partial
+} GrepScan;
+
+// 印出 [data, end) 中相符的行，data 為一行的開頭；count_rest 時把最後一個相符處之後的換行也算進行號
+static void grep_lines(GrepScan *g, const char *data, const char *end, int count_rest) {
+    const char *line_start = data;
+    const char *found;
+    while ((found = find_substring(line_start, end - line_start, g->pattern, g->len)) != NULL) {
+        // 數出相符位置所在的行號
+        const char *nl;
+        while ((nl = memchr(line_start, '\n', found - line_start)) != NULL) {
+            line_start = nl + 1;
+            g->line++;
+        }
+        const char *line_end = memchr(found, '\n', end - found);
+        if (!line_end) {
+            line_end = end;
+        }
+        fs_printf("%s:%d: %.*s\n", g->path, g->line, (int)(line_end - line_start), line_start);
+        g->matches++;
+        if (line_end == end) {
+            return;
+        }
+        line_start = line_end + 1;
+        g->line++;
+    }
+    for (const char *nl = line_start; count_rest && (nl = memchr(nl, '\n', end - nl)) != NULL; nl++) {
+        g->line++;
+    }
+}
 
-void help() {
-    printf("List of commands:\n");
-    printf("'ls'      list directory\n");
-    printf("'cd'      change directory\n");
-    printf("'rm'      remove file\n");
-    printf("'mkdir'   make directory\n");
-    printf("'rmdir'   remove directory\n");
-    printf("'put'     put file into the space\n");
-    printf("'get'     get file from the space\n");
-    printf("'cat'     show content of a file\n");
-    printf("'status'  show status of the space\n");
-    printf("'create'  create a new text file\n");
-    printf("'edit'    edit an existing text file\n");
-    printf("'help'    list commands\n");
-    printf("'exit'    exit and save filesystem\n");
-}
-void create(FileSystem *fs, const char *filename) {
-    // 檢查是否已存在同名文件
-    for (int i = 0; i < fs->file_count; i++) {
-        if (strcmp(fs->files[i].name, filename) == 0 &&
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0) {
-            printf("Error: File '%s' already exists in the current directory.\n", filename);
+static void grep_append_partial(GrepScan *g, const char *data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (g->partial_len + len > g->partial_capacity) {
+        size_t capacity = g->partial_capacity ? g->partial_capacity : 256;
+        while (capacity < g->partial_len + len) {
+            capacity *= 2;
+        }
+        char *grown = realloc(g->partial, capacity);
+        if (!grown) {
+            g->failed = 1;
             return;
         }
+        g->partial = grown;
+        g->partial_capacity = capacity;
     }
+    memcpy(g->partial + g->partial_len, data, len);
+    g->partial_len += len;
+}
 
-    printf("Enter text content for the file '%s' (end with an empty line):\n", filename);
-    char content[1024];
-    char line[256];
-    content[0] = '\0';
+// 只比對完整的行：跨段的那一行先接在 partial 中，等到換行才比對，檔案結尾的那一行由 grep_file 處理
+static void grep_chunk(void *ctx, const char *data, size_t len) {
+    GrepScan *g = ctx;
+    const char *end = data + len;
+    if (g->partial_len > 0) {
+        const char *nl = memchr(data, '\n', len);
+        const char *rest = nl ? nl + 1 : end;
+        grep_append_partial(g, data, rest - data);
+        if (!nl) {
+            return;
+        }
+        grep_lines(g, g->partial, g->partial + g->partial_len, 1);
+        g->partial_len = 0;
+        data = rest;
+    }
+    const char *tail = end;
+    while (tail > data && tail[-1] != '\n') {
+        tail--;
+    }
+    grep_lines(g, data, tail, 1);
+    grep_append_partial(g, tail, end - tail);
+}
 
-    // 清除輸入緩衝區，避免殘留字符影響輸入
-    while (getchar() != '\n'); 
+static int grep_file(FileSystem *fs, int index, GrepScan *g, char *path, size_t path_size) {
+    build_path(fs, index, path, path_size);
+    g->line = 1;
+    g->partial_len = 0;
+    if (file_scan(fs, index, 0, grep_chunk, g) == -1) {
+        fs_printf("Error: Could not read '%s'.\n", path);
+        return -1;
+    }
+    // 最後一行沒有換行
+    if (g->partial_len > 0) {
+        grep_lines(g, g->partial, g->partial + g->partial_len, 0);
+    }
+    return 0;
+}
 
-    while (fgets(line, sizeof(line), stdin)) {
-        // 檢查是否為空行來結束輸入
-        if (strcmp(line, "\n") == 0) break;
-        strcat(content, line);
+// 在所有檔案中搜尋 pattern：先用 trigram 索引縮小候選檔案，再分段比對實際內容
+int grep(FileSystem *fs, const char *pattern) {
+    int len = strlen(pattern);
+    if (len == 0) {
+        fs_printf("Error: Empty search pattern.\n");
+        return -1;
     }
 
-    int filesize = strlen(content);
-    if (filesize == 0) {
-        printf("Error: File '%s' is empty. Please provide content.\n", filename);
-        return;
+    char path[MAX_PATH];
+    GrepScan g = { .pattern = pattern, .len = len, .path = path };
+    int result = 0;
+    int *candidates, candidate_count;
+    if (trigram_index_candidates(fs, pattern, len, &candidates, &candidate_count) == 0) {
+        for (int c = 0; c < candidate_count; c++) {
+            if (grep_file(fs, candidates[c], &g, path, sizeof(path)) == -1) {
+                result = -1;
+            }
+        }
+    } else {
+        // 記憶體不足以查詢索引，逐一掃描所有檔案
+        candidates = NULL;
+        for (int i = 0; i < fs->file_count; i++) {
+            File *file = file_at(fs, i);
+            if (file->in_use == 1 && !file->is_directory && grep_file(fs, i, &g, path, sizeof(path)) == -1) {
+                result = -1;
+            }
+        }
     }
+    free(candidates);
+    free(g.partial);
 
-    int required_blocks = (filesize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (g.failed) {
+        fs_printf("Error: Not enough memory for a long line; some matches may be missing.\n");
+        result = -1;
+    }
+    if (g.matches == 0 && result == 0) {
+        fs_printf("No matches for '%s'.\n", pattern);
+    }
+    return result;
+}
 
-    // 檢查是否有足夠的空間來存儲文件
-    if (required_blocks > fs->free_blocks) {
-        printf("Error: Not enough space to store file '%s'.\n", filename);
-        return;
+
+void help() {
+    fs_printf("List of commands:\n");
+    fs_printf("'ls'      list directory (-s name|size, -r reverse, -p page, -n entries per page)\n");
+    fs_printf("'cd'      change directory\n");
+    fs_printf("'rm'      remove file\n");
+    fs_printf("'mkdir'   make directory\n");
+    fs_printf("'rmdir'   remove directory\n");
+    fs_printf("'put'     put file into the space\n");
+    fs_printf("'get'     get file from the space\n");
+    fs_printf("'cat'     show content of a file\n");
+    fs_printf("'status'  show status of the space\n");
+    fs_printf("'bitmap'  summarize used and free block runs (optional number of runs to list)\n");
+    fs_printf("'create'  create a new text file\n");
+    fs_printf("'edit'    edit an existing text file\n");
+    fs_printf("'cp'      copy a file (blocks are shared until modified)\n");
+    fs_printf("'mv'      move or rename a file or directory\n");
+    fs_printf("'grep'    search file contents for a string\n");
+    fs_printf("'snapshot' create|list|rollback|delete|save named snapshots\n");
+    fs_printf("'stats'   show command latencies and counters (json [file] | reset)\n");
+    fs_printf("'trace'   record operations for fsreplay (start <file> | stop)\n");
+    fs_printf("'serve'   serve this filesystem over a Unix socket\n");
+    fs_printf("'help'    list commands\n");
+    fs_printf("'exit'    exit and save filesystem\n");
+}
+// 從 stdin 讀取多行文字直到空行，回傳 malloc 的緩衝區（呼叫者負責 free），*size 為長度
+static char *read_text_lines(int *size) {
+    char *content = NULL;
+    size_t length = 0, capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &line_capacity, stdin)) > 0) {
+        // 檢查是否為空行來結束輸入
+        if (strcmp(line, "\n") == 0) break;
+        if (length + n + 1 > capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            while (length + n + 1 > capacity) {
+                capacity *= 2;
+            }
+            content = realloc(content, capacity);
+        }
+        memcpy(content + length, line, n);
+        length += n;
     }
+    free(line);
 
-    // 尋找空閒的區塊來存儲文件
-    int start_block = find_free_blocks(fs, required_blocks);
-    if (start_block == -1) {
-        printf("Error: Not enough continuous space to store file '%s'.\n", filename);
-        return;
+    if (!content) {
+        content = malloc(1);
     }
+    content[length] = '\0';
+    *size = (int)length;
+    return content;
+}
 
-    // 動態分配新的文件結構
-    fs->files = (File *)realloc(fs->files, (fs->file_count + 1) * sizeof(File));
-    if (fs->files == NULL) {
-        printf("Error: Could not allocate memory for new file.\n");
-        return;
+int create(FileSystem *fs, const char *filename) {
+    // 檢查是否已存在同名文件
+    if (find_file(fs, filename) != -1) {
+        fs_printf("Error: File '%s' already exists in the current directory.\n", filename);
+        return -1;
     }
 
-    // 初始化新文件
-    File *new_file = &fs->files[fs->file_count];
-    strncpy(new_file->name, filename, MAX_FILENAME);
-    new_file->size = filesize;
-    new_file->start_block = start_block;
-    new_file->used_blocks = required_blocks;
-    new_file->is_directory = 0;
-    strncpy(new_file->parent_name, fs->current_path, MAX_FILENAME);
+    fs_printf("Enter text content for the file '%s' (end with an empty line):\n", filename);
+
+    // 清除輸入緩衝區，避免殘留字符影響輸入
+    while (getchar() != '\n');
 
-    // 更新位元遮罩並寫入文件內容到存儲空間
-    set_bitmask(fs, start_block, required_blocks);
-    memcpy(storage + start_block * BLOCK_SIZE, content, filesize);
+    int filesize;
+    char *content = read_text_lines(&filesize);
+    if (filesize == 0) {
+        fs_printf("Error: File '%s' is empty. Please provide content.\n", filename);
+        free(content);
+        return -1;
+    }
 
-    fs->free_blocks -= required_blocks;
-    fs->file_count++;
+    // 配置空間並寫入文件內容到存儲空間
+    int index = write_new_file(fs, filename, content, filesize);
+    free(content);
+    if (index == -1) {
+        return -1;
+    }
 
-    printf("Text file '%s' created successfully.\n", filename);
+    fs_printf("Text file '%s' created successfully.\n", filename);
+    return 0;
 }
 
+static void edit_help() {
+    fs_printf("Edit commands:\n");
+    fs_printf("  p [line] [count]  print lines (default: 20 lines from line 1)\n");
+    fs_printf("  i <line>          insert lines before <line> (end with an empty line)\n");
+    fs_printf("  a                 append lines at the end (end with an empty line)\n");
+    fs_printf("  r <line>          replace one line\n");
+    fs_printf("  d <line> [count]  delete lines\n");
+    fs_printf("  w [new name]      save changes (to a new file if a name is given)\n");
+    fs_printf("  q                 quit editing (unsaved changes are discarded)\n");
+}
 
+// 從第 first 行開始印出 count 行，並加上行號
+static void print_lines(const PieceTable *pt, int first, int count) {
+    int offset = pt_line_offset(pt, first);
+    if (offset < 0 || offset >= pt->length) {
+        fs_printf("Error: Line %d does not exist.\n", first);
+        return;
+    }
+    char chunk[4096];
+    int line = first, at_line_start = 1;
+    while (offset < pt->length && line < first + count) {
+        int n = pt_read(pt, offset, chunk, sizeof(chunk));
+        if (n <= 0) {
+            fs_printf("\nError: Could not read line %d.\n", line);
+            return;
+        }
+        int i;
+        for (i = 0; i < n && line < first + count; i++) {
+            if (at_line_start) {
+                fs_printf("%6d  ", line);
+                at_line_start = 0;
+            }
+            fputc(chunk[i], FS_OUT);
+            if (chunk[i] == '\n') {
+                line++;
+                at_line_start = 1;
+            }
+        }
+        offset += i;
+    }
+    if (!at_line_start) {
+        fs_printf("\n");
+    }
+}
+
+// 第 line 行的範圍 [*begin, *end)，行不存在回傳 -1
+static int line_range(const PieceTable *pt, int line, int count, int *begin, int *end) {
+    *begin = pt_line_offset(pt, line);
+    if (*begin < 0 || *begin >= pt->length || count < 1) {
+        fs_printf("Error: Line %d does not exist.\n", line);
+        return -1;
+    }
+    *end = pt_line_offset(pt, line + count);
+    if (*end < 0) {
+        *end = pt->length; // 超過最後一行就刪到檔案結尾
+    }
+    return 0;
+}
 
-void edit(FileSystem *fs, const char *filename) {
+int edit(FileSystem *fs, const char *filename, void (*saved_as)(FileSystem *fs, const char *name)) {
     // Check if the file exists and is not a directory
-    for (int i = 0; i < fs->file_count; i++) {
-        if (strcmp(fs->files[i].name, filename) == 0 &&
-            strcmp(fs->files[i].parent_name, fs->current_path) == 0 &&
-            !fs->files[i].is_directory) {
-
-            // Load existing content into editable_content
-            char editable_content[1024];
-            memset(editable_content, 0, sizeof(editable_content));
-            memcpy(editable_content, storage + fs->files[i].start_block * BLOCK_SIZE, fs->files[i].size);
-            editable_content[fs->files[i].size] = '\0'; // Null-terminate for safety
-
-            printf("Editing '%s'.\n", filename);
-            printf("--- Current Content Below ---\n");
-            printf("%s\n", editable_content); // Display the existing content
-
-            char new_content[1024];
-            memset(new_content, 0, sizeof(new_content)); // Initialize new content buffer
-
-            printf("\n--- Modify the content below. Enter the updated content line by line ---\n");
-            printf("--- Current content is preloaded. Leave blank to keep, type '-d' to delete. ---\n");
-
-            char line[256]; // Buffer for user input
-            char *line_ptr = strtok(editable_content, "\n"); // Tokenize original content by lines
-            while (getchar() != '\n'); 
-            // Loop through each line of the original content
-            while (line_ptr) {
-                printf("Original: %s\nEdit (leave blank to keep, type '-d' to delete): ", line_ptr);
-                fgets(line, sizeof(line), stdin);
-
-                // Remove trailing newline from input
-                line[strcspn(line, "\n")] = '\0';
-
-                if (strcmp(line, "-d") == 0) {
-                    // If user types "-d", skip this line (delete it)
-                    printf("Line deleted.\n");
-                } else if (strcmp(line, "") == 0) {
-                    // If user leaves input blank, keep the original line
-                    strcat(new_content, line_ptr);
-                    strcat(new_content, "\n");
-                } else {
-                    // Replace with new content
-                    strcat(new_content, line);
-                    strcat(new_content, "\n");
-                }
+    int i = find_file(fs, filename);
+    if (i == -1 || file_at(fs, i)->is_directory) {
+        fs_printf("Error: File '%s' not found in the current directory.\n", filename);
+        return -1;
+    }
 
-                line_ptr = strtok(NULL, "\n"); // Move to the next line
-            }
+    // 以檔案目前的區塊作為原始內容，編輯只記錄在 piece table 中
+    PieceTable pt;
+    if (pt_open(&pt, fs, i) == -1) {
+        return -1;
+    }
+    int modified = 0;
 
-            // Allow user to add additional lines
-            printf("Add additional lines (end with an empty line):\n");
-            while (fgets(line, sizeof(line), stdin)) {
-                if (strcmp(line, "\n") == 0) break; // Stop on empty line
-                strcat(new_content, line); // Append additional content
-            }
+    fs_printf("Editing '%s' (%d bytes, %d lines).\n", filename, pt.length, pt_line_count(&pt));
+    edit_help();
+    if (pt.length > 0) {
+        print_lines(&pt, 1, 20);
+    }
 
-            int new_size = strlen(new_content);
-            if (new_size == 0) {
-                printf("Error: New content is empty. Editing aborted.\n");
-                return;
-            }
+    // 清除輸入緩衝區
+    while (getchar() != '\n');
 
-            // Ask the user whether to save as original or new file
-            char save_choice[10];
-            printf("Do you want to save changes as the original file '%s'? (yes/no): ", filename);
-            fgets(save_choice, sizeof(save_choice), stdin);
-            save_choice[strcspn(save_choice, "\n")] = '\0'; // Remove newline
-
-            if (strcmp(save_choice, "no") == 0) {
-                // Ask for a new filename
-                char new_filename[MAX_FILENAME];
-                printf("Enter new filename: ");
-                fgets(new_filename, sizeof(new_filename), stdin);
-                new_filename[strcspn(new_filename, "\n")] = '\0'; // Remove newline
-
-                // Check if the new filename already exists in the current directory
-                for (int j = 0; j < fs->file_count; j++) {
-                    if (strcmp(fs->files[j].name, new_filename) == 0 &&
-                        strcmp(fs->files[j].parent_name, fs->current_path) == 0) {
-                        printf("Error: File '%s' already exists in the current directory.\n", new_filename);
-                        return;
-                    }
-                }
+    char *input = NULL;
+    size_t input_capacity = 0;
+    int result = 0;
+    for (;;) {
+        fs_printf("edit> ");
+        if (getline(&input, &input_capacity, stdin) <= 0) {
+            break;
+        }
 
-                // Create a new file with the new content
-                int required_blocks = (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-                if (required_blocks > fs->free_blocks) {
-                    printf("Error: Not enough space to create new file '%s'.\n", new_filename);
-                    return;
+        char cmd = 0;
+        int line = 0, count = 1;
+        char new_filename[MAX_FILENAME];
+        int args = sscanf(input, " %c %d %d", &cmd, &line, &count);
+
+        if (cmd == 'p') {
+            print_lines(&pt, args >= 2 ? line : 1, args >= 3 ? count : 20);
+        } else if (cmd == 'i' || cmd == 'a') {
+            int offset;
+            if (cmd == 'a') {
+                offset = pt.length;
+            } else if (args < 2 || (offset = pt_line_offset(&pt, line)) < 0) {
+                fs_printf("Error: Line %d does not exist.\n", line);
+                continue;
+            }
+            fs_printf("Enter lines to insert (end with an empty line):\n");
+            int size;
+            char *text = read_text_lines(&size);
+            // 最後一行沒有換行時，接在後面的文字要先換行
+            int inserted = 0;
+            if (size > 0 && offset == pt.length && pt.length > 0) {
+                char last;
+                if (pt_read(&pt, pt.length - 1, &last, 1) == 1 && last != '\n') {
+                    inserted = pt_insert(&pt, offset++, "\n", 1);
                 }
-
-                int start_block = find_free_blocks(fs, required_blocks);
-                if (start_block == -1) {
-                    printf("Error: Not enough continuous space to create new file '%s'.\n", new_filename);
-                    return;
+            }
+            if (inserted == -1 || pt_insert(&pt, offset, text, size) == -1) {
+                fs_printf("Error: Not enough memory to insert the text.\n");
+                result = -1;
+            }
+            modified |= size > 0;
+            free(text);
+        } else if (cmd == 'r' && args >= 2) {
+            int begin, end;
+            if (line_range(&pt, line, 1, &begin, &end) == -1) {
+                continue;
+            }
+            fs_printf("New text for line %d: ", line);
+            char *text = NULL;
+            size_t text_capacity = 0;
+            ssize_t size = getline(&text, &text_capacity, stdin);
+            if (size > 0) {
+                char last;
+                if (pt_read(&pt, end - 1, &last, 1) == 1 && last != '\n' && text[size - 1] == '\n') {
+                    size--; // 原本的最後一行沒有換行，維持原樣
                 }
-
-                fs->files = (File *)realloc(fs->files, (fs->file_count + 1) * sizeof(File));
-                if (!fs->files) {
-                    printf("Error: Memory allocation failed.\n");
-                    return;
+                if (pt_delete(&pt, begin, end - begin) == -1 || pt_insert(&pt, begin, text, (int)size) == -1) {
+                    fs_printf("Error: Not enough memory to replace line %d.\n", line);
+                    result = -1;
                 }
-
-                File *new_file = &fs->files[fs->file_count];
-                strncpy(new_file->name, new_filename, MAX_FILENAME);
-                new_file->size = new_size;
-                new_file->start_block = start_block;
-                new_file->used_blocks = required_blocks;
-                new_file->is_directory = 0;
-                strncpy(new_file->parent_name, fs->current_path, MAX_FILENAME);
-
-                set_bitmask(fs, start_block, required_blocks);
-                memcpy(storage + start_block * BLOCK_SIZE, new_content, new_size);
-
-                fs->free_blocks -= required_blocks;
-                fs->file_count++;
-
-                printf("File '%s' created successfully.\n", new_filename);
-                return;
+                modified = 1;
             }
-
-            // Overwrite the original file
-            int required_blocks = (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-            if (required_blocks > fs->files[i].used_blocks) {
-                // Check if there is enough free space
-                if (required_blocks - fs->files[i].used_blocks > fs->free_blocks) {
-                    printf("Error: Not enough space to update file '%s'.\n", filename);
-                    return;
+            free(text);
+        } else if (cmd == 'd' && args >= 2) {
+            int begin, end;
+            if (line_range(&pt, line, count, &begin, &end) == -1) {
+                continue;
+            }
+            if (pt_delete(&pt, begin, end - begin) == -1) {
+                fs_printf("Error: Not enough memory to delete line(s).\n");
+                result = -1;
+                continue;
+            }
+            modified = 1;
+            fs_printf("Line(s) deleted.\n");
+        } else if (cmd == 'w') {
+            if (pt.length == 0) {
+                fs_printf("Error: New content is empty. Editing aborted.\n");
+                continue;
+            }
+            if (sscanf(input, " w %254s", new_filename) == 1) {
+                // 另存新檔
+                int index = alloc_file(fs, new_filename, pt.length);
+                if (index == -1) {
+                    result = -1;
+                    continue;
                 }
-
-                // Find new continuous space for the file
-                int start_block = find_free_blocks(fs, required_blocks);
-                if (start_block == -1) {
-                    printf("Error: Not enough continuous space to update file '%s'.\n", filename);
-                    return;
+                if (pt_store(&pt, (size_t)file_at(fs, index)->start_block * BLOCK_SIZE) == -1) {
+                    fs_printf("Error: Could not write file '%s'.\n", new_filename);
+                    discard_file(fs, index);
+                    result = -1;
+                    continue;
                 }
-
-                // Free the old space and update bitmask
-                clear_bitmask(fs, fs->files[i].start_block, fs->files[i].used_blocks);
-                fs->free_blocks += fs->files[i].used_blocks;
-
-                // Allocate new space
-                set_bitmask(fs, start_block, required_blocks);
-                fs->files[i].start_block = start_block;
-                fs->files[i].used_blocks = required_blocks;
-                fs->free_blocks -= required_blocks;
+                STATS_ADD(STAT_BYTES_IN, pt.length);
+                trigram_index_add(fs, index);
+                fs_printf("File '%s' created successfully.\n", new_filename);
+                if (saved_as) {
+                    saved_as(fs, new_filename);
+                }
+                result = 0;
+                continue;
             }
-
-            // Write the new content back to the original file
-            memcpy(storage + fs->files[i].start_block * BLOCK_SIZE, new_content, new_size);
-            fs->files[i].size = new_size;
-
-            printf("File '%s' updated successfully.\n", filename);
-            return;
+            int written = pt_save(fs, i, &pt);
+            if (written == -1) {
+                result = -1;
+                continue;
+            }
+            fs_printf("File '%s' updated successfully (%d of %d blocks written).\n",
+                   filename, written, (file_at(fs, i)->size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            // 存檔後檔案內容已經改變，以新內容重新開始
+            pt_free(&pt);
+            modified = 0;
+            result = 0;
+            if (pt_open(&pt, fs, i) == -1) {
+                result = -1;
+                break;
+            }
+        } else if (cmd == 'q') {
+            break;
+        } else if (cmd != 0) {
+            edit_help();
         }
     }
 
-    printf("Error: File '%s' not found in the current directory.\n", filename);
+    if (modified) {
+        fs_printf("Unsaved changes to '%s' discarded.\n", filename);
+    }
+    free(input);
+    pt_free(&pt);
+    return result;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
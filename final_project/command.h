@@ -1,37 +1,72 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 #include "filesystem.h"
+#include "filetable.h"
+#include "piece_table.h"
+#include "trigram.h"
 
-// 列出目錄內容
-void ls(FileSystem *fs);
+// 以下指令成功回傳 0，失敗回傳 -1（錯誤訊息會直接印出）
+
+#define LS_PAGE_SIZE 50   // ls -p 每頁的預設項目數
+#define BITMAP_RUNS 32    // bitmap 預設列出的區段數
+
+// 列出目前目錄的內容，options 為「-s name|size」「-r」「-p 頁數」「-n 每頁項目數」的組合
+int ls(FileSystem *fs, const char *options);
+
+// 以連續區段與密度圖顯示區塊使用情形，options 可指定列出的區段數
+int bitmap(FileSystem *fs, const char *options);
 
 // 建立目錄
-void mkdir(FileSystem *fs, const char *dirname);
+int mkdir(FileSystem *fs, const char *dirname);
 
 // 刪除目錄
-void rmdir(FileSystem *fs, const char *dirname);
+int rmdir(FileSystem *fs, const char *dirname);
 
 // 切換目錄
-void cd(FileSystem *fs, const char *path);
+int cd(FileSystem *fs, const char *path);
 
 // 將檔案存入檔案系統
-void put(FileSystem *fs, const char *filename);
+int put(FileSystem *fs, const char *filename);
 
 // 從檔案系統取出檔案
-void get(FileSystem *fs, const char *filename);
+int get(FileSystem *fs, const char *filename);
 
 // 刪除檔案
-void rm(FileSystem *fs, const char *filename);
+int rm(FileSystem *fs, const char *filename);
+
+// 複製檔案，新檔案與來源共用區塊，任一方修改時才複製（copy-on-write）
+int cp(FileSystem *fs, const char *source, const char *destination);
+
+// 搬移或改名檔案或目錄，只改變一個父目錄連結
+int mv(FileSystem *fs, const char *source, const char *destination);
 
 // 顯示檔案內容
-void cat(FileSystem *fs, const char *filename);
+int cat(FileSystem *fs, const char *filename);
 
 // 顯示檔案系統狀態
-void status(FileSystem *fs);
+int status(FileSystem *fs);
+
+// 在所有檔案中搜尋字串，印出相符的行
+int grep(FileSystem *fs, const char *pattern);
+
+int create(FileSystem *fs, const char *filename) ;
+
+// 互動編輯檔案；每次以「w <新檔名>」另存新檔成功後呼叫 saved_as（可為 NULL），例如讓 trace 記錄新檔案
+int edit(FileSystem *fs, const char *filename, void (*saved_as)(FileSystem *fs, const char *name)) ;
+
+// 找出當前目錄下的項目，回傳索引，找不到回傳 -1
+int find_file(FileSystem *fs, const char *name);
+
+// 在當前目錄建立檔案項目並配置區塊，回傳索引，失敗回傳 -1
+int alloc_file(FileSystem *fs, const char *filename, int size);
+
+// 建立新檔案並寫入內容，回傳索引，失敗回傳 -1
+int write_new_file(FileSystem *fs, const char *filename, const char *data, int size);
+
+// 覆寫既有檔案的內容
+int overwrite_file(FileSystem *fs, int index, const char *data, int size);
 
-void create(FileSystem *fs, const char *filename) ;
-void edit(FileSystem *fs, const char *filename) ;
 // 列出可用指令
 void help();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,200 @@
+#include "dispatch.h"
+#include "command.h"
+#include "snapshot.h"
+#include "stats.h"
+
+// 不需要互動輸入的 create：檢查內容後建立文字檔
+static int create_with_content(FileSystem *fs, const char *filename, const char *data, int size) {
+    if (find_file(fs, filename) != -1) {
+        fs_printf("Error: File '%s' already exists in the current directory.\n", filename);
+        return -1;
+    }
+    if (size == 0) {
+        fs_printf("Error: File '%s' is empty. Please provide content.\n", filename);
+        return -1;
+    }
+    if (write_new_file(fs, filename, data, size) == -1) {
+        return -1;
+    }
+    fs_printf("Text file '%s' created successfully.\n", filename);
+    return 0;
+}
+
+// 以 piece table 套用一段編輯，只寫回有變動的區塊
+static int edit_span(FileSystem *fs, const char *filename, const char *data, size_t len) {
+    int i = find_file(fs, filename);
+    if (i == -1 || file_at(fs, i)->is_directory) {
+        fs_printf("Error: File '%s' not found in the current directory.\n", filename);
+        return -1;
+    }
+    FsEditSpan span;
+    if (len < sizeof(span)) {
+        fs_printf("Error: Malformed edit request.\n");
+        return -1;
+    }
+    memcpy(&span, data, sizeof(span));
+
+    PieceTable pt;
+    if (pt_open(&pt, fs, i) == -1) {
+        return -1;
+    }
+    int result = -1;
+    if (pt_delete(&pt, (int)span.offset, (int)span.delete_len) == -1 ||
+        pt_insert(&pt, (int)span.offset, data + sizeof(span), (int)(len - sizeof(span))) == -1) {
+        fs_printf("Error: Edit range is outside of file '%s'.\n", filename);
+    } else if (pt.length == 0) {
+        fs_printf("Error: New content is empty. Editing aborted.\n");
+    } else {
+        int written = pt_save(fs, i, &pt);
+        if (written != -1) {
+            fs_printf("File '%s' updated successfully (%d of %d blocks written).\n",
+                   filename, written, (file_at(fs, i)->size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            result = 0;
+        }
+    }
+    pt_free(&pt);
+    return result;
+}
+
+static int put_with_content(FileSystem *fs, const char *filename, const char *data, int size) {
+    if (write_new_file(fs, filename, data, size) == -1) {
+        return -1;
+    }
+    fs_printf("File '%s' added to filesystem.\n", filename);
+    return 0;
+}
+
+static int get_to_stream(FileSystem *fs, const char *filename, FILE *out) {
+    int i = find_file(fs, filename);
+    if (i == -1 || file_at(fs, i)->is_directory) {
+        fs_printf("Error: File '%s' not found in the current directory.\n", filename);
+        return -1;
+    }
+    if (file_write_to(fs, i, out) == -1) {
+        fs_printf("Error: Could not read file '%s'.\n", filename);
+        return -1;
+    }
+    STATS_ADD(STAT_BYTES_OUT, file_at(fs, i)->size);
+    return 0;
+}
+
+// 資料為目的地路徑（不含 '\0'）
+static int copy_or_move(FileSystem *fs, int op, const char *source, const char *data, size_t len) {
+    char destination[MAX_PATH];
+    if (len == 0 || len >= sizeof(destination)) {
+        fs_printf("Error: Invalid destination.\n");
+        return -1;
+    }
+    memcpy(destination, data, len);
+    destination[len] = '\0';
+    return op == FS_OP_CP ? cp(fs, source, destination) : mv(fs, source, destination);
+}
+
+static int snapshot_with_password(FileSystem *fs, const char *args, const char *data, size_t len) {
+    char password[256];
+    if (len >= sizeof(password)) {
+        fs_printf("Error: Password too long.\n");
+        return -1;
+    }
+    memcpy(password, data, len);
+    password[len] = '\0';
+    return snapshot_command(fs, args, password);
+}
+
+static int save_with_password(FileSystem *fs, const char *filename, const char *data, size_t len) {
+    char password[256];
+    if (len >= sizeof(password)) {
+        fs_printf("Error: Password too long.\n");
+        return -1;
+    }
+    memcpy(password, data, len);
+    password[len] = '\0';
+    return store_filesystem(fs, filename, password);
+}
+
+// 把 client 指定的檔名換成 save_dir 下的路徑，不接受含目錄的檔名
+static int client_path(const char *save_dir, const char *filename, char *path, size_t size, FILE *out) {
+    if (!save_dir) {
+        fprintf(out, "Error: Clients may not write host files (start the server with FS_SAVE_DIR set).\n");
+        return -1;
+    }
+    if (filename[0] == '\0' || strchr(filename, '/') || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
+        fprintf(out, "Error: '%s' is not a plain file name.\n", filename);
+        return -1;
+    }
+    if (snprintf(path, size, "%s/%s", save_dir, filename) >= (int)size) {
+        fprintf(out, "Error: File name '%s' is too long.\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int execute_client_op(FileSystem *fs, const FsOp *op, FILE *out, const char *save_dir) {
+    FsOp checked = *op;
+    char args[MAX_PATH], path[MAX_FILENAME];
+    char action[16] = "", name[MAX_FILENAME] = "", filename[MAX_FILENAME] = "";
+
+    if (op->op == FS_OP_SAVE) {
+        if (client_path(save_dir, op->name, args, sizeof(args), out) == -1) {
+            return -1;
+        }
+        checked.name = args;
+    } else if (op->op == FS_OP_SNAPSHOT) {
+        // 與 snapshot_command 相同的解析方式
+        if (sscanf(op->name, "%15s %254s %254s", action, name, filename) == 3 && strcmp(action, "save") == 0) {
+            if (client_path(save_dir, filename, path, sizeof(path), out) == -1) {
+                return -1;
+            }
+            snprintf(args, sizeof(args), "save %s %s", name, path);
+            checked.name = args;
+        }
+    } else if (op->op == FS_OP_STATS) {
+        if (sscanf(op->name, "%15s %254s", action, filename) == 2 && strcmp(action, "json") == 0) {
+            if (client_path(save_dir, filename, path, sizeof(path), out) == -1) {
+                return -1;
+            }
+            snprintf(args, sizeof(args), "json %s", path);
+            checked.name = args;
+        }
+    }
+    return execute_op(fs, &checked, out);
+}
+
+int execute_op(FileSystem *fs, const FsOp *op, FILE *out) {
+    int size = (int)op->data_len;
+    int result = -1;
+    STATS_TIMER(start);
+
+    // 指令都用 fs_printf 輸出，執行期間把這個執行緒的輸出導向 out
+    FILE *saved_output = fs_output;
+    fs_output = out;
+
+    switch (op->op) {
+    case FS_OP_LS:     result = ls(fs, op->name); break;
+    case FS_OP_MKDIR:  result = mkdir(fs, op->name); break;
+    case FS_OP_RMDIR:  result = rmdir(fs, op->name); break;
+    case FS_OP_CD:     result = cd(fs, op->name); break;
+    case FS_OP_PUT:    result = put_with_content(fs, op->name, op->data, size); break;
+    case FS_OP_GET:    result = get_to_stream(fs, op->name, out); break;
+    case FS_OP_RM:     result = rm(fs, op->name); break;
+    case FS_OP_CAT:    result = cat(fs, op->name); break;
+    case FS_OP_STATUS: result = status(fs); break;
+    case FS_OP_BITMAP: result = bitmap(fs, op->name); break;
+    case FS_OP_CREATE: result = create_with_content(fs, op->name, op->data, size); break;
+    case FS_OP_EDIT:   result = edit_span(fs, op->name, op->data, op->data_len); break;
+    case FS_OP_HELP:   help(); result = 0; break;
+    case FS_OP_GREP:   result = grep(fs, op->name); break;
+    case FS_OP_CP:
+    case FS_OP_MV:     result = copy_or_move(fs, op->op, op->name, op->data, op->data_len); break;
+    case FS_OP_SNAPSHOT: result = snapshot_with_password(fs, op->name, op->data, op->data_len); break;
+    case FS_OP_SAVE:   result = save_with_password(fs, op->name, op->data, op->data_len); break;
+    case FS_OP_STATS:  result = stats_command(op->name); break;
+    default:
+        fs_printf("Error: Unknown operation %d.\n", op->op);
+        break;
+    }
+
+    fs_output = saved_output;
+    STATS_OP(op->op, start);
+    return result;
+}
@@ -0,0 +1,22 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "filesystem.h"
+#include "protocol.h"
+
+// 一個已解析的操作（name 必須以 '\0' 結尾）
+typedef struct {
+    int op;               // FS_OP_*
+    const char *name;
+    const char *data;
+    size_t data_len;
+} FsOp;
+
+// 對 fs 執行一個操作，指令輸出寫到 out，回傳指令的結果（0 或 -1）
+int execute_op(FileSystem *fs, const FsOp *op, FILE *out);
+
+// 執行 socket client 送來的操作：會寫入主機檔案的 save、snapshot save 與 stats json <file>
+// 只接受單純的檔名並寫到 save_dir 之下，save_dir 為 NULL 時拒絕
+int execute_client_op(FileSystem *fs, const FsOp *op, FILE *out, const char *save_dir);
+
+#endif
@@ -1,133 +1,455 @@
 #include "filesystem.h"
+#include "filetable.h"
+#include "trigram.h"
+#include "stats.h"
+#include "image.h"
 #define ENCRYPTION_KEY 0xAA // 加密使用的簡單密鑰
 
-char storage[1024000]; // 假設storage最大儲存空間大小為 1000KB
+__thread FILE *fs_output = NULL;
 
-void init_filesystem(FileSystem *fs, int size, int storage_start_block) {
-    if (size > sizeof(storage) - storage_start_block * BLOCK_SIZE) {
-        printf("Error: Partition size exceeds storage capacity.\n");
-        return;
+int init_filesystem(FileSystem *fs, int size, int storage_start_block) {
+    if (storage_reserve((size_t)storage_start_block * BLOCK_SIZE + size) == -1) {
+        fs_printf("Error: Partition size exceeds storage capacity.\n");
+        return -1;
     }
 
     fs->partition_size = size;
     fs->total_blocks = size / BLOCK_SIZE;
     fs->free_blocks = fs->total_blocks;
     fs->storage_start_block = storage_start_block;
-    fs->file_count = 0;
-    fs->files = NULL;
-    fs->used_blocks_bitmask = malloc(fs->total_blocks / 8);
-    memset(storage + storage_start_block * BLOCK_SIZE, 0, size); // 清空分區指定區域的記憶體初始化為零(記憶體起始位置, 初始化值, 初始化大小)
-    strcpy(fs->current_path, "/"); // 設定根目錄
+    fs->alloc_hint = 0;
+    file_table_init(fs);
+    fs->used_blocks_bitmask = calloc(BITMASK_BYTES(fs), 1);
+    fs->extent_refs = calloc(fs->total_blocks > 0 ? fs->total_blocks : 1, sizeof(int));
+    fs->extent_gen = calloc(fs->total_blocks > 0 ? fs->total_blocks : 1, sizeof(int));
+    fs->generation = 0;
+    fs->frozen_generation = -1;
+    fs->snapshots = NULL;
+    fs->snapshot_count = 0;
+    fs->trigram_index = trigram_index_create();
+    if (storage_zero((size_t)storage_start_block * BLOCK_SIZE, size) == -1) { // 清空分區指定區域初始化為零
+        fs_printf("Error: Could not initialize the partition.\n");
+        return -1;
+    }
+    set_cwd(fs, ROOT_DIR); // 設定根目錄
+    return 0;
 }
 
 
 
+void free_filesystem(FileSystem *fs) {
+    file_table_free(fs);
+    trigram_index_destroy(fs->trigram_index);
+    fs->trigram_index = NULL;
+    free(fs->used_blocks_bitmask);
+    free(fs->extent_refs);
+    free(fs->extent_gen);
+    fs->used_blocks_bitmask = NULL;
+    fs->extent_refs = NULL;
+    fs->extent_gen = NULL;
+}
+
 void encrypt(char *data, size_t size) {
     for (size_t i = 0; i < size; i++) {
         data[i] ^= ENCRYPTION_KEY;
     }
 }
 
-void save_filesystem(FileSystem *fs, const char *filename) {
+int write_encrypted(FILE *file, const void *data, size_t size) {
+    char buffer[64 * 1024];
+    const char *p = data;
+    while (size > 0) {
+        size_t n = size < sizeof(buffer) ? size : sizeof(buffer);
+        memcpy(buffer, p, n);
+        STATS_TIMER(encrypt_start);
+        encrypt(buffer, n);
+        STATS_PHASE(STAT_SAVE_ENCRYPT, encrypt_start);
+        STATS_TIMER(write_start);
+        if (fwrite(buffer, 1, n, file) != n) {
+            return -1;
+        }
+        STATS_PHASE(STAT_SAVE_WRITE, write_start);
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int write_image_header(FILE *file, const FileSystem *header) {
+    ImageHeader image = { .magic = IMAGE_MAGIC, .version = IMAGE_VERSION,
+                          .header_size = sizeof(FileSystem), .entry_size = sizeof(File) };
+    if (fwrite(&image, sizeof(image), 1, file) != 1) {
+        return -1;
+    }
+    return write_encrypted(file, header, sizeof(FileSystem));
+}
+
+int read_image_header(FILE *file, FileSystem *header, const char *filename) {
+    ImageHeader image;
+    if (fread(&image, sizeof(image), 1, file) != 1 || memcmp(image.magic, IMAGE_MAGIC, sizeof(image.magic)) != 0) {
+        fs_printf("Error: '%s' is not a filesystem image.\n", filename);
+        return -1;
+    }
+    if (image.version != IMAGE_VERSION || image.header_size != sizeof(FileSystem) || image.entry_size != sizeof(File)) {
+        fs_printf("Error: '%s' was written by an incompatible version (format %u, this build reads %u).\n",
+               filename, image.version, IMAGE_VERSION);
+        return -1;
+    }
+    if (fread(header, sizeof(FileSystem), 1, file) != 1) {
+        fs_printf("Error: '%s' is truncated.\n", filename);
+        return -1;
+    }
+    encrypt((char *)header, sizeof(FileSystem)); // Decrypt metadata, including password
+    if (header->file_count < 0 || header->total_blocks < 0 || header->partition_size < 0 ||
+        header->storage_start_block < 0 || header->total_blocks != header->partition_size / BLOCK_SIZE) {
+        fs_printf("Error: '%s' has a corrupt header.\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int save_filesystem(FileSystem *fs, const char *filename) {
     char password[256];
-    printf("Enter password to protect this filesystem: ");
+    fs_printf("Enter password to protect this filesystem: ");
     scanf("%s", password);
 
-    strncpy(fs->password, password, sizeof(fs->password)); // Store password in the filesystem structure
+    return store_filesystem(fs, filename, password);
+}
+
+// 不經互動直接以 password 加密並寫出映像檔，成功回傳 0；任何一段寫入失敗時刪除不完整的檔案並回傳 -1
+int store_filesystem(FileSystem *fs, const char *filename, const char *password) {
+    snprintf(fs->password, sizeof(fs->password), "%s", password); // Store password in the filesystem structure
 
+    STATS_TIMER(save_start);
     FILE *file = fopen(filename, "wb");
-    if (file) {
-        // Encrypt filesystem metadata, including the password
-        encrypt((char *)fs, sizeof(FileSystem));
-        fwrite(fs, sizeof(FileSystem), 1, file);
-        encrypt((char *)fs, sizeof(FileSystem)); // Restore after saving
-
-        // Encrypt file metadata
-        encrypt((char *)fs->files, fs->file_count * sizeof(File));
-        fwrite(fs->files, sizeof(File), fs->file_count, file);
-        encrypt((char *)fs->files, fs->file_count * sizeof(File));
-
-        // Encrypt storage
-        encrypt(storage + fs->storage_start_block * BLOCK_SIZE, fs->partition_size);
-        fwrite(storage + fs->storage_start_block * BLOCK_SIZE, fs->partition_size, 1, file);
-        encrypt(storage + fs->storage_start_block * BLOCK_SIZE, fs->partition_size);
-
-        // Encrypt bitmask
-        encrypt((char *)fs->used_blocks_bitmask, fs->total_blocks / 8);
-        fwrite(fs->used_blocks_bitmask, fs->total_blocks / 8, 1, file);
-        encrypt((char *)fs->used_blocks_bitmask, fs->total_blocks / 8);
+    if (!file) {
+        fs_printf("Error: Could not save filesystem.\n");
+        return -1;
+    }
+    STATS_PHASES_BEGIN(phases);
+
+    // 有快照時 bitmask 也包含只被快照使用的區塊，映像檔只記錄目前的檔案用到的
+    FileSystem header = *fs;
+    char *bitmask = fs->used_blocks_bitmask;
+    if (fs->snapshot_count > 0) {
+        bitmask = calloc(BITMASK_BYTES(fs), 1);
+        mark_table_blocks(fs->file_slabs, fs->file_count, bitmask);
+        header.free_blocks = fs->total_blocks - count_set_blocks(fs, bitmask);
+    }
 
-        fclose(file);
-        printf("Filesystem saved to '%s' with encryption.\n", filename);
-    } else {
-        printf("Error: Could not save filesystem.\n");
+    // Encrypt filesystem metadata, including the password
+    // 各區段都經由暫存緩衝區加密，背景儲存快照的執行緒可能同時在讀共用的 slab 與區塊
+    int result = write_image_header(file, &header);
+
+    // Encrypt file metadata（逐個 slab 寫出，墓碑也一起寫，索引在載入後保持不變）
+    for (int s = 0; s * FILE_SLAB_SIZE < fs->file_count && result == 0; s++) {
+        int count = fs->file_count - s * FILE_SLAB_SIZE;
+        if (count > FILE_SLAB_SIZE) {
+            count = FILE_SLAB_SIZE;
+        }
+        result = write_encrypted(file, fs->file_slabs[s], count * sizeof(File));
+    }
+
+    // Encrypt storage（分段在執行緒池上加密，同時寫入檔案，見 image.h）
+    size_t partition = (size_t)fs->storage_start_block * BLOCK_SIZE;
+    if (result == 0 && image_write_partition(file, fs->partition_size, image_source_storage, &partition) == -1) {
+        fs_printf("Error: Could not write the partition to '%s'.\n", filename);
+        result = -1;
     }
+
+    // Encrypt bitmask
+    if (result == 0) {
+        result = write_encrypted(file, bitmask, BITMASK_BYTES(fs));
+    }
+    if (bitmask != fs->used_blocks_bitmask) {
+        free(bitmask);
+    }
+
+    // trigram 索引放在最後，舊的映像檔沒有這一段
+    if (result == 0) {
+        STATS_TIMER(index_start);
+        result = trigram_index_save(fs, file);
+        STATS_PHASE(STAT_SAVE_INDEX, index_start);
+    }
+
+    // 任何一段失敗都不留下不完整的映像檔
+    if (fclose(file) != 0) {
+        result = -1;
+    }
+    if (result == -1) {
+        STATS_PHASES_DISCARD();
+        remove(filename);
+        fs_printf("Error: Could not save filesystem to '%s'.\n", filename);
+        return -1;
+    }
+    STATS_PHASE(STAT_SAVE, save_start);
+    STATS_PHASES_END(phases, STAT_SAVE, STAT_SAVE_INDEX);
+    fs_printf("Filesystem saved to '%s' with encryption.\n", filename);
+    return 0;
 }
 
 
+// 項目 i 是否為存活的目錄，ROOT_DIR 也算
+static int is_loaded_dir(FileSystem *fs, int i) {
+    return i == ROOT_DIR || (i >= 0 && i < fs->file_count && file_at(fs, i)->in_use == 1 &&
+                             file_at(fs, i)->is_directory);
+}
+
+// 檢查載入的項目表：區塊範圍在分區內、父目錄與 extent 串列的索引有效且沒有循環，
+// 重建索引與共用計數都依賴這些欄位，損毀的映像檔在這裡擋下
+static int check_loaded_entries(FileSystem *fs, const char *filename) {
+    int bad = -1;
+    for (int i = 0; i < fs->file_count && bad == -1; i++) {
+        File *file = file_at(fs, i);
+        if (file->in_use == 0) {
+            continue;
+        }
+        if ((file->in_use != 1 && file->in_use != FILE_EXTENT) ||
+            file->used_blocks < 0 || file->start_block < 0 || file->start_block > fs->total_blocks - file->used_blocks ||
+            file->skip < 0 || file->extent_size < 0 ||
+            (long long)file->skip + file->extent_size > (long long)file->used_blocks * BLOCK_SIZE ||
+            (file->next != -1 && (file->next < 0 || file->next >= fs->file_count ||
+                                  file_at(fs, file->next)->in_use != FILE_EXTENT))) {
+            bad = i;
+        } else if (file->in_use == 1 &&
+                   (!memchr(file->name, '\0', MAX_FILENAME) || file->size < 0 || file->parent == i ||
+                    !is_loaded_dir(fs, file->parent))) {
+            bad = i;
+        } else if (file->in_use == 1) {
+            // extent 串列的長度不會超過項目數，各段加起來就是檔案大小
+            long long size = 0;
+            int steps = 0;
+            for (int e = i; e != -1 && steps <= fs->file_count; e = file_at(fs, e)->next, steps++) {
+                size += file_at(fs, e)->extent_size;
+            }
+            if (steps > fs->file_count || size != file->size) {
+                bad = i;
+            }
+        }
+    }
+
+    // 父目錄連結不能形成循環：沿著父目錄往上走，遇到正在走的項目就是循環
+    char *state = bad == -1 ? calloc(fs->file_count > 0 ? fs->file_count : 1, 1) : NULL; // 0 未檢查、1 走訪中、2 通往根目錄
+    if (bad == -1 && !state) {
+        fs_printf("Error: Not enough memory to check '%s'.\n", filename);
+        return -1;
+    }
+    for (int i = 0; i < fs->file_count && bad == -1; i++) {
+        int d = i;
+        while (d != ROOT_DIR && file_at(fs, d)->in_use == 1 && state[d] == 0) {
+            state[d] = 1;
+            d = file_at(fs, d)->parent;
+        }
+        if (d != ROOT_DIR && file_at(fs, d)->in_use == 1 && state[d] == 1) {
+            bad = d;
+        }
+        for (d = i; d != ROOT_DIR && file_at(fs, d)->in_use == 1 && state[d] == 1; d = file_at(fs, d)->parent) {
+            state[d] = 2;
+        }
+    }
+    free(state);
+    if (bad != -1) {
+        fs_printf("Error: '%s' is corrupt (file entry %d).\n", filename, bad);
+        return -1;
+    }
+    return 0;
+}
+
+// 讀取映像檔中 FileSystem 之後的各區段（header 已讀入 fs 並解密）
+// 失敗時已載入的部分留在 fs 中，由 load_image_sections 釋放
+static int read_image_sections(FileSystem *fs, FILE *file, const char *filename) {
+    STATS_TIMER(load_start);
+
+    // header 中的指標是存檔時的位址，先清掉，失敗時才能交給 free_filesystem
+    fs->used_blocks_bitmask = NULL;
+    fs->extent_refs = NULL;
+    fs->extent_gen = NULL;
+    fs->trigram_index = NULL;
+    fs->snapshots = NULL;
+    fs->snapshot_count = 0;
+
+    // Load file metadata
+    int file_count = fs->file_count;
+    file_table_init(fs);
+    if (file_table_reserve(fs, file_count) == -1) {
+        fs_printf("Error: Not enough memory for %d file entries.\n", file_count);
+        return -1;
+    }
+    fs->file_count = file_count;
+    for (int s = 0; s * FILE_SLAB_SIZE < file_count; s++) {
+        int count = file_count - s * FILE_SLAB_SIZE;
+        if (count > FILE_SLAB_SIZE) {
+            count = FILE_SLAB_SIZE;
+        }
+        STATS_TIMER(read_start);
+        if (fread(fs->file_slabs[s], sizeof(File), count, file) != (size_t)count) {
+            fs_printf("Error: '%s' is truncated.\n", filename);
+            return -1;
+        }
+        STATS_PHASE(STAT_LOAD_READ, read_start);
+        STATS_TIMER(decrypt_start);
+        encrypt((char *)fs->file_slabs[s], count * sizeof(File)); // Decrypt
+        STATS_PHASE(STAT_LOAD_DECRYPT, decrypt_start);
+    }
+    if (check_loaded_entries(fs, filename) == -1) {
+        return -1;
+    }
+    STATS_TIMER(table_start);
+    file_table_rebuild(fs);
+    STATS_PHASE(STAT_LOAD_TABLE, table_start);
+
+    // Load storage
+    if (storage_reserve((size_t)fs->storage_start_block * BLOCK_SIZE + fs->partition_size) == -1) {
+        fs_printf("Error: Not enough memory to load the partition.\n");
+        return -1;
+    }
+    if (image_read_partition(file, (size_t)fs->storage_start_block * BLOCK_SIZE, fs->partition_size) == -1) {
+        fs_printf("Error: Could not load the partition.\n");
+        return -1;
+    }
+
+    // Load bitmask
+    fs->used_blocks_bitmask = calloc(BITMASK_BYTES(fs) > 0 ? BITMASK_BYTES(fs) : 1, 1);
+    fs->extent_refs = calloc(fs->total_blocks > 0 ? fs->total_blocks : 1, sizeof(int));
+    fs->extent_gen = calloc(fs->total_blocks > 0 ? fs->total_blocks : 1, sizeof(int));
+    if (!fs->used_blocks_bitmask || !fs->extent_refs || !fs->extent_gen) {
+        fs_printf("Error: Not enough memory for the block maps of %d blocks.\n", fs->total_blocks);
+        return -1;
+    }
+    if (fread(fs->used_blocks_bitmask, 1, BITMASK_BYTES(fs), file) != (size_t)BITMASK_BYTES(fs)) {
+        fs_printf("Error: '%s' is truncated.\n", filename);
+        return -1;
+    }
+    encrypt((char *)fs->used_blocks_bitmask, BITMASK_BYTES(fs)); // Decrypt
+    fs->free_blocks = fs->total_blocks - count_set_blocks(fs, fs->used_blocks_bitmask);
+
+    // 共用計數不存檔，依項目表重算
+    STATS_TIMER(refs_start);
+    rebuild_extent_refs(fs);
+    STATS_PHASE(STAT_LOAD_REFS, refs_start);
+
+    // 快照只存在記憶體中，載入後沒有快照
+    fs->generation = 0;
+    fs->frozen_generation = -1;
+
+    // 目前目錄失效時回到根目錄
+    if (fs->cwd < 0 || !is_loaded_dir(fs, fs->cwd)) {
+        fs->cwd = ROOT_DIR;
+    }
+    set_cwd(fs, fs->cwd);
+
+    // Load trigram index，沒有或不完整時依內容重建
+    STATS_TIMER(index_start);
+    fs->trigram_index = trigram_index_create();
+    if (trigram_index_load(fs, file) == -1) {
+        trigram_index_rebuild(fs);
+    }
+    STATS_PHASE(STAT_LOAD_INDEX, index_start);
+    STATS_PHASE(STAT_LOAD, load_start);
+    return 0;
+}
+
+// 同 read_image_sections，各階段的時間累計後每次載入只記錄一筆，失敗時釋放載入一半的內容
+static int load_image_sections(FileSystem *fs, FILE *file, const char *filename) {
+    STATS_PHASES_BEGIN(phases);
+    int result = read_image_sections(fs, file, filename);
+    if (result == 0) {
+        STATS_PHASES_END(phases, STAT_LOAD, STAT_LOAD_INDEX);
+    } else {
+        STATS_PHASES_DISCARD();
+        free_filesystem(fs);
+    }
+    return result;
+}
+
 void load_filesystem(FileSystem *fs) {
     char filename[MAX_FILENAME];
     char password[256];
     int attempt = 0;
 
-    printf("Enter the filename of the filesystem image: ");
+    fs_printf("Enter the filename of the filesystem image: ");
     scanf("%s", filename);
 
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        printf("Error: The file '%s' does not exist or cannot be opened.\n", filename);
+        fs_printf("Error: The file '%s' does not exist or cannot be opened.\n", filename);
         return;
     }
 
-    fread(fs, sizeof(FileSystem), 1, file);
-    encrypt((char *)fs, sizeof(FileSystem)); // Decrypt metadata, including password
+    if (read_image_header(file, fs, filename) == -1) {
+        fclose(file);
+        exit(EXIT_FAILURE);
+    }
 
-    printf("Enter password to decrypt this filesystem (3 attempts max):\n");
+    fs_printf("Enter password to decrypt this filesystem (3 attempts max):\n");
     while (attempt < 3) {
         scanf("%s", password);
         if (strcmp(password, fs->password) == 0) { // Compare entered password with stored password
-            // Load file metadata
-            fs->files = (File *)malloc(fs->file_count * sizeof(File));
-            fread(fs->files, sizeof(File), fs->file_count, file);
-            encrypt((char *)fs->files, fs->file_count * sizeof(File)); // Decrypt
-
-            // Load storage
-            fread(storage + fs->storage_start_block * BLOCK_SIZE, fs->partition_size, 1, file);
-            encrypt(storage + fs->storage_start_block * BLOCK_SIZE, fs->partition_size); // Decrypt
-
-            // Load bitmask
-            fs->used_blocks_bitmask = malloc(fs->total_blocks / 8);
-            fread(fs->used_blocks_bitmask, fs->total_blocks / 8, 1, file);
-            encrypt((char *)fs->used_blocks_bitmask, fs->total_blocks / 8); // Decrypt
-
+            if (load_image_sections(fs, file, filename) == -1) {
+                fclose(file);
+                exit(EXIT_FAILURE);
+            }
             fclose(file);
-            printf("Filesystem loaded successfully from '%s'.\n", filename);
+            fs_printf("Filesystem loaded successfully from '%s'.\n", filename);
             return;
         } else {
             attempt++;
-            printf("Incorrect password. Attempts left: %d\n", 3 - attempt);
+            fs_printf("Incorrect password. Attempts left: %d\n", 3 - attempt);
         }
     }
 
-    printf("Error: Password attempts exceeded. Exiting.\n");
+    fs_printf("Error: Password attempts exceeded. Exiting.\n");
     fclose(file);
     exit(EXIT_FAILURE);
 }
 
+int restore_filesystem(FileSystem *fs, const char *filename, const char *password) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fs_printf("Error: The file '%s' does not exist or cannot be opened.\n", filename);
+        return -1;
+    }
+    FileSystem header;
+    if (read_image_header(file, &header, filename) == -1) {
+        fclose(file);
+        return -1;
+    }
+    if (strcmp(password, header.password) != 0) {
+        fs_printf("Incorrect password.\n");
+        fclose(file);
+        return -1;
+    }
+    *fs = header;
+    int result = load_image_sections(fs, file, filename);
+    fclose(file);
+    if (result == 0) {
+        fs_printf("Filesystem loaded successfully from '%s'.\n", filename);
+    }
+    return result;
+}
+
 
 
 
-//從storage_used_blocks裡找出連續可用的區塊
-int find_free_blocks(FileSystem *fs, int required_blocks) {
+// 在 [from, to) 之間找出 required_blocks 個連續可用的區塊
+static int scan_free_blocks(FileSystem *fs, int from, int to, int required_blocks) {
     int start_block = -1;
     int count = 0;
-    for (int i = 0; i < fs->total_blocks; i++) {
+    for (int i = from; i < to; i++) {
+        // 整個位元組都被使用時一次跳過 8 個區塊
+        if (i % 8 == 0 && i + 8 <= to && (unsigned char)fs->used_blocks_bitmask[i / 8] == 0xFF) {
+            start_block = -1;
+            count = 0;
+            i += 7;
+            continue;
+        }
         if (!(fs->used_blocks_bitmask[i / 8] & (1 << (i % 8)))) {
             if (start_block == -1) {
                 start_block = i;
             }
             count++;
             if (count == required_blocks) {
+                STATS_ADD(STAT_ALLOC_SCANNED, i + 1 - from);
                 return start_block;
             }
         } else {
@@ -135,9 +457,49 @@ int find_free_blocks(FileSystem *fs, int required_blocks) {
             count = 0;
         }
     }
+    STATS_ADD(STAT_ALLOC_SCANNED, to > from ? to - from : 0);
     return -1;
 }
 
+//從storage_used_blocks裡找出連續可用的區塊
+// 採 next-fit：從上次配置的結尾開始找，大量連續新增時不必每次都從頭掃描
+int find_free_blocks(FileSystem *fs, int required_blocks) {
+    if (required_blocks <= 0 || required_blocks > fs->total_blocks) {
+        return -1;
+    }
+    STATS_ADD(STAT_ALLOC_CALLS, 1);
+    int hint = fs->alloc_hint;
+    if (hint < 0 || hint >= fs->total_blocks) {
+        hint = 0;
+    }
+    int start_block = scan_free_blocks(fs, hint, fs->total_blocks, required_blocks);
+    if (start_block == -1 && hint > 0) {
+        // 繞回開頭，範圍延伸到可以跨過 hint 的連續區段
+        STATS_ADD(STAT_ALLOC_WRAPS, 1);
+        int to = hint + required_blocks - 1;
+        start_block = scan_free_blocks(fs, 0, to < fs->total_blocks ? to : fs->total_blocks, required_blocks);
+    }
+    if (start_block != -1) {
+        fs->alloc_hint = start_block + required_blocks;
+    } else {
+        STATS_ADD(STAT_ALLOC_FAILS, 1);
+    }
+    return start_block;
+}
+
+// 檢查從 start_block 開始的 count 個區塊是否都在分區內且未使用
+int is_range_free(FileSystem *fs, int start_block, int count) {
+    if (start_block < 0 || start_block + count > fs->total_blocks) {
+        return 0;
+    }
+    for (int i = start_block; i < start_block + count; i++) {
+        if (fs->used_blocks_bitmask[i / 8] & (1 << (i % 8))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 void set_bitmask(FileSystem *fs, int start_block, int required_blocks) {
     for (int i = 0; i < required_blocks; i++) {
         fs->used_blocks_bitmask[(start_block + i) / 8] |= 1 << ((start_block + i) % 8);
@@ -150,30 +512,335 @@ void clear_bitmask(FileSystem *fs, int start_block, int required_blocks) {
     }
 }
 
-// 印出bitmask
-void print_bitmask(FileSystem *fs) {
-    for (int i = 0; i < fs->total_blocks; i++) {
-        if (i % 8 == 0) {
-            printf(" ");
+void claim_extent(FileSystem *fs, int start_block, int used_blocks) {
+    set_bitmask(fs, start_block, used_blocks);
+    fs->free_blocks -= used_blocks;
+    fs->extent_refs[start_block] = 0;
+    fs->extent_gen[start_block] = fs->generation;
+}
+
+void share_extent(FileSystem *fs, int start_block) {
+    fs->extent_refs[start_block]++;
+}
+
+int extent_frozen(FileSystem *fs, int start_block) {
+    return fs->extent_gen[start_block] <= fs->frozen_generation;
+}
+
+int extent_shared(FileSystem *fs, int start_block) {
+    return fs->extent_refs[start_block] > 0 || extent_frozen(fs, start_block);
+}
+
+void release_extent(FileSystem *fs, int start_block, int used_blocks) {
+    if (fs->extent_refs[start_block] > 0) {
+        fs->extent_refs[start_block]--;
+        return;
+    }
+    if (extent_frozen(fs, start_block)) {
+        return; // 快照還在使用，刪除快照時才重新計算可用區塊
+    }
+    clear_bitmask(fs, start_block, used_blocks);
+    fs->free_blocks += used_blocks;
+}
+
+int trim_extent(FileSystem *fs, int start_block, int used_blocks, int first, int count) {
+    if (first == 0 && count == used_blocks) {
+        return start_block;
+    }
+    clear_bitmask(fs, start_block, first);
+    clear_bitmask(fs, start_block + first + count, used_blocks - first - count);
+    fs->free_blocks += used_blocks - count;
+    // 計數與世代以起始區塊為鍵，跟著搬到新的起始區塊
+    int new_start = start_block + first;
+    fs->extent_refs[new_start] = 0;
+    fs->extent_gen[new_start] = fs->extent_gen[start_block];
+    return new_start;
+}
+
+void set_file_extent(File *file, int start_block, int used_blocks, int size) {
+    file->start_block = start_block;
+    file->used_blocks = used_blocks;
+    file->size = size;
+    file->skip = 0;
+    file->extent_size = size;
+    file->next = -1;
+}
+
+// 把檔案 [offset, offset + len) 拆成各段 extent 在 storage 中的範圍
+// 只有一段時放在 one 中，否則配置一個陣列（呼叫者在 *ranges 不是 one 時釋放），記憶體不足回傳 -1
+static int file_ranges(FileSystem *fs, int index, size_t offset, size_t len,
+                       StorageRange *one, StorageRange **ranges) {
+    int count = 0;
+    for (int e = index; e != -1; e = file_at(fs, e)->next) {
+        count++;
+    }
+    *ranges = count <= 1 ? one : malloc(count * sizeof(StorageRange));
+    if (!*ranges) {
+        fs_printf("Error: Not enough memory to read '%s'.\n", file_at(fs, index)->name);
+        return -1;
+    }
+    count = 0;
+    for (int e = index; e != -1 && len > 0; e = file_at(fs, e)->next) {
+        File *extent = file_at(fs, e);
+        if (offset >= (size_t)extent->extent_size) {
+            offset -= extent->extent_size;
+            continue;
+        }
+        size_t n = extent->extent_size - offset;
+        if (n > len) {
+            n = len;
+        }
+        (*ranges)[count].offset = EXTENT_OFFSET(extent) + offset;
+        (*ranges)[count].len = n;
+        count++;
+        len -= n;
+        offset = 0;
+    }
+    return len == 0 ? count : -1;
+}
+
+// 依序把檔案 [offset, offset + len) 的內容交給 visit
+static int file_visit(FileSystem *fs, int index, size_t offset, size_t len, size_t overlap,
+                      void (*visit)(void *ctx, const char *data, size_t len), void *ctx) {
+    StorageRange one, *ranges;
+    int count = file_ranges(fs, index, offset, len, &one, &ranges);
+    int result = count == -1 ? -1 : storage_scan_ranges(index, ranges, count, overlap, visit, ctx);
+    if (ranges != &one) {
+        free(ranges);
+    }
+    return result;
+}
+
+static void copy_out(void *ctx, const char *data, size_t len) {
+    char **out = ctx;
+    memcpy(*out, data, len);
+    *out += len;
+}
+
+int file_read(FileSystem *fs, int index, size_t offset, void *buf, size_t len) {
+    char *out = buf;
+    return file_visit(fs, index, offset, len, 0, copy_out, &out);
+}
+
+int file_scan(FileSystem *fs, int index, size_t overlap,
+              void (*visit)(void *ctx, const char *data, size_t len), void *ctx) {
+    return file_visit(fs, index, 0, file_at(fs, index)->size, overlap, visit, ctx);
+}
+
+// file_write_to 寫入主機檔案的狀態
+typedef struct {
+    FILE *out;
+    int failed;
+} WriteOut;
+
+static void write_out(void *ctx, const char *data, size_t len) {
+    WriteOut *w = ctx;
+    if (!w->failed && fwrite(data, 1, len, w->out) != len) {
+        w->failed = 1;
+    }
+}
+
+int file_write_to(FileSystem *fs, int index, FILE *out) {
+    WriteOut w = { out, 0 };
+    if (file_visit(fs, index, 0, file_at(fs, index)->size, 0, write_out, &w) == -1) {
+        return -1;
+    }
+    return w.failed ? -1 : 0;
+}
+
+void release_file_extents(FileSystem *fs, int index) {
+    File *file = file_mut(fs, index);
+    int next = file->next;
+    release_extent(fs, file->start_block, file->used_blocks);
+    file->next = -1;
+    while (next != -1) {
+        File *extent = file_at(fs, next);
+        int after = extent->next;
+        release_extent(fs, extent->start_block, extent->used_blocks);
+        file_table_release(fs, next);
+        next = after;
+    }
+}
+
+int share_file_extents(FileSystem *fs, int dst, int src) {
+    File *file = file_at(fs, src);
+    File *copy = file_mut(fs, dst);
+    copy->size = file->size;
+    copy->start_block = file->start_block;
+    copy->used_blocks = file->used_blocks;
+    copy->skip = file->skip;
+    copy->extent_size = file->extent_size;
+    copy->next = -1;
+    share_extent(fs, file->start_block);
+
+    int tail = dst;
+    for (int e = file_at(fs, src)->next; e != -1; e = file_at(fs, e)->next) {
+        int index = file_table_alloc_extent(fs);
+        if (index == -1) {
+            release_file_extents(fs, dst);
+            return -1;
+        }
+        // 配置可能新增 slab 或複製被快照共用的 slab，指標要重新取得
+        File *extent = file_at(fs, e);
+        File *shared = file_mut(fs, index);
+        shared->start_block = extent->start_block;
+        shared->used_blocks = extent->used_blocks;
+        shared->skip = extent->skip;
+        shared->extent_size = extent->extent_size;
+        share_extent(fs, extent->start_block);
+        file_mut(fs, tail)->next = index;
+        tail = index;
+    }
+    return 0;
+}
+
+void rebuild_extent_refs(FileSystem *fs) {
+    memset(fs->extent_refs, 0, fs->total_blocks * sizeof(int));
+    // 每段區塊的第一個檔案是擁有者，之後的才算共用者
+    char *seen = calloc(BITMASK_BYTES(fs), 1);
+    for (int i = 0; i < fs->file_count; i++) {
+        File *file = file_at(fs, i);
+        if (!file->in_use || file->is_directory) {
+            continue;
+        }
+        int b = file->start_block;
+        if (seen[b / 8] & (1 << (b % 8))) {
+            fs->extent_refs[b]++;
+        } else {
+            seen[b / 8] |= 1 << (b % 8);
         }
-        printf("%d", (fs->used_blocks_bitmask[i / 8] & (1 << (i % 8))) ? 1 : 0);
     }
-    printf("\n");
+    free(seen);
+}
+
+void mark_table_blocks(File **slabs, int file_count, char *bitmask) {
+    for (int i = 0; i < file_count; i++) {
+        File *file = &slabs[i / FILE_SLAB_SIZE][i % FILE_SLAB_SIZE];
+        if (!file->in_use) {
+            continue;
+        }
+        for (int b = file->start_block; b < file->start_block + file->used_blocks; b++) {
+            bitmask[b / 8] |= 1 << (b % 8);
+        }
+    }
+}
+
+int count_set_blocks(FileSystem *fs, const char *bitmask) {
+    int count = 0;
+    for (int i = 0; i < BITMASK_BYTES(fs); i++) {
+        count += __builtin_popcount((unsigned char)bitmask[i]);
+    }
+    return count;
+}
+
+#define BITMAP_CELLS 1024 // 密度圖最多的格數
+#define BITMAP_ROW 64      // 密度圖每行的格數
+
+static int block_used(FileSystem *fs, int block) {
+    return (fs->used_blocks_bitmask[block / 8] >> (block % 8)) & 1;
 }
 
-void exit_and_store(FileSystem *fs) {
+// 從 start 開始與 start 狀態相同的區段結束位置，整個位元組相同時一次跳過 8 個區塊
+static int run_end(FileSystem *fs, int start) {
+    int used = block_used(fs, start);
+    unsigned char same = used ? 0xFF : 0x00;
+    int i = start + 1;
+    while (i < fs->total_blocks) {
+        if (i % 8 == 0 && i + 8 <= fs->total_blocks && (unsigned char)fs->used_blocks_bitmask[i / 8] == same) {
+            i += 8;
+        } else if (block_used(fs, i) == used) {
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+void print_bitmap(FileSystem *fs, int max_runs) {
+    int total = fs->total_blocks;
+    int used = count_set_blocks(fs, fs->used_blocks_bitmask);
+    fs_printf("blocks: %d total, %d used (%.1f%%), %d free\n",
+           total, used, total ? 100.0 * used / total : 0.0, total - used);
+
+    // 連續區段：列出前 max_runs 個，其餘只統計
+    int used_runs = 0, free_runs = 0, largest_free = 0, largest_start = -1;
+    for (int start = 0; start < total;) {
+        int end = run_end(fs, start);
+        int is_used = block_used(fs, start);
+        if (used_runs + free_runs < max_runs) {
+            fs_printf("  %-4s %10d-%-10d %10d blocks\n", is_used ? "used" : "free", start, end - 1, end - start);
+        }
+        if (is_used) {
+            used_runs++;
+        } else {
+            free_runs++;
+            if (end - start > largest_free) {
+                largest_free = end - start;
+                largest_start = start;
+            }
+        }
+        start = end;
+    }
+    if (used_runs + free_runs > max_runs) {
+        fs_printf("  ... %d more runs\n", used_runs + free_runs - max_runs);
+    }
+    fs_printf("runs: %d used, %d free, largest free run %d blocks", used_runs, free_runs, largest_free);
+    if (largest_start != -1) {
+        fs_printf(" at block %d", largest_start);
+    }
+    fs_printf("\n");
+
+    // 密度圖：每格代表固定數量的區塊，依使用比例顯示
+    if (total == 0) {
+        return;
+    }
+    int per_cell = (total + BITMAP_CELLS - 1) / BITMAP_CELLS;
+    int cells = (total + per_cell - 1) / per_cell;
+    fs_printf("map (%d block%s per cell; '.' free, '-' under half, '+' half or more, '#' full):\n",
+           per_cell, per_cell > 1 ? "s" : "");
+    char row[BITMAP_ROW + 1];
+    for (int c = 0; c < cells; c++) {
+        int first = c * per_cell;
+        int last = first + per_cell < total ? first + per_cell : total;
+        int count = 0;
+        for (int b = first; b < last; b++) {
+            if (b % 8 == 0 && b + 8 <= last) {
+                count += __builtin_popcount((unsigned char)fs->used_blocks_bitmask[b / 8]);
+                b += 7;
+            } else {
+                count += block_used(fs, b);
+            }
+        }
+        int size = last - first;
+        row[c % BITMAP_ROW] = count == 0 ? '.' : count == size ? '#' : count * 2 < size ? '-' : '+';
+        if (c % BITMAP_ROW == BITMAP_ROW - 1 || c == cells - 1) {
+            row[c % BITMAP_ROW + 1] = '\0';
+            fs_printf("%10d %s\n", (c / BITMAP_ROW) * BITMAP_ROW * per_cell, row);
+        }
+    }
+}
+
+int exit_and_store(FileSystem *fs) {
     char filename[MAX_FILENAME];
 
-    printf("Enter the filename to save the filesystem (e.g., my_filesystem.img): ");
-    scanf("%s", filename);
+    fs_printf("Enter the filename to save the filesystem (e.g., my_filesystem.img): ");
+    if (scanf("%250s", filename) != 1) { // 留空間給補上的 ".img"
+        fs_printf("\nError: No filename given; the filesystem was not saved.\n");
+        return -1;
+    }
 
     // 檢查檔案名稱是否以 ".img" 結尾
     if (!strstr(filename, ".img")) {
-        printf("Error: The file '%s' is not a valid .img dump file. Adding '.img' extension automatically.\n", filename);
+        fs_printf("Error: The file '%s' is not a valid .img dump file. Adding '.img' extension automatically.\n", filename);
         strcat(filename, ".img"); // 自動補上 ".img"
     }
 
-    save_filesystem(fs, filename);
-    printf("Filesystem state saved to '%s'. Exiting.\n", filename);
+    if (save_filesystem(fs, filename) == -1) {
+        fs_printf("Filesystem was not saved; type 'exit' to try again.\n");
+        return -1;
+    }
+    fs_printf("Filesystem state saved to '%s'. Exiting.\n", filename);
+    return 0;
 }
 
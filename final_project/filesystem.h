@@ -4,10 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "storage.h"
 
 #define MAX_FILENAME 255
 #define MAX_PATH 1023
 #define BLOCK_SIZE 1024
+#define ROOT_DIR -1   // 根目錄沒有項目，以 -1 表示
+
+// 指令輸出的目的地，每個執行緒各自一份，NULL 表示 stdout
+// server 執行請求時指向該請求的回應緩衝區（見 dispatch.h），背景執行緒的訊息仍然寫到 stdout
+extern __thread FILE *fs_output;
+#define FS_OUT (fs_output ? fs_output : stdout)
+#define fs_printf(...) fprintf(FS_OUT, __VA_ARGS__)
 
 // 定義 File 結構
 typedef struct File {
@@ -16,49 +24,164 @@ typedef struct File {
     int start_block;         // 起始區塊
     int used_blocks;         // 使用的區塊數
     int is_directory;        // 是否為目錄（1 表示目錄，0 表示檔案）
-    char parent_name[MAX_FILENAME]; // 父目錄名稱
+    int parent;              // 父目錄的項目索引（ROOT_DIR 表示根目錄），搬移整個子樹只需改這一個連結
+    int in_use;              // 0 表示已刪除（墓碑），槽位可重用；FILE_EXTENT 表示延續項目
+    int child_count;         // 目錄底下的項目數
+    int next;                // 內容下一段 extent 的延續項目索引，-1 表示沒有
+    int skip;                // 這段內容從 start_block 開頭算起的位元組位移
+    int extent_size;         // 這段 extent 的位元組數（只有一段時等於 size）
 } File;
 
+#define FILE_EXTENT 2        // in_use 的值：檔案內容的延續 extent，不屬於任何目錄
+
 // 定義 FileSystem 結構
 typedef struct {
-    char current_path[MAX_PATH]; // 目前目錄路徑
+    char current_path[MAX_PATH]; // 目前目錄路徑（由 cwd 往上組出，顯示用）
+    int cwd;                         // 目前目錄的項目索引
     int partition_size;              // 分區大小
     int total_blocks;                // 總區塊數
     int free_blocks;                 // 剩餘區塊數
     int storage_start_block;         // 在共享存儲區域中的起始區塊（如果一個storage裡面有多個FileSystem的話啦）
-    File *files;                     // 動態分配的檔案和目錄清單
-    int file_count;                  // 檔案和目錄的數量
+    File **file_slabs;               // 檔案和目錄項目，分成固定大小的 slab（見 filetable.h）
+    int slab_count;
+    int file_count;                  // 用過的項目槽數（含墓碑）
+    int live_files;                  // 存活的檔案和目錄數量
+    int *free_slots;                 // 墓碑槽位，新增項目時優先重用
+    int free_count;
+    int *hash_buckets;               // (父目錄, 名稱) → 項目索引的雜湊表
+    int *hash_next;
+    int hash_size;
+    int *child_head;                 // 各目錄的子項目串列（第 0 格為根目錄，目錄 d 在第 d + 1 格）
+    int *child_tail;
+    int *sibling_next;               // 同一目錄下依加入順序串起來的項目
+    int *sibling_prev;
+    int alloc_hint;                  // find_free_blocks 下一次開始搜尋的區塊
+    struct TrigramIndex *trigram_index; // 檔案內容的 trigram 索引（見 trigram.h）
     char *used_blocks_bitmask; 
+    int *extent_refs;                // 以起始區塊為鍵，與其他檔案共用這段區塊的檔案數（cp 產生，不寫入映像檔）
+    int *extent_gen;                 // 以起始區塊為鍵，這段區塊配置時的世代
+    int generation;                  // 目前的世代，每建立一個快照加一
+    int frozen_generation;           // 最新快照的世代，沒有快照時為 -1（見 snapshot.h）
+    struct Snapshot **snapshots;
+    int snapshot_count;
     char password[256];       // 已使用空間的bitmask
 } FileSystem;
 
-// 共享儲存storage
-extern char storage[];
+// bitmask 的位元組數（區塊數不是 8 的倍數時要多一個位元組）
+#define BITMASK_BYTES(fs) (((fs)->total_blocks + 7) / 8)
+
+// 共享儲存 storage 與區塊層見 storage.h
+
+// 初始化檔案系統，storage 不足時回傳 -1
+int init_filesystem(FileSystem *fs, int size, int start_block);
 
-// 初始化檔案系統
-void init_filesystem(FileSystem *fs, int size, int start_block);
+// 釋放檔案系統的項目表、bitmask 與索引（共享的 storage 保留）
+void free_filesystem(FileSystem *fs);
 
 // 載入檔案系統
 void load_filesystem(FileSystem *fs);
+int restore_filesystem(FileSystem *fs, const char *filename, const char *password);
 
-// 儲存檔案系統
-void save_filesystem(FileSystem *fs, const char *filename);
+// 儲存檔案系統，詢問密碼後交給 store_filesystem，成功回傳 0
+int save_filesystem(FileSystem *fs, const char *filename);
+int store_filesystem(FileSystem *fs, const char *filename, const char *password);
 void encrypt(char *data, size_t size);
 
 //從storage_used_blocks裡找出連續可用的區塊
 int find_free_blocks(FileSystem *fs, int required_blocks);
 
+// 檢查一段區塊是否都可用
+int is_range_free(FileSystem *fs, int start_block, int count);
+
 // 設定bitmask
 void set_bitmask(FileSystem *fs, int start_block, int required_blocks);
 
 // 清除bitmask
 void clear_bitmask(FileSystem *fs, int start_block, int required_blocks);
 
-// 印出bitmask
-void print_bitmask(FileSystem *fs);
+// 把 XOR 加密後的資料寫入映像檔，原本的資料不會被改動（經由暫存緩衝區）
+int write_encrypted(FILE *file, const void *data, size_t size);
+
+// 映像檔開頭的格式識別（不加密），FileSystem 與 File 直接以記憶體中的結構寫入，
+// 結構改變時舊的映像檔會被解析錯，所以記錄版本與兩個結構的大小，不符時拒絕載入
+#define IMAGE_MAGIC "FSIMAGE"
+#define IMAGE_VERSION 2   // 改變映像檔的內容或 FileSystem / File 的欄位時加一
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;  // sizeof(FileSystem)
+    uint32_t entry_size;   // sizeof(File)
+} ImageHeader;
+
+// 寫入格式識別與加密後的 FileSystem
+int write_image_header(FILE *file, const FileSystem *header);
+
+// 讀取並檢查格式識別，再讀入解密後的 FileSystem，不是這個版本的映像檔時印出錯誤並回傳 -1
+int read_image_header(FILE *file, FileSystem *header, const char *filename);
+
+// 配置一段已找好的連續區塊給檔案或目錄，記錄配置時的世代
+void claim_extent(FileSystem *fs, int start_block, int used_blocks);
+
+// cp 讓兩個檔案共用同一段區塊，任何一方修改前都要先複製（copy-on-write）
+// 記錄 start_block 開頭的區塊多了一個共用者
+void share_extent(FileSystem *fs, int start_block);
+
+// 這段區塊是否被其他檔案或快照共用（是的話不可就地修改）
+int extent_shared(FileSystem *fs, int start_block);
+
+// 這段區塊是否在最新的快照之前配置，也就是被快照引用
+int extent_frozen(FileSystem *fs, int start_block);
+
+// 檔案不再使用這段區塊：還有其他共用者時只減少計數，被快照引用時保留到快照刪除，否則釋放區塊
+void release_extent(FileSystem *fs, int start_block, int used_blocks);
+
+// 在 bitmask 中標出項目表（slabs 的前 file_count 個項目）用到的區塊
+void mark_table_blocks(File **slabs, int file_count, char *bitmask);
+
+// bitmask 中已使用的區塊數
+int count_set_blocks(FileSystem *fs, const char *bitmask);
+
+// 一段配置只剩 [start_block + first, start_block + first + count) 還有內容時釋放前後其餘的區塊，回傳新的起始區塊
+// 與其他檔案或快照共用的配置不能縮小，由呼叫者先以 extent_shared 確認
+int trim_extent(FileSystem *fs, int start_block, int used_blocks, int first, int count);
+
+// 檔案內容可以由多段 extent 串成：第一段記在檔案項目本身，之後每段記在一個延續項目中，以 next 串起來
+// 每段引用一段配置 [start_block, start_block + used_blocks)，內容從其中第 skip 個位元組開始，長 extent_size
+// 同一段配置可以被多段 extent 引用（cp 或 edit 保留下來的內容），以 share_extent / release_extent 計數
+// edit 只為插入的文字配置新的 extent，其餘內容繼續引用原本的區塊（見 piece_table.h）
+
+// 這段 extent 的內容在 storage 中的位置
+#define EXTENT_OFFSET(file) ((size_t)(file)->start_block * BLOCK_SIZE + (file)->skip)
+
+// 把檔案設成從 start_block 開始的單段內容（原本的 extent 要先釋放）
+void set_file_extent(File *file, int start_block, int used_blocks, int size);
+
+// 依序讀出檔案 [offset, offset + len) 的內容，讀取失敗回傳 -1
+int file_read(FileSystem *fs, int index, size_t offset, void *buf, size_t len);
+
+// 依序把檔案內容交給 visit，語意同 storage_scan，overlap 也跨越 extent 的邊界
+int file_scan(FileSystem *fs, int index, size_t overlap,
+              void (*visit)(void *ctx, const char *data, size_t len), void *ctx);
+
+// 把檔案內容寫到主機檔案 out
+int file_write_to(FileSystem *fs, int index, FILE *out);
+
+// 釋放檔案所有 extent 引用的區塊與延續項目，只留下項目本身（之後由呼叫者設定新內容或刪除）
+void release_file_extents(FileSystem *fs, int index);
+
+// cp：dst 與 src 共用所有 extent，延續項目配置不到時回傳 -1，dst 沒有引用任何區塊
+int share_file_extents(FileSystem *fs, int dst, int src);
+
+// 依項目表重新計算共用計數（載入映像檔後使用）
+void rebuild_extent_refs(FileSystem *fs);
+
+// 印出 bitmask 的摘要：使用量、前 max_runs 個連續區段（run-length）與固定大小的密度圖
+// 輸出量與分區大小無關
+void print_bitmap(FileSystem *fs, int max_runs);
 
-// 儲存並退出檔案系統
-void exit_and_store(FileSystem *fs);
+// 儲存並退出檔案系統，儲存失敗時回傳 -1，不退出
+int exit_and_store(FileSystem *fs);
 
 #endif
 
@@ -0,0 +1,597 @@
+#include "filetable.h"
+
+// FNV-1a，鍵為「父目錄索引 + 名稱」
+static unsigned int hash_key(int parent, const char *name) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ ((unsigned int)parent >> (i * 8) & 0xFF)) * 16777619u;
+    }
+    for (const char *p = name; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h;
+}
+
+void file_table_init(FileSystem *fs) {
+    fs->file_slabs = NULL;
+    fs->slab_count = 0;
+    fs->file_count = 0;
+    fs->live_files = 0;
+    fs->free_slots = NULL;
+    fs->free_count = 0;
+    fs->hash_buckets = NULL;
+    fs->hash_next = NULL;
+    fs->hash_size = 0;
+    fs->child_head = NULL;
+    fs->child_tail = NULL;
+    fs->sibling_next = NULL;
+    fs->sibling_prev = NULL;
+}
+
+static File *slab_alloc(void) {
+    FileSlab *slab = calloc(1, sizeof(FileSlab));
+    if (!slab) {
+        return NULL;
+    }
+    slab->refs = 1;
+    return slab->files;
+}
+
+void slab_ref(File *slab) {
+    slab_header(slab)->refs++;
+}
+
+void slab_unref(File *slab) {
+    FileSlab *header = slab_header(slab);
+    if (--header->refs == 0) {
+        free(header);
+    }
+}
+
+File *file_mut(FileSystem *fs, int index) {
+    int s = index / FILE_SLAB_SIZE;
+    FileSlab *header = slab_header(fs->file_slabs[s]);
+    if (header->refs > 1) {
+        FileSlab *copy = malloc(sizeof(FileSlab));
+        if (!copy) {
+            fs_printf("Error: Could not allocate memory for file table.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy->files, header->files, sizeof(header->files));
+        copy->refs = 1;
+        header->refs--;
+        fs->file_slabs[s] = copy->files;
+    }
+    return &fs->file_slabs[s][index % FILE_SLAB_SIZE];
+}
+
+void file_table_free(FileSystem *fs) {
+    for (int s = 0; s < fs->slab_count; s++) {
+        slab_unref(fs->file_slabs[s]);
+    }
+    free(fs->file_slabs);
+    free(fs->free_slots);
+    free(fs->hash_buckets);
+    free(fs->hash_next);
+    free(fs->child_head);
+    free(fs->child_tail);
+    free(fs->sibling_next);
+    free(fs->sibling_prev);
+    file_table_init(fs);
+}
+
+static void hash_insert(FileSystem *fs, int index) {
+    File *file = file_at(fs, index);
+    unsigned int bucket = hash_key(file->parent, file->name) & (fs->hash_size - 1);
+    fs->hash_next[index] = fs->hash_buckets[bucket];
+    fs->hash_buckets[bucket] = index;
+}
+
+static void hash_remove(FileSystem *fs, int index) {
+    File *file = file_at(fs, index);
+    unsigned int bucket = hash_key(file->parent, file->name) & (fs->hash_size - 1);
+    int *link = &fs->hash_buckets[bucket];
+    while (*link != -1) {
+        if (*link == index) {
+            *link = fs->hash_next[index];
+            return;
+        }
+        link = &fs->hash_next[*link];
+    }
+}
+
+// 重新配置 size 個 bucket 並把所有存活項目放回去
+static int hash_resize(FileSystem *fs, int size) {
+    int *buckets = malloc(size * sizeof(int));
+    if (!buckets) {
+        return -1;
+    }
+    for (int b = 0; b < size; b++) {
+        buckets[b] = -1;
+    }
+    free(fs->hash_buckets);
+    fs->hash_buckets = buckets;
+    fs->hash_size = size;
+    for (int i = 0; i < fs->file_count; i++) {
+        if (file_at(fs, i)->in_use == 1) {
+            hash_insert(fs, i);
+        }
+    }
+    return 0;
+}
+
+static int resize_array(int **array, int count) {
+    int *p = realloc(*array, count * sizeof(int));
+    if (!p) {
+        return -1;
+    }
+    *array = p;
+    return 0;
+}
+
+// 把與項目槽數等長的陣列擴充到 slab_count 個 slab 的容量，新的目錄槽沒有子項目
+static int resize_slot_arrays(FileSystem *fs, int slab_count) {
+    int capacity = (slab_count > 0 ? slab_count : 1) * FILE_SLAB_SIZE;
+    int old_capacity = fs->child_head ? fs->slab_count * FILE_SLAB_SIZE : -1;
+    File **slabs = realloc(fs->file_slabs, (slab_count > 0 ? slab_count : 1) * sizeof(File *));
+    if (!slabs) {
+        return -1;
+    }
+    fs->file_slabs = slabs;
+    if (resize_array(&fs->hash_next, capacity) == -1 ||
+        resize_array(&fs->free_slots, capacity) == -1 ||
+        resize_array(&fs->sibling_next, capacity) == -1 ||
+        resize_array(&fs->sibling_prev, capacity) == -1 ||
+        resize_array(&fs->child_head, capacity + 1) == -1 ||
+        resize_array(&fs->child_tail, capacity + 1) == -1) {
+        return -1;
+    }
+    for (int d = old_capacity + 1; d <= capacity; d++) {
+        fs->child_head[d] = fs->child_tail[d] = -1;
+    }
+    return 0;
+}
+
+// 把項目接到父目錄子項目串列的尾端
+static void child_insert(FileSystem *fs, int index) {
+    int d = file_at(fs, index)->parent + 1;
+    fs->sibling_next[index] = -1;
+    fs->sibling_prev[index] = fs->child_tail[d];
+    if (fs->child_tail[d] != -1) {
+        fs->sibling_next[fs->child_tail[d]] = index;
+    } else {
+        fs->child_head[d] = index;
+    }
+    fs->child_tail[d] = index;
+}
+
+static void child_remove(FileSystem *fs, int index) {
+    int d = file_at(fs, index)->parent + 1;
+    int prev = fs->sibling_prev[index], next = fs->sibling_next[index];
+    if (prev != -1) {
+        fs->sibling_next[prev] = next;
+    } else {
+        fs->child_head[d] = next;
+    }
+    if (next != -1) {
+        fs->sibling_prev[next] = prev;
+    } else {
+        fs->child_tail[d] = prev;
+    }
+}
+
+// 再加一個 slab，並把與容量等長的陣列一起擴充
+static int add_slab(FileSystem *fs) {
+    if (resize_slot_arrays(fs, fs->slab_count + 1) == -1) {
+        return -1;
+    }
+    File *slab = slab_alloc();
+    if (!slab) {
+        return -1;
+    }
+    fs->file_slabs[fs->slab_count++] = slab;
+    return 0;
+}
+
+int file_table_reserve(FileSystem *fs, int count) {
+    while (fs->slab_count * FILE_SLAB_SIZE < count) {
+        if (add_slab(fs) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// free list 是以索引為鍵的 min-heap，新增項目時重用最小的墓碑槽位，存活的項目因此集中在表的前面
+static void free_push(FileSystem *fs, int index) {
+    int *heap = fs->free_slots;
+    int i = fs->free_count++;
+    while (i > 0 && heap[(i - 1) / 2] > index) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = index;
+}
+
+// 取出最小的墓碑槽位，沒有時回傳 -1
+// 結尾被去掉的槽位不會從 heap 中移除，它們都大於 file_count，最小的一個超出範圍時其餘也都超出，一起丟掉
+static int free_pop(FileSystem *fs) {
+    int *heap = fs->free_slots;
+    if (fs->free_count == 0 || heap[0] >= fs->file_count) {
+        fs->free_count = 0;
+        return -1;
+    }
+    int top = heap[0];
+    int last = heap[--fs->free_count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= fs->free_count) {
+            break;
+        }
+        if (child + 1 < fs->free_count && heap[child + 1] < heap[child]) {
+            child++;
+        }
+        if (heap[child] >= last) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+int file_table_alloc(FileSystem *fs) {
+    int index = free_pop(fs);
+    int appended = index == -1;
+    if (appended) {
+        if (fs->file_count == fs->slab_count * FILE_SLAB_SIZE && add_slab(fs) == -1) {
+            return -1;
+        }
+        index = fs->file_count++;
+    }
+    // 雜湊表的負載超過 1 時加倍
+    if (fs->live_files + 1 > fs->hash_size && hash_resize(fs, fs->hash_size ? fs->hash_size * 2 : 256) == -1) {
+        if (appended) {
+            fs->file_count--;
+        } else {
+            free_push(fs, index);
+        }
+        return -1;
+    }
+    File *file = file_mut(fs, index);
+    memset(file, 0, sizeof(File));
+    file->next = -1;
+    fs->hash_next[index] = -1;
+    fs->child_head[index + 1] = fs->child_tail[index + 1] = -1;
+    fs->live_files++;
+    return index;
+}
+
+int file_table_alloc_extent(FileSystem *fs) {
+    int index = file_table_alloc(fs);
+    if (index != -1) {
+        File *file = file_mut(fs, index);
+        file->in_use = FILE_EXTENT;
+        file->parent = ROOT_DIR;
+        fs->live_files--;
+    }
+    return index;
+}
+
+// 調整目錄 dir 的項目數
+static void adjust_child_count(FileSystem *fs, int dir, int delta) {
+    if (dir != ROOT_DIR) {
+        file_mut(fs, dir)->child_count += delta;
+    }
+}
+
+void file_table_link(FileSystem *fs, int index) {
+    File *file = file_mut(fs, index);
+    file->in_use = 1;
+    hash_insert(fs, index);
+    child_insert(fs, index);
+    adjust_child_count(fs, file->parent, 1);
+}
+
+void file_table_release(FileSystem *fs, int index) {
+    File *file = file_mut(fs, index);
+    // 延續項目不在索引與目錄中，也不算在存活項目中
+    if (file->in_use == 1) {
+        hash_remove(fs, index);
+        child_remove(fs, index);
+        adjust_child_count(fs, file->parent, -1);
+        fs->live_files--;
+    }
+    file->in_use = 0;
+    free_push(fs, index);
+
+    if (index == fs->file_count - 1) {
+        file_table_compact(fs);
+    }
+}
+
+int file_table_lookup(FileSystem *fs, int parent, const char *name) {
+    if (fs->hash_size == 0) {
+        return -1;
+    }
+    unsigned int bucket = hash_key(parent, name) & (fs->hash_size - 1);
+    for (int i = fs->hash_buckets[bucket]; i != -1; i = fs->hash_next[i]) {
+        File *file = file_at(fs, i);
+        if (file->parent == parent && strcmp(file->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void file_table_move(FileSystem *fs, int index, int new_parent, const char *new_name) {
+    File *file = file_mut(fs, index);
+    hash_remove(fs, index);
+    child_remove(fs, index);
+    adjust_child_count(fs, file->parent, -1);
+    file->parent = new_parent;
+    if (new_name != file->name) {
+        snprintf(file->name, sizeof(file->name), "%s", new_name);
+    }
+    hash_insert(fs, index);
+    child_insert(fs, index);
+    adjust_child_count(fs, new_parent, 1);
+}
+
+int resolve_path(FileSystem *fs, const char *path, int *index) {
+    int current = path[0] == '/' ? ROOT_DIR : fs->cwd;
+    const char *p = path;
+    for (;;) {
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        // 中間的每一段都必須是目錄
+        if (current != ROOT_DIR && !file_at(fs, current)->is_directory) {
+            return -1;
+        }
+        const char *end = strchr(p, '/');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        size_t len = end - p;
+        if (len >= MAX_FILENAME) {
+            return -1;
+        }
+        char name[MAX_FILENAME];
+        memcpy(name, p, len);
+        name[len] = '\0';
+
+        if (strcmp(name, "..") == 0) {
+            if (current != ROOT_DIR) {
+                current = file_at(fs, current)->parent;
+            }
+        } else if (strcmp(name, ".") != 0) {
+            int next = file_table_lookup(fs, current, name);
+            if (next == -1) {
+                return -1;
+            }
+            current = next;
+        }
+        p = end;
+    }
+    *index = current;
+    return 0;
+}
+
+int resolve_parent(FileSystem *fs, const char *path, int *parent, char *name) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--; // 忽略結尾的斜線
+    }
+    const char *start = path + len;
+    while (start > path && start[-1] != '/') {
+        start--;
+    }
+    size_t name_len = path + len - start;
+    if (name_len == 0 || name_len >= MAX_FILENAME) {
+        return -1;
+    }
+    memcpy(name, start, name_len);
+    name[name_len] = '\0';
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
+    }
+
+    char dir_path[MAX_PATH];
+    if (start == path) {
+        strcpy(dir_path, ".");
+    } else if (start - path >= MAX_PATH) {
+        return -1;
+    } else {
+        snprintf(dir_path, sizeof(dir_path), "%.*s", (int)(start - path), path);
+    }
+    if (resolve_path(fs, dir_path, parent) == -1) {
+        return -1;
+    }
+    return *parent == ROOT_DIR || file_at(fs, *parent)->is_directory ? 0 : -1;
+}
+
+int build_path(FileSystem *fs, int index, char *buf, size_t size) {
+    // 由項目往上走到根目錄，從暫存區的尾端往前填入各段名稱
+    char temp[MAX_PATH];
+    size_t pos = sizeof(temp) - 1;
+    temp[pos] = '\0';
+    for (int i = index; i != ROOT_DIR; i = file_at(fs, i)->parent) {
+        const char *name = file_at(fs, i)->name;
+        size_t len = strlen(name);
+        if (len + 1 > pos) {
+            snprintf(buf, size, "...%s", temp + pos); // 太深時只保留最後幾層
+            return -1;
+        }
+        pos -= len;
+        memcpy(temp + pos, name, len);
+        temp[--pos] = '/';
+    }
+    if (pos == sizeof(temp) - 1) {
+        snprintf(buf, size, "/");
+        return 0;
+    }
+    return (size_t)snprintf(buf, size, "%s", temp + pos) < size ? 0 : -1;
+}
+
+void set_cwd(FileSystem *fs, int dir) {
+    fs->cwd = dir;
+    build_path(fs, dir, fs->current_path, sizeof(fs->current_path));
+}
+
+void file_table_compact(FileSystem *fs) {
+    // 只去掉結尾的墓碑，其餘項目不搬動，索引都不變；去掉的槽位留在 free list 中，取出時才丟掉
+    while (fs->file_count > 0 && !file_at(fs, fs->file_count - 1)->in_use) {
+        fs->file_count--;
+    }
+
+    // 保留一個空 slab 的餘裕，其餘釋放
+    int needed_slabs = (fs->file_count + FILE_SLAB_SIZE - 1) / FILE_SLAB_SIZE + 1;
+    while (fs->slab_count > needed_slabs) {
+        slab_unref(fs->file_slabs[--fs->slab_count]);
+    }
+}
+
+int file_table_adopt(FileSystem *fs, File **slabs, int slab_count, int file_count) {
+    for (int s = 0; s < slab_count; s++) {
+        slab_ref(slabs[s]);
+    }
+    for (int s = 0; s < fs->slab_count; s++) {
+        slab_unref(fs->file_slabs[s]);
+    }
+    if (resize_slot_arrays(fs, slab_count) == -1) {
+        return -1;
+    }
+    memcpy(fs->file_slabs, slabs, slab_count * sizeof(File *));
+    fs->slab_count = slab_count;
+    fs->file_count = file_count;
+    file_table_rebuild(fs);
+    return 0;
+}
+
+void file_table_rebuild(FileSystem *fs) {
+    fs->live_files = 0;
+    fs->free_count = 0;
+    for (int i = 0; i < fs->file_count; i++) {
+        File *file = file_at(fs, i);
+        if (!file->in_use) {
+            fs->free_slots[fs->free_count++] = i;
+        } else if (file->in_use != FILE_EXTENT) {
+            fs->live_files++;
+        }
+    }
+    int hash_size = 256;
+    while (hash_size < fs->live_files) {
+        hash_size *= 2;
+    }
+    hash_resize(fs, hash_size);
+
+    // 載入的項目表沒有記錄加入順序，依索引順序重建子項目串列（沒有任何 slab 時還沒有串列）
+    if (!fs->child_head) {
+        return;
+    }
+    for (int d = 0; d <= fs->file_count; d++) {
+        fs->child_head[d] = fs->child_tail[d] = -1;
+    }
+    for (int i = 0; i < fs->file_count; i++) {
+        if (file_at(fs, i)->in_use == 1) {
+            child_insert(fs, i);
+        }
+    }
+}
+
+typedef struct {
+    const char *name;
+    int size;
+    int index;
+} DirSortKey;
+
+static int compare_by_name(const void *a, const void *b) {
+    return strcmp(((const DirSortKey *)a)->name, ((const DirSortKey *)b)->name);
+}
+
+static int compare_by_size(const void *a, const void *b) {
+    const DirSortKey *x = a, *y = b;
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+int dir_open(FileSystem *fs, int dir, int order, int reverse, DirCursor *cursor) {
+    cursor->count = 0;
+    cursor->pos = 0;
+    // 根目錄沒有項目可以記錄子項目數，先走一次串列
+    int total = 0;
+    if (dir != ROOT_DIR) {
+        total = file_at(fs, dir)->child_count;
+    } else if (fs->child_head) {
+        for (int i = fs->child_head[0]; i != -1; i = fs->sibling_next[i]) {
+            total++;
+        }
+    }
+    cursor->entries = malloc((total > 0 ? total : 1) * sizeof(int));
+    if (!cursor->entries) {
+        return -1;
+    }
+    if (fs->child_head) {
+        for (int i = fs->child_head[dir + 1]; i != -1 && cursor->count < total; i = fs->sibling_next[i]) {
+            cursor->entries[cursor->count++] = i;
+        }
+    }
+
+    if (order == DIR_ORDER_NAME || order == DIR_ORDER_SIZE) {
+        DirSortKey *keys = malloc((cursor->count > 0 ? cursor->count : 1) * sizeof(DirSortKey));
+        if (!keys) {
+            dir_close(cursor);
+            return -1;
+        }
+        for (int k = 0; k < cursor->count; k++) {
+            File *file = file_at(fs, cursor->entries[k]);
+            keys[k].name = file->name;
+            keys[k].size = file->size;
+            keys[k].index = cursor->entries[k];
+        }
+        qsort(keys, cursor->count, sizeof(DirSortKey), order == DIR_ORDER_NAME ? compare_by_name : compare_by_size);
+        for (int k = 0; k < cursor->count; k++) {
+            cursor->entries[k] = keys[k].index;
+        }
+        free(keys);
+    }
+    if (reverse) {
+        for (int a = 0, b = cursor->count - 1; a < b; a++, b--) {
+            int t = cursor->entries[a];
+            cursor->entries[a] = cursor->entries[b];
+            cursor->entries[b] = t;
+        }
+    }
+    return 0;
+}
+
+int dir_read(DirCursor *cursor, int *entries, int max) {
+    int n = cursor->count - cursor->pos;
+    if (n > max) {
+        n = max;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    memcpy(entries, cursor->entries + cursor->pos, n * sizeof(int));
+    cursor->pos += n;
+    return n;
+}
+
+void dir_seek(DirCursor *cursor, int pos) {
+    cursor->pos = pos < 0 ? 0 : pos > cursor->count ? cursor->count : pos;
+}
+
+void dir_close(DirCursor *cursor) {
+    free(cursor->entries);
+    cursor->entries = NULL;
+    cursor->count = cursor->pos = 0;
+}
@@ -0,0 +1,114 @@
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include <stddef.h>
+#include "filesystem.h"
+
+// 檔案/目錄項目表
+// 項目放在固定大小的 slab 中，擴充時只新增 slab，既有項目不會被搬動，索引也不變
+// 刪除只把項目標成墓碑並放進 free list，新增項目時重用最小的墓碑槽位，項目一旦配置索引就不會改變
+// 結尾的墓碑隨時從表中去掉，多餘的 slab 一起釋放（見 file_table_compact）
+// 每個項目只記父目錄的索引，(父目錄, 名稱) 另外用雜湊表索引，查詢不必掃過整張表
+// 每個目錄的子項目另外依加入順序串成雙向串列，列出目錄只需走過它自己的子項目
+// 雜湊表與子項目串列都只存在記憶體中，載入映像檔或回復快照後依項目表重建
+// slab 有參考計數，快照（見 snapshot.h）直接共用 slab，修改項目前要用 file_mut 取得私有的複本
+
+#define FILE_SLAB_SIZE 256       // 每個 slab 的項目數
+
+// slab 實際配置的結構，file_slabs 中存的是 files 的位址
+typedef struct {
+    int refs;                    // 共用這個 slab 的項目表數（目前的檔案系統與各個快照）
+    File files[FILE_SLAB_SIZE];
+} FileSlab;
+
+static inline FileSlab *slab_header(File *slab) {
+    return (FileSlab *)((char *)slab - offsetof(FileSlab, files));
+}
+
+// 取得第 index 個項目（唯讀）
+static inline File *file_at(FileSystem *fs, int index) {
+    return &fs->file_slabs[index / FILE_SLAB_SIZE][index % FILE_SLAB_SIZE];
+}
+
+// 取得第 index 個項目以便修改，slab 被快照共用時先複製一份（copy-on-write）
+File *file_mut(FileSystem *fs, int index);
+
+// 增加 / 減少 slab 的參考，最後一個參考放掉時釋放
+void slab_ref(File *slab);
+void slab_unref(File *slab);
+
+// 初始化空的項目表
+void file_table_init(FileSystem *fs);
+
+// 釋放項目表的所有記憶體
+void file_table_free(FileSystem *fs);
+
+// 確保至少有 count 個項目槽的空間（載入映像檔時使用）
+int file_table_reserve(FileSystem *fs, int count);
+
+// 配置一個清空的項目（優先重用最小的墓碑槽位），回傳索引，記憶體不足回傳 -1
+// 名稱與父目錄設定好後要呼叫 file_table_link 才能被查到
+int file_table_alloc(FileSystem *fs);
+
+// 配置一個延續項目（in_use 為 FILE_EXTENT）記錄檔案內容的一段 extent，不加入索引也不算在存活項目中
+int file_table_alloc_extent(FileSystem *fs);
+
+// 把項目加入 (父目錄, 名稱) 索引並更新父目錄的項目數
+void file_table_link(FileSystem *fs, int index);
+
+// 刪除項目（變成墓碑），其他項目的索引不受影響
+void file_table_release(FileSystem *fs, int index);
+
+// 找出目錄 parent（ROOT_DIR 為根目錄）下名稱為 name 的項目，找不到回傳 -1
+int file_table_lookup(FileSystem *fs, int parent, const char *name);
+
+// 把項目移到 new_parent 底下並改名為 new_name，子樹跟著父目錄連結一起搬走
+void file_table_move(FileSystem *fs, int index, int new_parent, const char *new_name);
+
+// 依路徑找出項目，path 可以是絕對路徑或相對於目前目錄，支援 . 與 ..
+// 成功回傳 0 並把索引（根目錄為 ROOT_DIR）寫入 *index，找不到回傳 -1
+int resolve_path(FileSystem *fs, const char *path, int *index);
+
+// 找出路徑最後一段所在的目錄，最後一段的名稱寫入 name（至少 MAX_FILENAME 位元組）
+// 目錄不存在或最後一段不是合法名稱時回傳 -1
+int resolve_parent(FileSystem *fs, const char *path, int *parent, char *name);
+
+// 由父目錄連結組出項目的完整路徑，超過 buf 或 MAX_PATH 時截斷並回傳 -1
+int build_path(FileSystem *fs, int index, char *buf, size_t size);
+
+// 切換目前目錄並更新 current_path
+void set_cwd(FileSystem *fs, int dir);
+
+// 去掉結尾的墓碑並釋放多餘的 slab，不搬動任何項目
+void file_table_compact(FileSystem *fs);
+
+// 改用另一組 slab（回復快照時使用），增加它們的參考後重建索引
+int file_table_adopt(FileSystem *fs, File **slabs, int slab_count, int file_count);
+
+// 載入映像檔後重建 free list、雜湊索引、子項目串列與計數
+void file_table_rebuild(FileSystem *fs);
+
+// 目錄讀取 cursor：開啟時依指定順序取得子項目的快照，之後分頁讀出
+// 順序在 cursor 開啟期間固定，目錄沒有變動時每次開啟的順序也相同
+#define DIR_ORDER_CREATED 0      // 加入目錄的順序
+#define DIR_ORDER_NAME 1
+#define DIR_ORDER_SIZE 2         // 由小到大，大小相同時依名稱
+
+typedef struct {
+    int *entries;                // 子項目的索引
+    int count;
+    int pos;                     // 下一個要讀出的位置
+} DirCursor;
+
+// 開啟目錄 dir（ROOT_DIR 為根目錄），reverse 為 1 時反向排序，記憶體不足回傳 -1
+int dir_open(FileSystem *fs, int dir, int order, int reverse, DirCursor *cursor);
+
+// 讀出最多 max 個項目的索引，回傳讀到的數量，0 表示已經讀完
+int dir_read(DirCursor *cursor, int *entries, int max);
+
+// 移到第 pos 個項目（從 0 開始）
+void dir_seek(DirCursor *cursor, int pos);
+
+void dir_close(DirCursor *cursor);
+
+#endif
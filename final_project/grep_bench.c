@@ -0,0 +1,135 @@
+// 比較 trigram 索引與逐檔掃描的搜尋時間
+// 用法：./grep_bench [corpus MB (預設 1024)] [file KB (預設 256)]
+#include <time.h>
+
+#include "command.h"
+
+#define WORDS 5000
+#define QUERY_ROUNDS 5
+
+static char vocabulary[WORDS][12];
+static unsigned int rng = 12345;
+
+static unsigned int next_random(void) {
+    rng = rng * 1103515245u + 12345u;
+    return rng >> 8;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 以字彙表隨機產生一段文字，每行約 60 個字元
+static void fill_text(char *buffer, int size) {
+    int pos = 0, column = 0;
+    while (pos < size) {
+        const char *word = vocabulary[next_random() % WORDS];
+        int len = strlen(word);
+        for (int i = 0; i < len && pos < size; i++) {
+            buffer[pos++] = word[i];
+        }
+        column += len + 1;
+        if (pos < size) {
+            buffer[pos++] = column > 60 ? '\n' : ' ';
+        }
+        if (column > 60) {
+            column = 0;
+        }
+    }
+}
+
+// 回傳含有 pattern 的檔案數
+static int search(FileSystem *fs, const char *pattern, int use_index, int *candidates_out) {
+    int len = strlen(pattern);
+    int count, matches = 0;
+    int *candidates;
+    if (!use_index || trigram_index_candidates(fs, pattern, len, &candidates, &count) == -1) {
+        candidates = malloc(fs->file_count * sizeof(int));
+        count = 0;
+        for (int i = 0; i < fs->file_count; i++) {
+            if (file_at(fs, i)->in_use == 1 && !file_at(fs, i)->is_directory) {
+                candidates[count++] = i;
+            }
+        }
+    }
+    for (int c = 0; c < count; c++) {
+        File *file = file_at(fs, candidates[c]);
+        const char *data = storage_pin((size_t)file->start_block * BLOCK_SIZE, file->size);
+        if (find_substring(data, file->size, pattern, len)) {
+            matches++;
+        }
+        storage_unpin(data);
+    }
+    free(candidates);
+    *candidates_out = count;
+    return matches;
+}
+
+int main(int argc, char *argv[]) {
+    int corpus_mb = argc > 1 ? atoi(argv[1]) : 1024;
+    int file_kb = argc > 2 ? atoi(argv[2]) : 256;
+    if (corpus_mb < 1 || file_kb < 1 || corpus_mb * 1024 / file_kb < 1) {
+        fprintf(stderr, "Usage: %s [corpus MB] [file KB]\n", argv[0]);
+        return 1;
+    }
+    int file_size = file_kb * 1024;
+    int file_count = corpus_mb * 1024 / file_kb;
+
+    for (int w = 0; w < WORDS; w++) {
+        int len = 3 + next_random() % 8;
+        for (int i = 0; i < len; i++) {
+            vocabulary[w][i] = 'a' + next_random() % 26;
+        }
+        vocabulary[w][len] = '\0';
+    }
+
+    FileSystem fs;
+    if (init_filesystem(&fs, (corpus_mb + 1) * 1024 * 1024, 0) == -1) {
+        return 1;
+    }
+
+    // 建立語料，並在少數檔案中放入罕見的字串
+    char *buffer = malloc(file_size);
+    double insert_time = 0;
+    for (int f = 0; f < file_count; f++) {
+        fill_text(buffer, file_size);
+        if (f % 997 == 0) {
+            memcpy(buffer + next_random() % (file_size - 32), "zq-needle-0042", 14);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "doc%d.txt", f);
+        double start = now_seconds();
+        if (write_new_file(&fs, name, buffer, file_size) == -1) {
+            return 1;
+        }
+        insert_time += now_seconds() - start;
+    }
+    free(buffer);
+
+    printf("corpus: %d MB, %d files of %d KB\n", corpus_mb, file_count, file_kb);
+    printf("insert + index time: %.3f s\n", insert_time);
+    if (fs.trigram_index) {
+        printf("trigram lists: %d, postings: %ld\n", fs.trigram_index->list_count, fs.trigram_index->total_postings);
+    }
+
+    const char *patterns[] = { "zq-needle-0042", vocabulary[0], "not present anywhere" };
+    for (int p = 0; p < 3; p++) {
+        int candidates = 0, scanned = 0, indexed_matches = 0, scan_matches = 0;
+        double start = now_seconds();
+        for (int r = 0; r < QUERY_ROUNDS; r++) {
+            indexed_matches = search(&fs, patterns[p], 1, &candidates);
+        }
+        double indexed = (now_seconds() - start) / QUERY_ROUNDS;
+        start = now_seconds();
+        for (int r = 0; r < QUERY_ROUNDS; r++) {
+            scan_matches = search(&fs, patterns[p], 0, &scanned);
+        }
+        double scan = (now_seconds() - start) / QUERY_ROUNDS;
+        printf("pattern '%s': candidates %d/%d, matches %d (scan %d), indexed %.3f ms, scan %.3f ms, speedup %.1fx\n",
+               patterns[p], candidates, scanned, indexed_matches, scan_matches,
+               indexed * 1e3, scan * 1e3, indexed > 0 ? scan / indexed : 0);
+    }
+    return 0;
+}
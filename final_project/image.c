@@ -0,0 +1,476 @@
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE // linux/fs.h 的定義，與 filesystem.h 的 BLOCK_SIZE 無關
+#define HAVE_IO_URING 1
+#endif
+#endif
+#include "image.h"
+#include "filesystem.h"
+#include "stats.h"
+
+#define MAX_SLOTS (IMAGE_MAX_THREADS * 2 + 4) // 同時在管線中的片段數
+
+#define SLOT_FREE 0     // 空的緩衝區
+#define SLOT_CIPHER 1   // 執行緒池正在加密或解密
+#define SLOT_READY 2    // 儲存：已加密，等待寫入
+#define SLOT_IO 3       // 讀寫檔案中
+#define SLOT_LOADED 4   // 載入：已讀入，等待解密
+
+typedef struct {
+    int fd;
+    off_t base;                 // 這一段在檔案中的開頭
+    size_t size;
+    int chunk_count;
+    int saving;                 // 1 為儲存，0 為載入
+    ImageSource source;         // 儲存時的內容來源
+    void *ctx;
+    size_t offset;              // 載入到 storage 的位置
+    char *buffers;              // slot_count 個 IMAGE_CHUNK 大小的緩衝區
+    int slot_count;
+    int state[MAX_SLOTS];       // SLOT_*
+    int chunk[MAX_SLOTS];       // 每個緩衝區目前放的片段
+    size_t valid[MAX_SLOTS];    // 載入：實際從檔案讀到的位元組數
+    int next_cipher;            // 下一個開始加解密的片段（載入時只用來計數）
+    int next_io;                // 載入：下一個要讀的片段
+    int completed;              // 完成的片段數（儲存：已寫入；載入：已寫進 storage）
+    int failed;
+    StatsPhaseTotals *totals;   // 呼叫者正在累計的各階段時間，加解密執行緒沿用
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Pipeline;
+
+typedef struct {
+    int slot;
+    ssize_t result;             // 讀寫的位元組數，失敗時為負的 errno
+} IoCompletion;
+
+// 非同步讀寫：有 io_uring 時送進 ring，否則在 ioq_push 中直接同步讀寫，結果留到 ioq_wait 回傳
+typedef struct {
+    int ring_fd;                // -1 表示同步讀寫
+    IoCompletion pending[MAX_SLOTS];
+    int pending_count;
+#ifdef HAVE_IO_URING
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+#endif
+} IoQueue;
+
+int image_source_storage(void *ctx, size_t pos, char *buf, size_t len) {
+    return storage_read(*(size_t *)ctx + pos, buf, len);
+}
+
+static size_t chunk_length(const Pipeline *p, int c) {
+    size_t begin = (size_t)c * IMAGE_CHUNK;
+    return p->size - begin < IMAGE_CHUNK ? p->size - begin : IMAGE_CHUNK;
+}
+
+static char *slot_buffer(const Pipeline *p, int slot) {
+    return p->buffers + (size_t)slot * IMAGE_CHUNK;
+}
+
+// 加密要寫入的片段，或解密讀入的片段並寫進 storage
+static int cipher_chunk(Pipeline *p, int slot) {
+    int c = p->chunk[slot];
+    size_t pos = (size_t)c * IMAGE_CHUNK, len = chunk_length(p, c);
+    char *buf = slot_buffer(p, slot);
+    if (p->saving) {
+        if (p->source(p->ctx, pos, buf, len) == -1) {
+            return -1;
+        }
+        STATS_TIMER(encrypt_start);
+        encrypt(buf, len);
+        STATS_PHASE(STAT_SAVE_ENCRYPT, encrypt_start);
+        return 0;
+    }
+    STATS_TIMER(decrypt_start);
+    encrypt(buf, p->valid[slot]); // Decrypt，檔案不足的部分維持為零
+    STATS_PHASE(STAT_LOAD_DECRYPT, decrypt_start);
+    return storage_write(p->offset + pos, buf, len);
+}
+
+static void *cipher_worker(void *arg) {
+    Pipeline *p = arg;
+    stats_totals = p->totals;
+    pthread_mutex_lock(&p->lock);
+    while (!p->failed && p->next_cipher < p->chunk_count) {
+        int slot = -1;
+        for (int s = 0; s < p->slot_count && slot == -1; s++) {
+            if (p->state[s] == (p->saving ? SLOT_FREE : SLOT_LOADED)) {
+                slot = s;
+            }
+        }
+        if (slot == -1) {
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+        if (p->saving) {
+            p->chunk[slot] = p->next_cipher;
+        }
+        p->next_cipher++;
+        p->state[slot] = SLOT_CIPHER;
+        pthread_mutex_unlock(&p->lock);
+        int result = cipher_chunk(p, slot);
+        pthread_mutex_lock(&p->lock);
+        if (result == -1) {
+            p->failed = 1;
+        }
+        if (p->saving) {
+            p->state[slot] = SLOT_READY;
+        } else {
+            p->state[slot] = SLOT_FREE;
+            p->completed++;
+        }
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+#ifdef HAVE_IO_URING
+static int ring_init(IoQueue *q, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return -1;
+    }
+    // IORING_OP_READ/WRITE 與 IORING_FEAT_RW_CUR_POS 同時加入（Linux 5.6），以此判斷是否支援
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return -1;
+    }
+    q->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    q->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (q->cq_ring_size > q->sq_ring_size) {
+        q->sq_ring_size = q->cq_ring_size;
+    }
+    q->sq_ring = mmap(NULL, q->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (q->sq_ring == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    q->cq_ring = q->sq_ring; // IORING_FEAT_SINGLE_MMAP：兩個 ring 在同一個對應中
+    q->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (q->sqes == MAP_FAILED) {
+        munmap(q->sq_ring, q->sq_ring_size);
+        close(fd);
+        return -1;
+    }
+    char *sq = q->sq_ring, *cq = q->cq_ring;
+    q->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    q->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    q->sq_array = (unsigned *)(sq + params.sq_off.array);
+    q->cq_head = (unsigned *)(cq + params.cq_off.head);
+    q->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    q->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    q->to_submit = 0;
+    q->ring_fd = fd;
+    return 0;
+}
+#endif
+
+static void ioq_init(IoQueue *q, unsigned entries) {
+    q->ring_fd = -1;
+    q->pending_count = 0;
+#ifdef HAVE_IO_URING
+    const char *mode = getenv("FS_IMAGE_IO");
+    if (!mode || strcmp(mode, "sync") != 0) {
+        ring_init(q, entries);
+    }
+#else
+    (void)entries;
+#endif
+}
+
+static void ioq_free(IoQueue *q) {
+#ifdef HAVE_IO_URING
+    if (q->ring_fd != -1) {
+        munmap(q->sqes, q->sqes_size);
+        munmap(q->sq_ring, q->sq_ring_size);
+        close(q->ring_fd);
+    }
+#endif
+    q->ring_fd = -1;
+}
+
+static off_t slot_offset(const Pipeline *p, int slot) {
+    return p->base + (off_t)p->chunk[slot] * IMAGE_CHUNK;
+}
+
+// 同步讀寫一個片段（可能只完成一部分，由 finish_io 補完）
+static ssize_t sync_io(const Pipeline *p, int slot) {
+    char *buf = slot_buffer(p, slot);
+    size_t len = chunk_length(p, p->chunk[slot]);
+    ssize_t n = p->saving ? pwrite(p->fd, buf, len, slot_offset(p, slot))
+                          : pread(p->fd, buf, len, slot_offset(p, slot));
+    return n < 0 ? -errno : n;
+}
+
+static void ioq_push(IoQueue *q, const Pipeline *p, int slot) {
+#ifdef HAVE_IO_URING
+    if (q->ring_fd != -1) {
+        unsigned tail = *q->sq_tail;
+        unsigned index = tail & *q->sq_mask;
+        struct io_uring_sqe *sqe = &q->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = p->saving ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = p->fd;
+        sqe->addr = (unsigned long)slot_buffer(p, slot);
+        sqe->len = chunk_length(p, p->chunk[slot]);
+        sqe->off = slot_offset(p, slot);
+        sqe->user_data = slot;
+        q->sq_array[index] = index;
+        __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        q->to_submit++;
+        return;
+    }
+#endif
+    q->pending[q->pending_count].slot = slot;
+    q->pending[q->pending_count].result = sync_io(p, slot);
+    q->pending_count++;
+}
+
+// 送出排隊的讀寫並等到至少一個完成，回傳完成的數量，失敗回傳 -1
+static int ioq_wait(IoQueue *q, IoCompletion *done) {
+#ifdef HAVE_IO_URING
+    if (q->ring_fd != -1) {
+        for (;;) {
+            int n = syscall(__NR_io_uring_enter, q->ring_fd, q->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (n >= 0) {
+                unsigned submitted = (unsigned)n; // n 不是負數，最多就是送出的數量
+                q->to_submit -= submitted < q->to_submit ? submitted : q->to_submit;
+                break;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return -1;
+            }
+        }
+        unsigned head = *q->cq_head, tail = __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE);
+        int count = 0;
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+            done[count].slot = (int)cqe->user_data;
+            done[count].result = cqe->res;
+            count++;
+        }
+        __atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+#endif
+    int count = q->pending_count;
+    memcpy(done, q->pending, count * sizeof(IoCompletion));
+    q->pending_count = 0;
+    return count;
+}
+
+// 補完只讀寫了一部分的片段（io_uring 與 pread/pwrite 都可能回傳較少的位元組）
+static int finish_io(Pipeline *p, int slot, ssize_t result) {
+    char *buf = slot_buffer(p, slot);
+    size_t len = chunk_length(p, p->chunk[slot]);
+    off_t offset = slot_offset(p, slot);
+    size_t done = 0;
+    while (result >= 0) {
+        done += result;
+        if (done == len || (!p->saving && result == 0)) {
+            break;
+        }
+        result = p->saving ? pwrite(p->fd, buf + done, len - done, offset + done)
+                           : pread(p->fd, buf + done, len - done, offset + done);
+        if (result < 0) {
+            result = -errno;
+        } else if (p->saving && result == 0) {
+            result = -EIO;
+        }
+    }
+    if (result < 0) {
+        return -1;
+    }
+    if (!p->saving) {
+        memset(buf + done, 0, len - done); // 映像檔被截斷時其餘部分維持為零
+        p->valid[slot] = done;
+    }
+    return 0;
+}
+
+// 呼叫的執行緒負責讀寫檔案：儲存時寫出加密好的片段，載入時把空的緩衝區讀滿交給執行緒池
+static int run_io(Pipeline *p, IoQueue *q) {
+    IoCompletion done[MAX_SLOTS];
+    int inflight = 0;
+    pthread_mutex_lock(&p->lock);
+    while (!p->failed && p->completed < p->chunk_count) {
+        int claimed[MAX_SLOTS], count = 0;
+        for (int s = 0; s < p->slot_count; s++) {
+            if (p->saving ? p->state[s] == SLOT_READY : (p->state[s] == SLOT_FREE && p->next_io < p->chunk_count)) {
+                if (!p->saving) {
+                    p->chunk[s] = p->next_io++;
+                }
+                p->state[s] = SLOT_IO;
+                claimed[count++] = s;
+            }
+        }
+        if (count == 0 && inflight == 0) {
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        for (int i = 0; i < count; i++) {
+            ioq_push(q, p, claimed[i]);
+        }
+        inflight += count;
+        STATS_TIMER(io_start);
+        int finished = ioq_wait(q, done);
+        STATS_PHASE(p->saving ? STAT_SAVE_WRITE : STAT_LOAD_READ, io_start);
+        int failed = finished == -1;
+        for (int i = 0; i < finished; i++) {
+            if (finish_io(p, done[i].slot, done[i].result) == -1) {
+                failed = 1;
+            }
+        }
+
+        pthread_mutex_lock(&p->lock);
+        if (failed) {
+            p->failed = 1;
+        }
+        for (int i = 0; i < finished; i++) {
+            if (p->saving) {
+                p->state[done[i].slot] = SLOT_FREE;
+                p->completed++;
+            } else {
+                p->state[done[i].slot] = SLOT_LOADED;
+            }
+        }
+        inflight -= finished > 0 ? finished : 0;
+        if (finished == -1) {
+            inflight = -1; // ring 已無法使用，進行中的讀寫無從得知
+            break;
+        }
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+
+    // 失敗時要等進行中的讀寫結束才能釋放緩衝區
+    while (inflight > 0) {
+        int finished = ioq_wait(q, done);
+        if (finished == -1) {
+            inflight = -1;
+            break;
+        }
+        inflight -= finished;
+    }
+    return inflight == -1 ? -2 : (p->failed ? -1 : 0);
+}
+
+static int thread_count(int chunk_count) {
+    const char *env = getenv("FS_IMAGE_THREADS");
+    long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > IMAGE_MAX_THREADS) {
+        threads = IMAGE_MAX_THREADS;
+    }
+    return threads < chunk_count ? (int)threads : chunk_count;
+}
+
+static int run_pipeline(Pipeline *p) {
+    p->chunk_count = (int)((p->size + IMAGE_CHUNK - 1) / IMAGE_CHUNK);
+    if (p->chunk_count == 0) {
+        return 0;
+    }
+    int threads = thread_count(p->chunk_count);
+    p->slot_count = threads * 2 + 4 < p->chunk_count ? threads * 2 + 4 : p->chunk_count;
+    p->buffers = malloc((size_t)p->slot_count * IMAGE_CHUNK);
+    if (!p->buffers) {
+        return -1;
+    }
+    memset(p->state, 0, sizeof(p->state));
+    p->next_cipher = p->next_io = p->completed = p->failed = 0;
+    p->totals = stats_totals;
+
+    // 只有一個片段時不值得開執行緒
+    if (p->chunk_count == 1) {
+        p->chunk[0] = 0;
+        int result;
+        if (p->saving) {
+            result = cipher_chunk(p, 0) == -1 ? -1 : finish_io(p, 0, sync_io(p, 0));
+        } else {
+            result = finish_io(p, 0, sync_io(p, 0)) == -1 ? -1 : cipher_chunk(p, 0);
+        }
+        free(p->buffers);
+        return result;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    pthread_t workers[IMAGE_MAX_THREADS];
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, cipher_worker, p) == 0) {
+        started++;
+    }
+    IoQueue q;
+    ioq_init(&q, p->slot_count);
+    int result = started > 0 ? run_io(p, &q) : -1;
+    if (started == 0) {
+        fs_printf("Error: Could not start image worker threads.\n");
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    ioq_free(&q);
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    if (result == -2) {
+        // 核心可能還在使用緩衝區，寧可不釋放
+        return -1;
+    }
+    free(p->buffers);
+    return result;
+}
+
+int image_write_partition(FILE *file, size_t size, ImageSource source, void *ctx) {
+    if (fflush(file) != 0) {
+        return -1;
+    }
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.fd = fileno(file);
+    p.base = ftello(file);
+    p.size = size;
+    p.saving = 1;
+    p.source = source;
+    p.ctx = ctx;
+    if (p.base < 0 || run_pipeline(&p) == -1) {
+        return -1;
+    }
+    return fseeko(file, p.base + (off_t)size, SEEK_SET);
+}
+
+int image_read_partition(FILE *file, size_t offset, size_t size) {
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.fd = fileno(file);
+    p.base = ftello(file);
+    p.size = size;
+    p.saving = 0;
+    p.offset = offset;
+    if (p.base < 0 || run_pipeline(&p) == -1) {
+        return -1;
+    }
+    return fseeko(file, p.base + (off_t)size, SEEK_SET);
+}
@@ -0,0 +1,30 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// 映像檔中分區內容的管線化讀寫
+// 分區切成 IMAGE_CHUNK 大小的片段，在執行緒池上加密或解密，同時由呼叫的執行緒以非同步 I/O 讀寫檔案
+// （有 io_uring 時使用 io_uring，否則在呼叫的執行緒中同步 pread/pwrite，仍然與加解密重疊）
+// 加密一律在複製出來的緩衝區中進行，不會就地修改 storage
+// 執行緒數預設為 CPU 數（最多 IMAGE_MAX_THREADS），可用環境變數 FS_IMAGE_THREADS 指定，
+// FS_IMAGE_IO=sync 則不使用 io_uring
+
+#define IMAGE_CHUNK (1024 * 1024)
+#define IMAGE_MAX_THREADS 8
+
+// 提供要寫入的內容：把分區中 [pos, pos + len) 的明文複製到 buf，可能同時被多個執行緒呼叫
+typedef int (*ImageSource)(void *ctx, size_t pos, char *buf, size_t len);
+
+// 從 storage 的 *(size_t *)ctx 位置開始讀取的 ImageSource
+int image_source_storage(void *ctx, size_t pos, char *buf, size_t len);
+
+// 從 file 目前的位置寫入 size 位元組加密後的內容，完成後位置移到這一段之後，失敗回傳 -1
+int image_write_partition(FILE *file, size_t size, ImageSource source, void *ctx);
+
+// 從 file 目前的位置讀取 size 位元組，解密後寫入 storage 的 offset 位置
+// 檔案不足 size 時其餘部分填零，完成後位置移到這一段之後，失敗回傳 -1
+int image_read_partition(FILE *file, size_t offset, size_t size);
+
+#endif
@@ -0,0 +1,310 @@
+// 壓力測試 client：開多條連線對 server 送 pipelined 請求，回報 ops/s 與延遲百分位數
+// 用法：./fsloadgen <socket> [connections] [pipeline depth] [seconds] [payload bytes]
+//       ./fsloadgen <socket> shutdown   讓 server 結束並回到互動模式
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+// 每條連線在自己的目錄下重複這個循環
+static const int cycle_ops[] = { FS_OP_PUT, FS_OP_GET, FS_OP_CAT, FS_OP_LS, FS_OP_RM };
+#define CYCLE_LEN ((int)(sizeof(cycle_ops) / sizeof(cycle_ops[0])))
+
+enum { PHASE_SETUP, PHASE_RUN, PHASE_TEARDOWN, PHASE_DONE };
+
+typedef struct {
+    int fd;
+    int id;
+    int phase;
+    int step;                   // 目前階段中下一個要送出的操作
+    int iteration;              // 第幾次循環（決定檔名）
+    int in_flight;
+    uint64_t *sent_at;          // 已送出、等待回應的請求送出時間（FIFO）
+    int sent_head, sent_tail;
+    char *out;                  // 尚未送出的請求
+    size_t out_len, out_pos, out_cap;
+    char *in;                   // 尚未處理的回應
+    size_t in_len, in_cap;
+} Client;
+
+static uint64_t *latencies;
+static size_t latency_count, latency_cap;
+static long errors;
+static int depth = 8;
+static char *payload;
+static size_t payload_len = 1024;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *grow(void *ptr, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap) {
+        return ptr;
+    }
+    size_t new_cap = *cap ? *cap : 4096;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    ptr = realloc(ptr, new_cap * elem);
+    if (!ptr) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    *cap = new_cap;
+    return ptr;
+}
+
+static void send_request(Client *c, int op, const char *name, const char *data, size_t len) {
+    size_t name_len = strlen(name);
+    FsRequestHeader header = {
+        .body_len = (uint32_t)(name_len + len),
+        .seq = 0,
+        .op = (uint16_t)op,
+        .name_len = (uint16_t)name_len,
+    };
+    size_t total = sizeof(header) + name_len + len;
+    c->out = grow(c->out, &c->out_cap, c->out_len + total, 1);
+    memcpy(c->out + c->out_len, &header, sizeof(header));
+    memcpy(c->out + c->out_len + sizeof(header), name, name_len);
+    if (len > 0) {
+        memcpy(c->out + c->out_len + sizeof(header) + name_len, data, len);
+    }
+    c->out_len += total;
+
+    c->sent_at[c->sent_tail] = now_ns();
+    c->sent_tail = (c->sent_tail + 1) % depth;
+    c->in_flight++;
+}
+
+// 依連線目前的階段補滿 pipeline
+static void fill_pipeline(Client *c, int stopping) {
+    char name[64];
+    while (c->in_flight < depth && c->phase != PHASE_DONE) {
+        if (c->phase == PHASE_SETUP) {
+            snprintf(name, sizeof(name), "lg%d", c->id);
+            send_request(c, c->step == 0 ? FS_OP_MKDIR : FS_OP_CD, name, NULL, 0);
+            if (++c->step == 2) {
+                c->phase = PHASE_RUN;
+                c->step = 0;
+            }
+        } else if (c->phase == PHASE_RUN) {
+            // 只在循環開頭停下，確保檔案都被刪掉
+            if (stopping && c->step == 0) {
+                c->phase = PHASE_TEARDOWN;
+                continue;
+            }
+            int op = cycle_ops[c->step];
+            snprintf(name, sizeof(name), "f%d", c->iteration);
+            if (op == FS_OP_PUT) {
+                send_request(c, op, name, payload, payload_len);
+            } else {
+                send_request(c, op, op == FS_OP_LS ? "" : name, NULL, 0);
+            }
+            if (++c->step == CYCLE_LEN) {
+                c->step = 0;
+                c->iteration++;
+            }
+        } else if (c->phase == PHASE_TEARDOWN) {
+            if (c->step == 0) {
+                send_request(c, FS_OP_CD, "..", NULL, 0);
+                c->step = 1;
+            } else {
+                snprintf(name, sizeof(name), "lg%d", c->id);
+                send_request(c, FS_OP_RMDIR, name, NULL, 0);
+                c->phase = PHASE_DONE;
+            }
+        }
+    }
+}
+
+static int flush_client(Client *c) {
+    while (c->out_pos < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        c->out_pos += n;
+    }
+    c->out_pos = c->out_len = 0;
+    return 0;
+}
+
+// 還有資料沒送完才需要等 EPOLLOUT
+static void update_client_events(int epfd, Client *c) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (c->out_len > c->out_pos) {
+        ev.events |= EPOLLOUT;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// 讀取回應並記錄延遲，連線關閉或錯誤回傳 -1
+static int read_responses(Client *c, int record) {
+    c->in = grow(c->in, &c->in_cap, c->in_len + 65536, 1);
+    ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    c->in_len += n;
+
+    size_t pos = 0;
+    uint64_t now = now_ns();
+    while (c->in_len - pos >= sizeof(FsResponseHeader)) {
+        FsResponseHeader header;
+        memcpy(&header, c->in + pos, sizeof(header));
+        if (c->in_len - pos < sizeof(header) + header.body_len) {
+            break;
+        }
+        pos += sizeof(header) + header.body_len;
+
+        uint64_t sent = c->sent_at[c->sent_head];
+        c->sent_head = (c->sent_head + 1) % depth;
+        c->in_flight--;
+        if (header.status != 0) {
+            errors++;
+        }
+        if (record) {
+            latencies = grow(latencies, &latency_cap, latency_count + 1, sizeof(uint64_t));
+            latencies[latency_count++] = now - sent;
+        }
+    }
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(double p) {
+    if (latency_count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(p * (latency_count - 1));
+    return latencies[index] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <socket> [connections] [pipeline depth] [seconds] [payload bytes]\n", argv[0]);
+        return 1;
+    }
+    const char *socket_path = argv[1];
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    if (argc > 2 && strcmp(argv[2], "shutdown") == 0) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        FsRequestHeader header = { .op = FS_OP_SHUTDOWN };
+        FsResponseHeader reply;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            write(fd, &header, sizeof(header)) != sizeof(header) ||
+            read(fd, &reply, sizeof(reply)) != sizeof(reply)) {
+            perror("shutdown");
+            return 1;
+        }
+        close(fd);
+        return 0;
+    }
+
+    int connections = argc > 2 ? atoi(argv[2]) : 64;
+    depth = argc > 3 ? atoi(argv[3]) : 8;
+    double seconds = argc > 4 ? atof(argv[4]) : 5.0;
+    payload_len = argc > 5 ? (size_t)atol(argv[5]) : 1024;
+    if (connections < 1 || depth < 1 || payload_len < 1) {
+        fprintf(stderr, "Error: connections, depth and payload must be positive.\n");
+        return 1;
+    }
+
+    payload = malloc(payload_len);
+    for (size_t i = 0; i < payload_len; i++) {
+        payload[i] = 'a' + i % 26;
+    }
+
+    int epfd = epoll_create1(0);
+    Client *clients = calloc(connections, sizeof(Client));
+    for (int i = 0; i < connections; i++) {
+        Client *c = &clients[i];
+        c->id = i;
+        c->sent_at = calloc(depth, sizeof(uint64_t));
+        c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            return 1;
+        }
+        // 連上後才設為 non-blocking，避免 connect 回傳 EAGAIN
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        fill_pipeline(c, 0);
+        update_client_events(epfd, c);
+    }
+
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+    int done = 0;
+    struct epoll_event events[64];
+    while (done < connections) {
+        int stopping = now_ns() >= deadline;
+        int n = epoll_wait(epfd, events, 64, 100);
+        for (int i = 0; i < n; i++) {
+            Client *c = events[i].data.ptr;
+            if (c->fd < 0) {
+                continue;
+            }
+            int failed = 0;
+            if (events[i].events & EPOLLIN) {
+                failed = read_responses(c, c->phase == PHASE_RUN) == -1;
+            }
+            if (!failed) {
+                fill_pipeline(c, stopping);
+                failed = flush_client(c) == -1;
+            }
+            if (!failed) {
+                update_client_events(epfd, c);
+            }
+            if (failed || (c->phase == PHASE_DONE && c->in_flight == 0)) {
+                if (failed) {
+                    fprintf(stderr, "Connection %d closed unexpectedly.\n", c->id);
+                }
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                c->fd = -1;
+                done++;
+            }
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    qsort(latencies, latency_count, sizeof(uint64_t), compare_u64);
+    printf("connections: %d\n", connections);
+    printf("pipeline depth: %d\n", depth);
+    printf("payload bytes: %zu\n", payload_len);
+    printf("ops: %zu\n", latency_count);
+    printf("errors: %ld\n", errors);
+    printf("elapsed: %.3f s\n", elapsed);
+    printf("ops/s: %.0f\n", latency_count / elapsed);
+    printf("latency p50: %.1f us\n", percentile_us(0.50));
+    printf("latency p99: %.1f us\n", percentile_us(0.99));
+    printf("latency max: %.1f us\n", percentile_us(1.0));
+    return errors ? 2 : 0;
+}
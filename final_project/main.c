@@ -2,7 +2,7 @@
 
 int main() {
     FileSystem fs;
-    char command[256], arg1[256];
+    char command[256], arg1[256], arg2[256];
     int running = 1;
 
     printf("1. Load from file\n2. Create new partition\n");
@@ -20,7 +20,9 @@ int main() {
         scanf("%d", &size);
         getchar();
         printf("partition size = %d\n", size);
-        init_filesystem(&fs, size, 0); // The first partition starts at 0
+        if (init_filesystem(&fs, size, 0) == -1) { // The first partition starts at 0
+            return 1;
+        }
         printf("Make new partition successful!\n");
         help();
     } else {
@@ -30,48 +32,126 @@ int main() {
 
     while (running) {
         printf("%s$ ", fs.current_path); // Display the current directory
-        scanf("%s", command);
+        if (scanf("%s", command) != 1) { // 輸入結束
+            break;
+        }
+        STATS_TIMER(start); // create 與 edit 的時間包含等待輸入
+        uint64_t trace_start = trace_clock();
+        int result = 0, op = 0; // op 為要記錄到追蹤檔的 FS_OP_*，0 表示不記錄
+        const char *name = arg1, *data = NULL;
 
         if (strcmp(command, "ls") == 0) {
-            ls(&fs);
+            // 選項可有可無，讀取整行的剩餘部分
+            if (fgets(arg1, sizeof(arg1), stdin)) {
+                arg1[strcspn(arg1, "\n")] = '\0';
+                result = ls(&fs, arg1);
+                op = FS_OP_LS;
+            }
+        } else if (strcmp(command, "bitmap") == 0) {
+            if (fgets(arg1, sizeof(arg1), stdin)) {
+                arg1[strcspn(arg1, "\n")] = '\0';
+                result = bitmap(&fs, arg1);
+                op = FS_OP_BITMAP;
+            }
         } else if (strcmp(command, "mkdir") == 0) {
             scanf("%s", arg1);
-            mkdir(&fs, arg1);
+            result = mkdir(&fs, arg1);
+            op = FS_OP_MKDIR;
         } else if (strcmp(command, "rmdir") == 0) {
             scanf("%s", arg1);
-            rmdir(&fs, arg1);
+            result = rmdir(&fs, arg1);
+            op = FS_OP_RMDIR;
         } else if (strcmp(command, "put") == 0) {
             scanf("%s", arg1);
-            put(&fs, arg1);
+            result = put(&fs, arg1);
+            trace_record_file(&fs, FS_OP_PUT, arg1, result, trace_start);
         } else if (strcmp(command, "get") == 0) {
             scanf("%s", arg1);
-            get(&fs, arg1);
+            result = get(&fs, arg1);
+            op = FS_OP_GET;
         } else if (strcmp(command, "cat") == 0) {
             scanf("%s", arg1);
-            cat(&fs, arg1);
+            result = cat(&fs, arg1);
+            op = FS_OP_CAT;
         } else if (strcmp(command, "rm") == 0) {
             scanf("%s", arg1);
-            rm(&fs, arg1);
+            result = rm(&fs, arg1);
+            op = FS_OP_RM;
         } else if (strcmp(command, "status") == 0) {
-            status(&fs);
+            result = status(&fs);
+            op = FS_OP_STATUS;
+            name = "";
         } else if (strcmp(command, "create") == 0) {
             scanf("%s", arg1);
-            create(&fs, arg1);
+            result = create(&fs, arg1);
+            trace_record_file(&fs, FS_OP_CREATE, arg1, result, trace_start);
         } else if (strcmp(command, "edit") == 0) {
             scanf("%s", arg1);
-            edit(&fs, arg1);
+            int before_len = 0;
+            char *before = trace_copy_file(&fs, arg1, &before_len);
+            result = edit(&fs, arg1, trace_record_saved_as);
+            trace_record_edit(&fs, arg1, before, before_len, result, trace_start);
+        } else if (strcmp(command, "cp") == 0) {
+            scanf("%s %s", arg1, arg2);
+            result = cp(&fs, arg1, arg2);
+            op = FS_OP_CP;
+            data = arg2;
+        } else if (strcmp(command, "mv") == 0) {
+            scanf("%s %s", arg1, arg2);
+            result = mv(&fs, arg1, arg2);
+            op = FS_OP_MV;
+            data = arg2;
+        } else if (strcmp(command, "grep") == 0) {
+            // 樣式可以包含空白，讀取整行的剩餘部分
+            char pattern[256];
+            if (fgets(pattern, sizeof(pattern), stdin)) {
+                pattern[strcspn(pattern, "\n")] = '\0';
+                strcpy(arg1, pattern + strspn(pattern, " \t"));
+                result = grep(&fs, arg1);
+                op = FS_OP_GREP;
+            }
+        } else if (strcmp(command, "snapshot") == 0) {
+            char args[512];
+            if (fgets(args, sizeof(args), stdin)) {
+                result = snapshot_command(&fs, args, NULL);
+                args[strcspn(args, "\n")] = '\0';
+                snprintf(arg1, sizeof(arg1), "%s", args + strspn(args, " \t"));
+                op = FS_OP_SNAPSHOT; // 密碼不記錄
+            }
+        } else if (strcmp(command, "stats") == 0) {
+            char args[512];
+            if (fgets(args, sizeof(args), stdin)) {
+                result = stats_command(args);
+            }
+        } else if (strcmp(command, "trace") == 0) {
+            char args[512];
+            if (fgets(args, sizeof(args), stdin)) {
+                trace_command(&fs, args);
+            }
         } else if (strcmp(command, "help") == 0) {
             help();
+            op = FS_OP_HELP;
+            name = "";
         } else if (strcmp(command, "cd") == 0) {
             scanf("%s", arg1);
-            cd(&fs, arg1);
+            result = cd(&fs, arg1);
+            op = FS_OP_CD;
+        } else if (strcmp(command, "serve") == 0) {
+            scanf("%s", arg1);
+            serve(&fs, arg1);
         } else if (strcmp(command, "exit") == 0) {
-            exit_and_store(&fs);
-            running = 0;
+            snapshot_wait(&fs); // 背景儲存中的快照先寫完
+            running = exit_and_store(&fs) == -1; // 存檔失敗時留在迴圈中，trace 繼續記錄，離開迴圈後才關閉
         } else {
             printf("Unknown command: '%s'. Type 'help' for a list of commands.\n", command);
         }
+        if (op) {
+            trace_record(op, name, data, data ? strlen(data) : 0, result, trace_start);
+        }
+        STATS_OP(stats_op_from_name(command), start);
     }
 
-    return 0;
+    snapshot_wait(&fs);
+    trace_close();
+    return storage_shutdown() == -1;
 }
@@ -2,5 +2,9 @@
 #define MAIN_H
 
 #include "command.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
 
 #endif
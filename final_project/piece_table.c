@@ -0,0 +1,644 @@
+#include "piece_table.h"
+#include "filetable.h"
+#include "trigram.h"
+#include "stats.h"
+
+int pt_open(PieceTable *pt, FileSystem *fs, int index) {
+    memset(pt, 0, sizeof(PieceTable));
+    int count = 0;
+    for (int e = index; e != -1; e = file_at(fs, e)->next) {
+        count++;
+    }
+    pt->extents = malloc(count * sizeof(PieceExtent));
+    pt->pieces = malloc(4 * sizeof(Piece));
+    if (!pt->extents || !pt->pieces) {
+        pt_free(pt);
+        fs_printf("Error: Not enough memory to edit '%s'.\n", file_at(fs, index)->name);
+        return -1;
+    }
+    pt->piece_capacity = 4;
+
+    int offset = 0;
+    for (int e = index; e != -1; e = file_at(fs, e)->next) {
+        File *extent = file_at(fs, e);
+        if (extent->extent_size == 0) {
+            continue;
+        }
+        PieceExtent *x = &pt->extents[pt->extent_count++];
+        x->offset = offset;
+        x->length = extent->extent_size;
+        x->start_block = extent->start_block;
+        x->used_blocks = extent->used_blocks;
+        x->skip = extent->skip;
+        offset += extent->extent_size;
+    }
+    pt->original_length = offset;
+    pt->length = offset;
+    if (offset > 0) {
+        pt->pieces[0].source = PIECE_ORIGINAL;
+        pt->pieces[0].start = 0;
+        pt->pieces[0].length = offset;
+        pt->piece_count = 1;
+    }
+    return 0;
+}
+
+void pt_free(PieceTable *pt) {
+    free(pt->extents);
+    free(pt->add);
+    free(pt->pieces);
+    memset(pt, 0, sizeof(PieceTable));
+}
+
+// 取得從 offset 開始的一段連續內容，*data 指向它，回傳長度（0 表示已到結尾，讀取失敗回傳 -1）
+// 附加緩衝區與整個分區在記憶體中時的原始內容直接指過去，分層儲存時把原始內容讀進 buffer（最多 capacity 個位元組）
+static int pt_chunk(const PieceTable *pt, int offset, char *buffer, int capacity, const char **data) {
+    int pos = 0;
+    for (int i = 0; i < pt->piece_count; i++) {
+        const Piece *p = &pt->pieces[i];
+        if (offset >= pos + p->length) {
+            pos += p->length;
+            continue;
+        }
+        int skip = offset - pos;
+        int n = p->length - skip;
+        if (p->source == PIECE_ADD) {
+            *data = pt->add + p->start + skip;
+            return n;
+        }
+        // 原始內容：找出這個位置所在的 extent，一次只交出同一段 extent 中的內容
+        int o = p->start + skip;
+        for (int e = 0; e < pt->extent_count; e++) {
+            const PieceExtent *x = &pt->extents[e];
+            if (o >= x->offset + x->length) {
+                continue;
+            }
+            if (n > x->offset + x->length - o) {
+                n = x->offset + x->length - o;
+            }
+            size_t at = (size_t)x->start_block * BLOCK_SIZE + x->skip + (o - x->offset);
+            if (storage) {
+                *data = storage + at;
+                return n;
+            }
+            if (n > capacity) {
+                n = capacity;
+            }
+            if (storage_read(at, buffer, n) == -1) {
+                return -1;
+            }
+            *data = buffer;
+            return n;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static int reserve_pieces(PieceTable *pt, int count) {
+    if (count <= pt->piece_capacity) {
+        return 0;
+    }
+    int capacity = pt->piece_capacity ? pt->piece_capacity * 2 : 4;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    Piece *pieces = realloc(pt->pieces, capacity * sizeof(Piece));
+    if (!pieces) {
+        return -1;
+    }
+    pt->pieces = pieces;
+    pt->piece_capacity = capacity;
+    return 0;
+}
+
+// 確保有片段剛好從 offset 開始，回傳該片段的索引（offset 等於總長度時回傳 piece_count）
+static int split_at(PieceTable *pt, int offset) {
+    int pos = 0;
+    for (int i = 0; i < pt->piece_count; i++) {
+        Piece *p = &pt->pieces[i];
+        if (offset == pos) {
+            return i;
+        }
+        if (offset < pos + p->length) {
+            if (reserve_pieces(pt, pt->piece_count + 1) == -1) {
+                return -1;
+            }
+            p = &pt->pieces[i];
+            memmove(p + 1, p, (pt->piece_count - i) * sizeof(Piece));
+            int head = offset - pos;
+            p[1].start += head;
+            p[1].length -= head;
+            p[0].length = head;
+            pt->piece_count++;
+            return i + 1;
+        }
+        pos += p->length;
+    }
+    return pt->piece_count;
+}
+
+int pt_insert(PieceTable *pt, int offset, const char *text, int len) {
+    if (offset < 0 || offset > pt->length || len < 0) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    // 文字一律附加到附加緩衝區的尾端
+    if (pt->add_length + len > pt->add_capacity) {
+        int capacity = pt->add_capacity ? pt->add_capacity : 1024;
+        while (capacity < pt->add_length + len) {
+            capacity *= 2;
+        }
+        char *add = realloc(pt->add, capacity);
+        if (!add) {
+            return -1;
+        }
+        pt->add = add;
+        pt->add_capacity = capacity;
+    }
+    int add_start = pt->add_length;
+    memcpy(pt->add + add_start, text, len);
+    pt->add_length += len;
+
+    int k = split_at(pt, offset);
+    if (k == -1) {
+        return -1;
+    }
+
+    // 緊接在上一次插入之後繼續輸入時，直接延長前一個片段
+    if (k > 0 && pt->pieces[k - 1].source == PIECE_ADD &&
+        pt->pieces[k - 1].start + pt->pieces[k - 1].length == add_start) {
+        pt->pieces[k - 1].length += len;
+    } else {
+        if (reserve_pieces(pt, pt->piece_count + 1) == -1) {
+            return -1;
+        }
+        memmove(&pt->pieces[k + 1], &pt->pieces[k], (pt->piece_count - k) * sizeof(Piece));
+        pt->pieces[k].source = PIECE_ADD;
+        pt->pieces[k].start = add_start;
+        pt->pieces[k].length = len;
+        pt->piece_count++;
+    }
+    pt->length += len;
+    return 0;
+}
+
+int pt_delete(PieceTable *pt, int offset, int len) {
+    if (offset < 0 || len < 0 || offset + len > pt->length) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    int first = split_at(pt, offset);
+    if (first == -1) {
+        return -1;
+    }
+    int last = split_at(pt, offset + len);
+    if (last == -1) {
+        return -1;
+    }
+    memmove(&pt->pieces[first], &pt->pieces[last], (pt->piece_count - last) * sizeof(Piece));
+    pt->piece_count -= last - first;
+    pt->length -= len;
+    return 0;
+}
+
+
+int pt_read(const PieceTable *pt, int offset, char *buf, int len) {
+    int copied = 0;
+    while (copied < len) {
+        const char *data;
+        int n = pt_chunk(pt, offset + copied, buf + copied, len - copied, &data);
+        if (n <= 0) {
+            break;
+        }
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        if (data != buf + copied) {
+            memcpy(buf + copied, data, n);
+        }
+        copied += n;
+    }
+    return copied;
+}
+
+int pt_line_offset(const PieceTable *pt, int line) {
+    if (line < 1) {
+        return -1;
+    }
+    if (line == 1) {
+        return 0;
+    }
+    char buffer[16384];
+    int pos = 0, current = 1;
+    while (pos < pt->length) {
+        const char *data;
+        int n = pt_chunk(pt, pos, buffer, sizeof(buffer), &data);
+        if (n <= 0) {
+            return -1;
+        }
+        const char *end = data + n;
+        const char *nl = data;
+        while ((nl = memchr(nl, '\n', end - nl)) != NULL) {
+            nl++;
+            if (++current == line) {
+                return pos + (int)(nl - data);
+            }
+        }
+        pos += n;
+    }
+    // 最後一行沒有換行時，其下一行從總長度開始
+    if (current + 1 == line && pt->length > 0) {
+        char last;
+        if (pt_read(pt, pt->length - 1, &last, 1) == 1 && last != '\n') {
+            return pt->length;
+        }
+    }
+    return -1;
+}
+
+int pt_line_count(const PieceTable *pt) {
+    char buffer[16384];
+    int lines = 0, pos = 0;
+    char last = '\n';
+    while (pos < pt->length) {
+        const char *data;
+        int n = pt_chunk(pt, pos, buffer, sizeof(buffer), &data);
+        if (n <= 0) {
+            break;
+        }
+        const char *end = data + n;
+        for (const char *nl = data; (nl = memchr(nl, '\n', end - nl)) != NULL; nl++) {
+            lines++;
+        }
+        last = data[n - 1];
+        pos += n;
+    }
+    return last == '\n' ? lines : lines + 1;
+}
+
+// 把內容 [begin, begin + len) 依序寫到 storage 的 offset 位置
+static int store_range(const PieceTable *pt, int begin, int len, size_t offset) {
+    char buffer[64 * 1024];
+    for (int done = 0; done < len;) {
+        int want = len - done < (int)sizeof(buffer) ? len - done : (int)sizeof(buffer);
+        if (pt_read(pt, begin + done, buffer, want) != want || storage_write(offset + done, buffer, want) == -1) {
+            return -1;
+        }
+        done += want;
+    }
+    return 0;
+}
+
+int pt_store(const PieceTable *pt, size_t offset) {
+    return store_range(pt, 0, pt->length, offset);
+}
+
+// 以區塊為單位記錄需要重寫的範圍 [first, last]
+typedef struct {
+    int first, last;
+} BlockRange;
+
+// 長度不變、檔案只有一段且沒有共用時就地寫回：原樣保留在原位置的片段不需要重寫，其餘片段涵蓋的區塊才寫回
+// 就地寫入到一半失敗時已寫入的區塊無法還原
+static int save_in_place(FileSystem *fs, int index, const PieceTable *pt) {
+    File *file = file_mut(fs, index);
+    int new_size = pt->length;
+    BlockRange *ranges = NULL;
+    int range_count = 0, range_capacity = 0;
+    int offset = 0;
+    for (int i = 0; i < pt->piece_count; i++) {
+        const Piece *p = &pt->pieces[i];
+        if (!(p->source == PIECE_ORIGINAL && p->start == offset)) {
+            int first = offset / BLOCK_SIZE;
+            int last = (offset + p->length - 1) / BLOCK_SIZE;
+            if (range_count > 0 && first <= ranges[range_count - 1].last + 1) {
+                if (last > ranges[range_count - 1].last) {
+                    ranges[range_count - 1].last = last;
+                }
+            } else {
+                if (range_count == range_capacity) {
+                    int capacity = range_capacity ? range_capacity * 2 : 8;
+                    BlockRange *grown = realloc(ranges, capacity * sizeof(BlockRange));
+                    if (!grown) {
+                        free(ranges);
+                        fs_printf("Error: Not enough memory to update file '%s'.\n", file->name);
+                        return -1;
+                    }
+                    ranges = grown;
+                    range_capacity = capacity;
+                }
+                ranges[range_count].first = first;
+                ranges[range_count].last = last;
+                range_count++;
+            }
+        }
+        offset += p->length;
+    }
+
+    // 片段可能引用即將被覆寫的原始區塊，所以先把所有變動的區塊組好再一起寫入
+    int dirty_bytes = 0;
+    for (int r = 0; r < range_count; r++) {
+        int begin = ranges[r].first * BLOCK_SIZE;
+        int end = (ranges[r].last + 1) * BLOCK_SIZE;
+        dirty_bytes += (end < new_size ? end : new_size) - begin;
+    }
+    char *staging = malloc(dirty_bytes > 0 ? dirty_bytes : 1);
+    if (!staging) {
+        free(ranges);
+        fs_printf("Error: Not enough memory to update file '%s'.\n", file->name);
+        return -1;
+    }
+    int staged = 0;
+    for (int r = 0; r < range_count; r++) {
+        int begin = ranges[r].first * BLOCK_SIZE;
+        int end = (ranges[r].last + 1) * BLOCK_SIZE;
+        int n = (end < new_size ? end : new_size) - begin;
+        if (pt_read(pt, begin, staging + staged, n) != n) {
+            free(staging);
+            free(ranges);
+            fs_printf("Error: Could not read file '%s'.\n", file->name);
+            return -1;
+        }
+        staged += n;
+    }
+
+    staged = 0;
+    int written_blocks = 0;
+    for (int r = 0; r < range_count; r++) {
+        int begin = ranges[r].first * BLOCK_SIZE;
+        int end = (ranges[r].last + 1) * BLOCK_SIZE;
+        int n = (end < new_size ? end : new_size) - begin;
+        if (storage_write((size_t)file->start_block * BLOCK_SIZE + begin, staging + staged, n) == -1) {
+            fs_printf("Error: Could not write file '%s'; its content may be incomplete.\n", file->name);
+            written_blocks = -1; // 已寫入的區塊無法還原，仍重新索引，讓索引與內容一致
+            break;
+        }
+        staged += n;
+        written_blocks += ranges[r].last - ranges[r].first + 1;
+    }
+    STATS_ADD(STAT_BYTES_IN, staged);
+    free(staging);
+    free(ranges);
+    trigram_index_update(fs, index);
+    return written_blocks;
+}
+
+// 整個內容寫到一段新的連續區塊，寫入成功後才釋放原本的 extent
+static int save_rewrite(FileSystem *fs, int index, const PieceTable *pt) {
+    const char *name = file_at(fs, index)->name;
+    int required_blocks = (pt->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (required_blocks > fs->free_blocks) {
+        fs_printf("Error: Not enough space to update file '%s'.\n", name);
+        return -1;
+    }
+    int start_block = find_free_blocks(fs, required_blocks);
+    if (start_block == -1) {
+        fs_printf("Error: Not enough continuous space to update file '%s'.\n", name);
+        return -1;
+    }
+    // 新位置與舊區塊不重疊，可以直接從片段寫入；寫入失敗時還沒有改動任何東西
+    if (pt_store(pt, (size_t)start_block * BLOCK_SIZE) == -1) {
+        fs_printf("Error: Could not write file '%s'.\n", name);
+        return -1;
+    }
+    STATS_ADD(STAT_BYTES_IN, pt->length);
+    release_file_extents(fs, index);
+    claim_extent(fs, start_block, required_blocks);
+    set_file_extent(file_mut(fs, index), start_block, required_blocks, pt->length);
+    trigram_index_update(fs, index);
+    return required_blocks;
+}
+
+// 新內容的一段 extent：引用原本的配置，或是 fresh（插入的文字，寫入時才配置新的區塊）
+typedef struct {
+    int start_block, used_blocks;
+    int skip, length;
+    int offset;              // 在新內容中的位置
+    int fresh;
+} Splice;
+
+typedef struct {
+    Splice *items;
+    int count, capacity;
+} SpliceList;
+
+// 接在串列尾端，能與前一段接起來時直接延長
+static int push_splice(SpliceList *list, Splice item) {
+    if (list->count > 0) {
+        Splice *last = &list->items[list->count - 1];
+        if ((item.fresh && last->fresh) ||
+            (!item.fresh && !last->fresh && last->start_block == item.start_block &&
+             last->skip + last->length == item.skip)) {
+            last->length += item.length;
+            return 0;
+        }
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 8;
+        Splice *items = realloc(list->items, capacity * sizeof(Splice));
+        if (!items) {
+            return -1;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = item;
+    return 0;
+}
+
+// 依片段組出新內容的 extent 串列：原始內容的片段對應回它所在的 extent，附加的文字成為 fresh
+static int build_splices(const PieceTable *pt, SpliceList *list) {
+    int offset = 0;
+    for (int i = 0; i < pt->piece_count; i++) {
+        const Piece *p = &pt->pieces[i];
+        if (p->source == PIECE_ADD) {
+            Splice item = { .start_block = -1, .length = p->length, .offset = offset, .fresh = 1 };
+            if (push_splice(list, item) == -1) {
+                return -1;
+            }
+        } else {
+            int o = p->start, at = offset, remaining = p->length;
+            for (int e = 0; e < pt->extent_count && remaining > 0; e++) {
+                const PieceExtent *x = &pt->extents[e];
+                if (o >= x->offset + x->length) {
+                    continue;
+                }
+                int n = x->offset + x->length - o;
+                if (n > remaining) {
+                    n = remaining;
+                }
+                Splice item = { x->start_block, x->used_blocks, x->skip + (o - x->offset), n, at, 0 };
+                if (push_splice(list, item) == -1) {
+                    return -1;
+                }
+                o += n;
+                at += n;
+                remaining -= n;
+            }
+        }
+        offset += p->length;
+    }
+    return 0;
+}
+
+int pt_save(FileSystem *fs, int index, const PieceTable *pt) {
+    File *file = file_at(fs, index);
+    if (pt->length == file->size && file->next == -1 && file->skip == 0 && !extent_shared(fs, file->start_block)) {
+        return save_in_place(fs, index, pt);
+    }
+
+    if (pt->length == 0) {
+        // 內容全部刪除：放掉所有 extent，檔案不再佔用區塊
+        int start_block = file->start_block;
+        release_file_extents(fs, index);
+        set_file_extent(file_mut(fs, index), start_block, 0, 0);
+        trigram_index_update(fs, index);
+        return 0;
+    }
+
+    SpliceList list = { NULL, 0, 0 };
+    if (build_splices(pt, &list) == -1) {
+        free(list.items);
+        fs_printf("Error: Not enough memory to update file '%s'.\n", file->name);
+        return -1;
+    }
+    if (list.count > PT_MAX_EXTENTS) {
+        free(list.items);
+        return save_rewrite(fs, index, pt);
+    }
+
+    // 檔案原本的延續項目，新的串列沿用它們，不夠時再配置
+    int old_count = 0;
+    for (int e = file->next; e != -1; e = file_at(fs, e)->next) {
+        old_count++;
+    }
+    int needed = list.count - 1;
+    int *old_entries = malloc((old_count > 0 ? old_count : 1) * sizeof(int));
+    int *entries = malloc((needed > 0 ? needed : 1) * sizeof(int));
+    if (!old_entries || !entries) {
+        free(old_entries);
+        free(entries);
+        free(list.items);
+        fs_printf("Error: Not enough memory to update file '%s'.\n", file->name);
+        return -1;
+    }
+    old_count = 0;
+    for (int e = file->next; e != -1; e = file_at(fs, e)->next) {
+        old_entries[old_count++] = e;
+    }
+
+    // 插入的文字寫到新配置的區塊，這一步失敗時檔案保持原狀
+    int fresh_blocks = 0, written = 0, allocated = 0, failed = 0;
+    for (int k = 0; k < list.count; k++) {
+        if (list.items[k].fresh) {
+            fresh_blocks += (list.items[k].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+    }
+    if (fresh_blocks > fs->free_blocks) {
+        fs_printf("Error: Not enough space to update file '%s'.\n", file->name);
+        failed = 1;
+    }
+    for (int k = 0; !failed && k < list.count; k++) {
+        Splice *item = &list.items[k];
+        if (!item->fresh) {
+            continue;
+        }
+        int blocks = (item->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        int start_block = find_free_blocks(fs, blocks);
+        if (start_block == -1) {
+            fs_printf("Error: Not enough continuous space to update file '%s'.\n", file_at(fs, index)->name);
+            failed = 1;
+            break;
+        }
+        claim_extent(fs, start_block, blocks);
+        item->start_block = start_block;
+        item->used_blocks = blocks;
+        item->skip = 0;
+        if (store_range(pt, item->offset, item->length, (size_t)start_block * BLOCK_SIZE) == -1) {
+            fs_printf("Error: Could not write file '%s'.\n", file_at(fs, index)->name);
+            failed = 1;
+            break;
+        }
+        written += blocks;
+        STATS_ADD(STAT_BYTES_IN, item->length);
+    }
+    for (; !failed && allocated + old_count < needed; allocated++) {
+        int entry = file_table_alloc_extent(fs);
+        if (entry == -1) {
+            fs_printf("Error: Could not allocate memory for file table.\n");
+            failed = 1;
+            break;
+        }
+        entries[old_count + allocated] = entry;
+    }
+    if (failed) {
+        for (int k = 0; k < list.count; k++) {
+            if (list.items[k].fresh && list.items[k].start_block != -1) {
+                release_extent(fs, list.items[k].start_block, list.items[k].used_blocks);
+            }
+        }
+        for (int k = 0; k < allocated; k++) {
+            file_table_release(fs, entries[old_count + k]);
+        }
+        free(old_entries);
+        free(entries);
+        free(list.items);
+        return -1;
+    }
+    for (int k = 0; k < old_count && k < needed; k++) {
+        entries[k] = old_entries[k];
+    }
+
+    // 新的 extent 先各自引用原本的配置，再放掉舊的 extent：只剩舊 extent 引用的配置才會釋放
+    for (int k = 0; k < list.count; k++) {
+        if (!list.items[k].fresh) {
+            share_extent(fs, list.items[k].start_block);
+        }
+    }
+    release_extent(fs, file->start_block, file->used_blocks);
+    for (int k = 0; k < old_count; k++) {
+        File *extent = file_at(fs, old_entries[k]);
+        release_extent(fs, extent->start_block, extent->used_blocks);
+    }
+
+    // 只剩這一段 extent 引用的配置，釋放前後已經沒有內容的區塊，刪除的內容因此不會一直佔用空間
+    for (int k = 0; k < list.count; k++) {
+        Splice *item = &list.items[k];
+        int unique = !item->fresh && !extent_shared(fs, item->start_block);
+        for (int j = 0; unique && j < list.count; j++) {
+            unique = j == k || list.items[j].start_block != item->start_block;
+        }
+        if (unique) {
+            int first = item->skip / BLOCK_SIZE;
+            int count = (item->skip + item->length - 1) / BLOCK_SIZE - first + 1;
+            item->start_block = trim_extent(fs, item->start_block, item->used_blocks, first, count);
+            item->used_blocks = count;
+            item->skip -= first * BLOCK_SIZE;
+        }
+    }
+
+    // 寫入新的 extent 串列，多出來的舊延續項目變成墓碑
+    for (int k = 0; k < list.count; k++) {
+        File *extent = file_mut(fs, k == 0 ? index : entries[k - 1]);
+        extent->start_block = list.items[k].start_block;
+        extent->used_blocks = list.items[k].used_blocks;
+        extent->skip = list.items[k].skip;
+        extent->extent_size = list.items[k].length;
+        extent->next = k + 1 < list.count ? entries[k] : -1;
+    }
+    for (int k = needed; k < old_count; k++) {
+        file_table_release(fs, old_entries[k]);
+    }
+    file_mut(fs, index)->size = pt->length;
+    free(old_entries);
+    free(entries);
+    free(list.items);
+    trigram_index_update(fs, index);
+    return written;
+}
@@ -0,0 +1,70 @@
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include "filesystem.h"
+
+// piece table：檔案內容以「原始內容」與「附加緩衝區」上的片段(piece)串接表示
+// 插入只把文字加到附加緩衝區並切分片段，刪除只調整片段，不會搬動原始內容
+// 原始內容只記錄它在哪幾段 extent 中，需要時才經由區塊層讀取，開啟大檔案不需要複製整個檔案
+
+#define PIECE_ORIGINAL 0
+#define PIECE_ADD      1
+
+typedef struct {
+    int source;   // PIECE_ORIGINAL 或 PIECE_ADD
+    int start;    // 在來源中的起始位置
+    int length;
+} Piece;
+
+// 開啟時檔案的一段 extent（見 filesystem.h）
+typedef struct {
+    int offset;                   // 在原始內容中的起始位置
+    int length;
+    int start_block, used_blocks; // 引用的配置
+    int skip;                     // 內容從 start_block 開頭算起的位元組位移
+} PieceExtent;
+
+typedef struct {
+    PieceExtent *extents;   // 原始內容依序由這幾段 extent 組成
+    int extent_count;
+    int original_length;
+    char *add;              // 附加緩衝區，只會往後加
+    int add_length, add_capacity;
+    Piece *pieces;
+    int piece_count, piece_capacity;
+    int length;             // 目前內容的總長度
+} PieceTable;
+
+void pt_free(PieceTable *pt);
+
+// 以 fs 中第 index 個檔案目前的內容作為原始內容，只記錄它的 extent，不讀取內容
+// 記憶體不足時回傳 -1，pt 為空的，仍可以 pt_free
+int pt_open(PieceTable *pt, FileSystem *fs, int index);
+
+// 在 offset 插入 len 個位元組，成功回傳 0
+int pt_insert(PieceTable *pt, int offset, const char *text, int len);
+
+// 刪除從 offset 開始的 len 個位元組，成功回傳 0
+int pt_delete(PieceTable *pt, int offset, int len);
+
+// 從 offset 複製最多 len 個位元組到 buf，回傳實際複製的數量（讀取原始內容失敗時會少於要求的數量）
+int pt_read(const PieceTable *pt, int offset, char *buf, int len);
+
+// 第 line 行（從 1 開始）的起始位置；line 為最後一行的下一行時回傳總長度，超出範圍回傳 -1
+int pt_line_offset(const PieceTable *pt, int line);
+
+// 內容的行數（最後一行沒有換行也算一行）
+int pt_line_count(const PieceTable *pt);
+
+// 把整個內容依序寫到 storage 的 offset 位置，分段經由區塊層寫入
+int pt_store(const PieceTable *pt, size_t offset);
+
+// 把內容寫回 fs 中第 index 個檔案，回傳寫入的區塊數，失敗回傳 -1 且檔案保持原狀
+// 原始內容留在原本的區塊中，由新的 extent 串列引用（與其他檔案或快照共用的區塊也一樣），
+// 只有插入的文字寫到新配置的 extent，所以插入與刪除的成本與編輯的大小有關，與檔案大小無關
+// 長度不變的修改且檔案只有一段、沒有共用時，直接就地寫入被改到的區塊
+// extent 超過 PT_MAX_EXTENTS 段時整個檔案重寫成一段連續的區塊
+#define PT_MAX_EXTENTS 64
+int pt_save(FileSystem *fs, int index, const PieceTable *pt);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// 本機 client/server 模式使用的二進位協定
+// 每個請求為 FsRequestHeader + body，body = 名稱(name_len 位元組，不含 '\0') + 資料
+// 每個回應為 FsResponseHeader + body，body 為指令輸出（get 則為檔案內容）
+// 只走 Unix domain socket，所以整數直接使用本機位元組序
+// 同一條連線上的請求依序處理，client 可以不等回應就連續送出多個請求（pipelining）
+
+enum {
+    FS_OP_LS = 1,   // 名稱為 ls 的選項（可以是空字串）
+    FS_OP_MKDIR,
+    FS_OP_RMDIR,
+    FS_OP_CD,
+    FS_OP_PUT,      // 名稱 + 檔案內容
+    FS_OP_GET,      // 回應 body 為檔案內容
+    FS_OP_RM,
+    FS_OP_CAT,
+    FS_OP_STATUS,
+    FS_OP_CREATE,   // 名稱 + 文字內容
+    FS_OP_EDIT,     // 名稱 + FsEditSpan + 要插入的文字
+    FS_OP_HELP,
+    FS_OP_SAVE,     // 名稱為映像檔檔名，資料為密碼
+    FS_OP_SHUTDOWN, // 結束 server，回到互動模式
+    FS_OP_GREP,     // 名稱為搜尋字串
+    FS_OP_CP,       // 名稱為來源，資料為目的地
+    FS_OP_MV,       // 名稱為來源，資料為目的地
+    FS_OP_SNAPSHOT, // 名稱為 snapshot 指令的參數，save 時資料為密碼
+    FS_OP_STATS,    // 名稱為 stats 指令的參數
+    FS_OP_BITMAP,   // 名稱為 bitmap 指令的參數
+    FS_OP_COUNT
+};
+
+typedef struct {
+    uint32_t body_len; // header 之後的位元組數
+    uint32_t seq;      // client 自訂序號，回應會原樣帶回
+    uint16_t op;       // FS_OP_*
+    uint16_t name_len; // body 開頭名稱的長度
+} FsRequestHeader;
+
+typedef struct {
+    uint32_t body_len;
+    uint32_t seq;
+    int32_t status;    // 0 成功，-1 失敗
+} FsResponseHeader;
+
+// FS_OP_EDIT 的資料開頭：刪除 [offset, offset + delete_len) 後在 offset 插入其餘資料
+typedef struct {
+    uint32_t offset;
+    uint32_t delete_len;
+} FsEditSpan;
+
+#define FS_MAX_BODY (64u * 1024 * 1024) // 單一請求 body 上限
+
+#endif
@@ -0,0 +1,217 @@
+// 重新執行 trace 指令記錄的工作負載，回報每種操作的執行時間並與記錄時比較
+// 用法：./fsreplay <trace> [--paced] [--verbose] [--image <file> <password>] [--save <file> <password>]
+//   --paced    依記錄的時間間隔送出操作（預設為儘快執行）
+//   --verbose  逐筆印出每個操作
+//   --image    從映像檔開始重播（應與開始記錄時的狀態相同），預設為記錄時大小的新分區
+//   --save     重播結束後存成映像檔，並回報儲存時間
+// 操作的輸出全部丟棄，重播時若結果（成功或失敗）與記錄時不同會印出警告
+#include <time.h>
+
+#include "dispatch.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
+
+#define MAX_MISMATCH_REPORTS 10
+
+typedef struct {
+    long count;
+    uint64_t recorded_ns;       // 記錄時的總執行時間
+    uint64_t *durations;        // 重播時每一筆的執行時間
+    long capacity;
+} OpTimes;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t target) {
+    struct timespec ts = { .tv_sec = target / 1000000000u, .tv_nsec = target % 1000000000u };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s <trace> [--paced] [--verbose] [--image <file> <password>] [--save <file> <password>]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = NULL, *image = NULL, *image_password = NULL;
+    const char *save_path = NULL, *save_password = NULL;
+    int paced = 0, verbose = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--paced") == 0) {
+            paced = 1;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "--image") == 0 && i + 2 < argc) {
+            image = argv[++i];
+            image_password = argv[++i];
+        } else if (strcmp(argv[i], "--save") == 0 && i + 2 < argc) {
+            save_path = argv[++i];
+            save_password = argv[++i];
+        } else if (!trace_path && argv[i][0] != '-') {
+            trace_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!trace_path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *trace = fopen(trace_path, "rb");
+    if (!trace) {
+        fprintf(stderr, "Error: Could not open trace '%s'.\n", trace_path);
+        return 1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, trace) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "Error: '%s' is not a trace file.\n", trace_path);
+        return 1;
+    }
+    if (header.block_size != BLOCK_SIZE) {
+        fprintf(stderr, "Error: Trace was recorded with %u-byte blocks, this build uses %d.\n",
+                header.block_size, BLOCK_SIZE);
+        return 1;
+    }
+
+    FileSystem fs;
+    if (image) {
+        if (restore_filesystem(&fs, image, image_password) == -1) {
+            return 1;
+        }
+    } else {
+        if (init_filesystem(&fs, header.partition_size, 0) == -1) {
+            return 1;
+        }
+    }
+
+    FILE *out = fopen("/dev/null", "w");
+    if (!out) {
+        perror("/dev/null");
+        return 1;
+    }
+    FsOp cd = { .op = FS_OP_CD, .name = header.cwd };
+    if (execute_op(&fs, &cd, out) == -1) {
+        fprintf(stderr, "Warning: Could not change to the recorded directory '%s'.\n", header.cwd);
+    }
+
+    OpTimes times[FS_OP_COUNT];
+    memset(times, 0, sizeof(times));
+    char name[65536];
+    char *data = NULL;
+    size_t data_capacity = 0;
+    long replayed = 0, mismatches = 0;
+    uint64_t origin = now_ns(), busy = 0;
+
+    TraceRecord record;
+    while (fread(&record, sizeof(record), 1, trace) == 1) {
+        if (record.op <= 0 || record.op >= FS_OP_COUNT ||
+            fread(name, 1, record.name_len, trace) != record.name_len) {
+            fprintf(stderr, "Error: Trace is corrupted after %ld operations.\n", replayed);
+            break;
+        }
+        name[record.name_len] = '\0';
+        if (record.data_len > data_capacity) {
+            char *grown = realloc(data, record.data_len);
+            if (!grown) {
+                fprintf(stderr, "Error: Not enough memory for operation #%ld (%u bytes).\n",
+                        replayed + 1, record.data_len);
+                return 1;
+            }
+            data = grown;
+            data_capacity = record.data_len;
+        }
+        if (fread(data, 1, record.data_len, trace) != record.data_len) {
+            fprintf(stderr, "Error: Trace is truncated after %ld operations.\n", replayed);
+            break;
+        }
+
+        if (paced) {
+            sleep_until(origin + record.start_ns);
+        }
+        FsOp op = { .op = record.op, .name = name, .data = data, .data_len = record.data_len };
+        uint64_t start = now_ns();
+        int status = execute_op(&fs, &op, out);
+        uint64_t elapsed = now_ns() - start;
+        busy += elapsed;
+
+        OpTimes *t = &times[record.op];
+        if (t->count == t->capacity) {
+            long capacity = t->capacity ? t->capacity * 2 : 64;
+            uint64_t *durations = realloc(t->durations, capacity * sizeof(uint64_t));
+            if (!durations) {
+                fprintf(stderr, "Error: Not enough memory to record timings after %ld operations.\n", replayed);
+                return 1;
+            }
+            t->durations = durations;
+            t->capacity = capacity;
+        }
+        t->durations[t->count++] = elapsed;
+        t->recorded_ns += record.duration_ns;
+        replayed++;
+
+        if (status != record.status && mismatches++ < MAX_MISMATCH_REPORTS) {
+            fprintf(stderr, "Warning: #%ld %s '%s' returned %d, recorded %d.\n",
+                    replayed, stats_op_name(record.op), name, status, record.status);
+        }
+        if (verbose) {
+            printf("#%-6ld %-9s %-32s recorded %10.2f us  replay %10.2f us  status %d\n",
+                   replayed, stats_op_name(record.op), name, record.duration_ns / 1e3, elapsed / 1e3, status);
+        }
+    }
+    fclose(trace);
+    uint64_t wall = now_ns() - origin;
+    snapshot_wait(&fs); // 背景儲存的快照也算在重播內
+
+    printf("replayed %ld operations in %.3f s (%.3f s executing, %s), %ld status mismatches\n",
+           replayed, wall / 1e9, busy / 1e9, paced ? "paced" : "as fast as possible", mismatches);
+    printf("%-9s %8s %12s %12s %10s %10s %10s %10s\n",
+           "op", "count", "recorded ms", "replay ms", "avg us", "p50 us", "p99 us", "max us");
+    for (int op = 1; op < FS_OP_COUNT; op++) {
+        OpTimes *t = &times[op];
+        if (t->count == 0) {
+            continue;
+        }
+        uint64_t total = 0;
+        for (long i = 0; i < t->count; i++) {
+            total += t->durations[i];
+        }
+        qsort(t->durations, t->count, sizeof(uint64_t), compare_u64);
+        printf("%-9s %8ld %12.3f %12.3f %10.2f %10.2f %10.2f %10.2f\n", stats_op_name(op), t->count,
+               t->recorded_ns / 1e6, total / 1e6, total / 1e3 / t->count,
+               t->durations[t->count / 2] / 1e3, t->durations[t->count * 99 / 100] / 1e3,
+               t->durations[t->count - 1] / 1e3);
+        free(t->durations);
+    }
+    free(data);
+
+    if (save_path) {
+        uint64_t start = now_ns();
+        fs_output = out;
+        int result = store_filesystem(&fs, save_path, save_password);
+        fs_output = NULL;
+        if (result == -1) {
+            fprintf(stderr, "Error: Could not save '%s'.\n", save_path);
+            return 1;
+        }
+        printf("saved '%s' in %.3f ms\n", save_path, (now_ns() - start) / 1e6);
+    }
+    fclose(out);
+    free_filesystem(&fs);
+    if (storage_shutdown() == -1) {
+        return 1;
+    }
+    return mismatches > 0 ? 2 : 0;
+}
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE // accept4
+#include "server.h"
+#include "dispatch.h"
+#include "filetable.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+#define READ_CHUNK 65536
+#define MAX_PENDING_OUTPUT (4 * 1024 * 1024) // 待送出資料超過此量就暫停讀取
+
+typedef struct Connection {
+    int fd;
+    char *in;                   // 尚未處理的請求資料
+    size_t in_len, in_cap;
+    char *out;                  // 尚未送出的回應資料
+    size_t out_len, out_pos, out_cap;
+    int events;                 // 目前向 epoll 註冊的事件
+    char cwd[MAX_PATH];         // 這條連線的目前目錄
+    int same_user;              // 對方與 server 是同一個使用者，只有這種連線可以 shutdown
+    struct Connection *prev, *next;
+} Connection;
+
+static Connection *connections = NULL; // 所有連線，server 結束時一併關閉
+static const char *save_dir = NULL;    // client 可以寫入映像檔的目錄（FS_SAVE_DIR），NULL 表示不允許
+static int spare_fd = -1;              // 預留的描述符，描述符用完時釋放它來接受並關閉新連線
+static int listen_paused = 0;          // listen socket 暫時不接收事件（連預留描述符都無法使用時）
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : 4096;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    char *p = realloc(*buf, new_cap);
+    if (!p) {
+        return -1;
+    }
+    *buf = p;
+    *cap = new_cap;
+    return 0;
+}
+
+static void close_connection(int epfd, int listen_fd, Connection *conn) {
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+    if (listen_paused) {
+        // 有描述符空出來了，恢復接受連線
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, listen_fd, &ev) == 0) {
+            listen_paused = 0;
+        }
+    }
+}
+
+static void update_events(int epfd, Connection *conn) {
+    size_t pending = conn->out_len - conn->out_pos;
+    int events = 0;
+    if (pending < MAX_PENDING_OUTPUT) {
+        events |= EPOLLIN;
+    }
+    if (pending > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != conn->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = conn };
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+// 盡量把輸出緩衝區送出，連線出錯回傳 -1
+static int flush_output(Connection *conn) {
+    while (conn->out_pos < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->out_pos += n;
+    }
+    conn->out_pos = conn->out_len = 0;
+    return 0;
+}
+
+static int append_response(Connection *conn, uint32_t seq, int status, const char *body, size_t len) {
+    FsResponseHeader header = { .body_len = (uint32_t)len, .seq = seq, .status = status };
+    if (conn->out_pos > 0 && conn->out_pos == conn->out_len) {
+        conn->out_pos = conn->out_len = 0;
+    }
+    if (reserve(&conn->out, &conn->out_cap, conn->out_len + sizeof(header) + len) == -1) {
+        return -1;
+    }
+    memcpy(conn->out + conn->out_len, &header, sizeof(header));
+    memcpy(conn->out + conn->out_len + sizeof(header), body, len);
+    conn->out_len += sizeof(header) + len;
+    return 0;
+}
+
+// 處理輸入緩衝區中所有完整的請求，回傳 -1 表示協定錯誤，1 表示收到 shutdown
+static int process_requests(FileSystem *fs, Connection *conn) {
+    size_t pos = 0;
+    int result = 0;
+
+    while (conn->out_len - conn->out_pos < MAX_PENDING_OUTPUT &&
+           conn->in_len - pos >= sizeof(FsRequestHeader)) {
+        FsRequestHeader header;
+        memcpy(&header, conn->in + pos, sizeof(header));
+        if (header.body_len > FS_MAX_BODY || header.name_len > header.body_len ||
+            header.name_len >= MAX_PATH) {
+            return -1;
+        }
+        if (conn->in_len - pos < sizeof(header) + header.body_len) {
+            break; // 請求還沒收完整
+        }
+
+        const char *body = conn->in + pos + sizeof(header);
+        char name[MAX_PATH];
+        memcpy(name, body, header.name_len);
+        name[header.name_len] = '\0';
+
+        char *output = NULL;
+        size_t output_len = 0;
+        int status = 0;
+        if (header.op == FS_OP_SHUTDOWN && conn->same_user) {
+            result = 1;
+        } else if (header.op == FS_OP_SHUTDOWN) {
+            static const char denied[] = "Error: Only the user running the server may shut it down.\n";
+            output = strdup(denied);
+            output_len = output ? strlen(output) : 0;
+            status = -1;
+        } else {
+            FILE *out = open_memstream(&output, &output_len);
+            if (!out) {
+                return -1;
+            }
+            FsOp op = {
+                .op = header.op,
+                .name = name,
+                .data = body + header.name_len,
+                .data_len = header.body_len - header.name_len,
+            };
+
+            // 切換成這條連線的目前目錄，目錄已被其他連線刪除或搬走時回到根目錄
+            int dir;
+            if (resolve_path(fs, conn->cwd, &dir) == -1 ||
+                (dir != ROOT_DIR && !file_at(fs, dir)->is_directory)) {
+                dir = ROOT_DIR;
+            }
+            set_cwd(fs, dir);
+            status = execute_client_op(fs, &op, out, save_dir);
+            strcpy(conn->cwd, fs->current_path);
+            fclose(out);
+        }
+
+        int appended = append_response(conn, header.seq, status, output, output_len);
+        free(output);
+        if (appended == -1) {
+            return -1;
+        }
+        pos += sizeof(header) + header.body_len;
+        if (result == 1) {
+            break;
+        }
+    }
+
+    // 把未處理完的資料移到緩衝區開頭
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return result;
+}
+
+// 讀取並處理連線上的資料，回傳 -1 表示連線應關閉，1 表示收到 shutdown
+static int handle_readable(FileSystem *fs, Connection *conn) {
+    if (reserve(&conn->in, &conn->in_cap, conn->in_len + READ_CHUNK) == -1) {
+        return -1;
+    }
+    ssize_t n = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    conn->in_len += n;
+    return process_requests(fs, conn);
+}
+
+static void accept_connections(int epfd, int listen_fd, const char *cwd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EMFILE && errno != ENFILE) {
+                return; // EAGAIN 或其他錯誤，等下一次事件
+            }
+            // 描述符用完：listen socket 是 level-triggered，不把等待中的連線取走的話 epoll 會一直喚醒。
+            // 先釋放預留的描述符接受連線並立刻關閉，讓 client 看到連線被拒
+            if (spare_fd >= 0) {
+                close(spare_fd);
+                fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    close(fd);
+                }
+                spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (fd >= 0) {
+                    continue;
+                }
+            }
+            // 預留描述符也無法使用時，暫停 listen socket 直到有連線關閉
+            struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+            if (epoll_ctl(epfd, EPOLL_CTL_MOD, listen_fd, &ev) == 0) {
+                listen_paused = 1;
+            }
+            return;
+        }
+        Connection *conn = calloc(1, sizeof(Connection));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        conn->same_user = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0 && cred.uid == geteuid();
+        strcpy(conn->cwd, cwd);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = connections;
+        if (connections) {
+            connections->prev = conn;
+        }
+        connections = conn;
+    }
+}
+
+int serve(FileSystem *fs, const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path '%s' is too long.\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        printf("Error: Could not create socket.\n");
+        return -1;
+    }
+    unlink(socket_path);
+    // socket 檔只有自己可以連線
+    mode_t old_mask = umask(077);
+    int bound = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound == -1 || listen(listen_fd, SOMAXCONN) == -1) {
+        printf("Error: Could not listen on '%s'.\n", socket_path);
+        close(listen_fd);
+        return -1;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL }; // ptr 為 NULL 代表 listen socket
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    listen_paused = 0;
+
+    char shell_path[MAX_PATH];
+    strcpy(shell_path, fs->current_path);
+    save_dir = getenv("FS_SAVE_DIR");
+    if (save_dir && save_dir[0] == '\0') {
+        save_dir = NULL;
+    }
+    printf("Serving filesystem on '%s'.\n", socket_path);
+    if (save_dir) {
+        printf("Clients may save images under '%s'.\n", save_dir);
+    }
+    fflush(stdout);
+
+    int running = 1;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            Connection *conn = events[i].data.ptr;
+            if (!conn) {
+                accept_connections(epfd, listen_fd, shell_path);
+                continue;
+            }
+
+            int result = 0;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                result = handle_readable(fs, conn);
+            }
+            if (result != -1) {
+                // 若之前因輸出過多而暫停，送出後再處理緩衝中的請求
+                if (flush_output(conn) == -1) {
+                    result = -1;
+                } else if (result == 0 && conn->in_len > 0) {
+                    result = process_requests(fs, conn);
+                    if (result != -1 && flush_output(conn) == -1) {
+                        result = -1;
+                    }
+                }
+            }
+            if (result == 1) {
+                running = 0;
+            }
+            if (result == -1) {
+                close_connection(epfd, listen_fd, conn);
+            } else {
+                update_events(epfd, conn);
+            }
+        }
+    }
+
+    while (connections) {
+        close_connection(epfd, listen_fd, connections);
+    }
+    close(epfd);
+    close(listen_fd);
+    if (spare_fd >= 0) {
+        close(spare_fd);
+        spare_fd = -1;
+    }
+    unlink(socket_path);
+    int dir;
+    if (resolve_path(fs, shell_path, &dir) == -1) {
+        dir = ROOT_DIR;
+    }
+    set_cwd(fs, dir);
+    printf("Server on '%s' stopped.\n", socket_path);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "filesystem.h"
+
+// 在 socket_path 上以 epoll 事件迴圈提供檔案系統服務，直到收到 FS_OP_SHUTDOWN
+// 每條連線各自保有目前目錄，請求依序處理並可 pipelining
+// socket 檔只有 server 的使用者可以連線，FS_OP_SHUTDOWN 也只接受同一個使用者
+// client 的 save 與 snapshot save 只能以單純的檔名寫到環境變數 FS_SAVE_DIR 指定的目錄，沒有設定時拒絕
+int serve(FileSystem *fs, const char *socket_path);
+
+#endif
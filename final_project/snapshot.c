@@ -0,0 +1,379 @@
+#include "snapshot.h"
+#include "filetable.h"
+#include "trigram.h"
+#include "stats.h"
+#include "image.h"
+
+// 背景儲存需要的資料，在主執行緒準備好後交給儲存執行緒
+typedef struct SaveJob {
+    FileSystem *fs;
+    Snapshot *snap;
+    FileSystem header;        // 寫入映像檔的 FileSystem（快照當時的計數與目前目錄）
+    char *bitmask;            // 快照用到的區塊
+    File **slabs;             // 儲存期間自己持有參考的 slab
+    int slab_count;
+} SaveJob;
+
+// slab 的參考計數不是 atomic，所以由主執行緒在 join 之後放掉
+static void free_job(SaveJob *job) {
+    for (int s = 0; s < job->slab_count; s++) {
+        slab_unref(job->slabs[s]);
+    }
+    free(job->slabs);
+    free(job->bitmask);
+    free(job);
+}
+
+static void finish_save(Snapshot *snap) {
+    pthread_join(snap->saver, NULL);
+    free_job(snap->save_job);
+    snap->save_job = NULL;
+    snap->save_state = SNAPSHOT_IDLE;
+}
+
+static int find_snapshot(FileSystem *fs, const char *name) {
+    for (int i = 0; i < fs->snapshot_count; i++) {
+        if (strcmp(fs->snapshots[i]->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// join 已經結束的背景儲存
+static void reap_saves(FileSystem *fs) {
+    for (int i = 0; i < fs->snapshot_count; i++) {
+        Snapshot *snap = fs->snapshots[i];
+        if (__atomic_load_n(&snap->save_state, __ATOMIC_ACQUIRE) == SNAPSHOT_SAVED) {
+            finish_save(snap);
+        }
+    }
+}
+
+// 新的最新快照世代（沒有快照時為 -1）
+static void update_frozen_generation(FileSystem *fs) {
+    fs->frozen_generation = -1;
+    for (int i = 0; i < fs->snapshot_count; i++) {
+        if (fs->snapshots[i]->generation > fs->frozen_generation) {
+            fs->frozen_generation = fs->snapshots[i]->generation;
+        }
+    }
+}
+
+// 依目前的檔案系統與所有快照重新計算 bitmask 與剩餘區塊數，回收只有被刪除的快照用到的區塊
+static void recompute_block_map(FileSystem *fs) {
+    memset(fs->used_blocks_bitmask, 0, BITMASK_BYTES(fs));
+    mark_table_blocks(fs->file_slabs, fs->file_count, fs->used_blocks_bitmask);
+    for (int i = 0; i < fs->snapshot_count; i++) {
+        Snapshot *snap = fs->snapshots[i];
+        mark_table_blocks(snap->file_slabs, snap->file_count, fs->used_blocks_bitmask);
+    }
+    fs->free_blocks = fs->total_blocks - count_set_blocks(fs, fs->used_blocks_bitmask);
+}
+
+int snapshot_create(FileSystem *fs, const char *name) {
+    reap_saves(fs);
+    if (find_snapshot(fs, name) != -1) {
+        fs_printf("Error: Snapshot '%s' already exists.\n", name);
+        return -1;
+    }
+    if (strlen(name) >= MAX_FILENAME) {
+        fs_printf("Error: Snapshot name too long.\n");
+        return -1;
+    }
+
+    Snapshot **snapshots = realloc(fs->snapshots, (fs->snapshot_count + 1) * sizeof(Snapshot *));
+    if (!snapshots) {
+        fs_printf("Error: Could not allocate memory for snapshot.\n");
+        return -1;
+    }
+    fs->snapshots = snapshots;
+    Snapshot *snap = calloc(1, sizeof(Snapshot));
+    File **slabs = malloc((fs->slab_count > 0 ? fs->slab_count : 1) * sizeof(File *));
+    if (!snap || !slabs) {
+        free(snap);
+        free(slabs);
+        fs_printf("Error: Could not allocate memory for snapshot.\n");
+        return -1;
+    }
+
+    // 只共用 slab，不複製項目；區塊則由世代保護
+    strcpy(snap->name, name);
+    if (fs->slab_count > 0) {
+        memcpy(slabs, fs->file_slabs, fs->slab_count * sizeof(File *));
+    }
+    for (int s = 0; s < fs->slab_count; s++) {
+        slab_ref(slabs[s]);
+    }
+    snap->file_slabs = slabs;
+    snap->slab_count = fs->slab_count;
+    snap->file_count = fs->file_count;
+    snap->live_files = fs->live_files;
+    snap->cwd = fs->cwd;
+    snap->generation = fs->generation;
+    snap->created = time(NULL);
+    fs->snapshots[fs->snapshot_count++] = snap;
+
+    // 之後配置的區塊屬於新的世代，不受這個快照保護
+    fs->frozen_generation = fs->generation++;
+
+    fs_printf("Snapshot '%s' created (%d entries).\n", name, snap->live_files);
+    return 0;
+}
+
+int snapshot_list(FileSystem *fs) {
+    reap_saves(fs);
+    if (fs->snapshot_count == 0) {
+        fs_printf("No snapshots.\n");
+        return 0;
+    }
+    char *bitmask = malloc(BITMASK_BYTES(fs));
+    if (!bitmask) {
+        fs_printf("Error: Not enough memory to list snapshots.\n");
+        return -1;
+    }
+    for (int i = 0; i < fs->snapshot_count; i++) {
+        Snapshot *snap = fs->snapshots[i];
+        memset(bitmask, 0, BITMASK_BYTES(fs));
+        mark_table_blocks(snap->file_slabs, snap->file_count, bitmask);
+
+        char created[32];
+        strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&snap->created));
+        fs_printf("%-20s %s  %d entries  %d blocks", snap->name, created, snap->live_files,
+               count_set_blocks(fs, bitmask));
+        if (__atomic_load_n(&snap->save_state, __ATOMIC_ACQUIRE) == SNAPSHOT_SAVING) {
+            fs_printf("  (saving to '%s')", snap->save_path);
+        } else if (snap->save_path[0]) {
+            fs_printf("  (%s '%s')", snap->save_result == 0 ? "saved to" : "failed to save to", snap->save_path);
+        }
+        fs_printf("\n");
+    }
+    free(bitmask);
+    return 0;
+}
+
+int snapshot_rollback(FileSystem *fs, const char *name) {
+    reap_saves(fs);
+    int i = find_snapshot(fs, name);
+    if (i == -1) {
+        fs_printf("Error: Snapshot '%s' not found.\n", name);
+        return -1;
+    }
+    Snapshot *snap = fs->snapshots[i];
+
+    // 目前的項目表換成快照的 slab，之後的修改一樣會先複製 slab
+    if (file_table_adopt(fs, snap->file_slabs, snap->slab_count, snap->file_count) == -1) {
+        fs_printf("Error: Could not allocate memory for file table.\n");
+        return -1;
+    }
+    set_cwd(fs, snap->cwd);
+    rebuild_extent_refs(fs);
+    recompute_block_map(fs);
+    fs->alloc_hint = 0;
+
+    // trigram 索引只對應目前的檔案系統，依快照的內容重建
+    trigram_index_rebuild(fs);
+
+    fs_printf("Rolled back to snapshot '%s'.\n", name);
+    return 0;
+}
+
+int snapshot_delete(FileSystem *fs, const char *name) {
+    reap_saves(fs);
+    int i = find_snapshot(fs, name);
+    if (i == -1) {
+        fs_printf("Error: Snapshot '%s' not found.\n", name);
+        return -1;
+    }
+    Snapshot *snap = fs->snapshots[i];
+    if (__atomic_load_n(&snap->save_state, __ATOMIC_ACQUIRE) == SNAPSHOT_SAVING) {
+        fs_printf("Error: Snapshot '%s' is being saved.\n", name);
+        return -1;
+    }
+
+    for (int s = 0; s < snap->slab_count; s++) {
+        slab_unref(snap->file_slabs[s]);
+    }
+    free(snap->file_slabs);
+    memmove(&fs->snapshots[i], &fs->snapshots[i + 1], (fs->snapshot_count - i - 1) * sizeof(Snapshot *));
+    fs->snapshot_count--;
+
+    update_frozen_generation(fs);
+    int free_before = fs->free_blocks;
+    recompute_block_map(fs);
+    fs_printf("Snapshot '%s' deleted (%d blocks reclaimed).\n", snap->name, fs->free_blocks - free_before);
+    free(snap);
+    return 0;
+}
+
+// 分區內容的 ImageSource：快照用到的區塊從 storage 讀取，其餘（含分區尾端不足一個區塊的部分）填零
+static int snapshot_source(void *ctx, size_t pos, char *buf, size_t len) {
+    SaveJob *job = ctx;
+    FileSystem *fs = job->fs;
+    size_t partition = (size_t)fs->storage_start_block * BLOCK_SIZE;
+    while (len > 0) {
+        size_t block = pos / BLOCK_SIZE;
+        size_t skip = pos % BLOCK_SIZE;
+        size_t part = BLOCK_SIZE - skip < len ? BLOCK_SIZE - skip : len;
+        if (block < (size_t)fs->total_blocks && (job->bitmask[block / 8] & (1 << (block % 8)))) {
+            if (storage_read(partition + pos, buf, part) == -1) {
+                return -1;
+            }
+        } else {
+            memset(buf, 0, part);
+        }
+        pos += part;
+        buf += part;
+        len -= part;
+    }
+    return 0;
+}
+
+// 儲存執行緒：快照用到的區塊不會再被修改，未用到的區塊寫成零，不需要和主執行緒同步
+static void *save_thread(void *arg) {
+    SaveJob *job = arg;
+    Snapshot *snap = job->snap;
+    FileSystem *fs = job->fs;
+    int result = -1;
+
+    STATS_TIMER(save_start);
+    FILE *file = fopen(snap->save_path, "wb");
+    if (file) {
+        STATS_PHASES_BEGIN(phases);
+        result = write_image_header(file, &job->header);
+        for (int s = 0; s * FILE_SLAB_SIZE < snap->file_count && result == 0; s++) {
+            int count = snap->file_count - s * FILE_SLAB_SIZE;
+            if (count > FILE_SLAB_SIZE) {
+                count = FILE_SLAB_SIZE;
+            }
+            result = write_encrypted(file, job->slabs[s], count * sizeof(File));
+        }
+
+        if (result == 0) {
+            result = image_write_partition(file, fs->partition_size, snapshot_source, job);
+        }
+        if (result == 0) {
+            result = write_encrypted(file, job->bitmask, BITMASK_BYTES(fs));
+        }
+        // 不寫 trigram 索引，載入時會依內容重建
+        if (fclose(file) != 0) {
+            result = -1;
+        }
+        if (result == -1) {
+            remove(snap->save_path); // 不留下不完整的映像檔
+        }
+        STATS_PHASE(STAT_SAVE, save_start);
+        STATS_PHASES_END(phases, STAT_SAVE, STAT_SAVE_INDEX);
+    }
+
+    snap->save_result = result;
+    __atomic_store_n(&snap->save_state, SNAPSHOT_SAVED, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int snapshot_save(FileSystem *fs, const char *name, const char *filename, const char *password) {
+    reap_saves(fs);
+    int i = find_snapshot(fs, name);
+    if (i == -1) {
+        fs_printf("Error: Snapshot '%s' not found.\n", name);
+        return -1;
+    }
+    Snapshot *snap = fs->snapshots[i];
+    if (snap->save_state != SNAPSHOT_IDLE) {
+        fs_printf("Error: Snapshot '%s' is already being saved.\n", name);
+        return -1;
+    }
+    if (strlen(filename) >= sizeof(snap->save_path)) {
+        fs_printf("Error: File name too long.\n");
+        return -1;
+    }
+
+    SaveJob *job = calloc(1, sizeof(SaveJob));
+    if (!job) {
+        fs_printf("Error: Not enough memory to save snapshot '%s'.\n", name);
+        return -1;
+    }
+    job->fs = fs;
+    job->snap = snap;
+    job->bitmask = calloc(BITMASK_BYTES(fs), 1);
+    job->slabs = malloc((snap->slab_count > 0 ? snap->slab_count : 1) * sizeof(File *));
+    if (!job->bitmask || !job->slabs) {
+        free_job(job);
+        fs_printf("Error: Not enough memory to save snapshot '%s'.\n", name);
+        return -1;
+    }
+    // 儲存執行緒讀取的 slab 由工作自己持有參考，失敗或結束時放掉
+    for (int s = 0; s < snap->slab_count; s++) {
+        job->slabs[s] = snap->file_slabs[s];
+        slab_ref(job->slabs[s]);
+    }
+    job->slab_count = snap->slab_count;
+    mark_table_blocks(job->slabs, snap->file_count, job->bitmask);
+
+    // 映像檔的 FileSystem 以快照當時的狀態為準
+    FileSystem *header = &job->header;
+    *header = *fs;
+    header->file_slabs = job->slabs;
+    header->slab_count = snap->slab_count;
+    header->file_count = snap->file_count;
+    header->live_files = snap->live_files;
+    header->free_blocks = fs->total_blocks - count_set_blocks(fs, job->bitmask);
+    header->alloc_hint = 0;
+    set_cwd(header, snap->cwd);
+    strncpy(header->password, password, sizeof(header->password) - 1);
+    header->password[sizeof(header->password) - 1] = '\0';
+
+    strcpy(snap->save_path, filename);
+    snap->save_state = SNAPSHOT_SAVING;
+    snap->save_job = job;
+    if (pthread_create(&snap->saver, NULL, save_thread, job) != 0) {
+        snap->save_state = SNAPSHOT_IDLE;
+        snap->save_path[0] = '\0';
+        snap->save_job = NULL;
+        free_job(job);
+        fs_printf("Error: Could not start saving snapshot '%s'.\n", name);
+        return -1;
+    }
+    fs_printf("Saving snapshot '%s' to '%s' in the background.\n", name, filename);
+    return 0;
+}
+
+void snapshot_wait(FileSystem *fs) {
+    for (int i = 0; i < fs->snapshot_count; i++) {
+        Snapshot *snap = fs->snapshots[i];
+        if (snap->save_state != SNAPSHOT_IDLE) {
+            finish_save(snap);
+        }
+    }
+}
+
+int snapshot_command(FileSystem *fs, const char *args, const char *password) {
+    char action[16] = "", name[MAX_FILENAME] = "", filename[MAX_FILENAME] = "";
+    int count = sscanf(args, "%15s %254s %254s", action, name, filename);
+
+    if (count >= 1 && strcmp(action, "list") == 0) {
+        return snapshot_list(fs);
+    }
+    if (count >= 2 && strcmp(action, "create") == 0) {
+        return snapshot_create(fs, name);
+    }
+    if (count >= 2 && strcmp(action, "rollback") == 0) {
+        return snapshot_rollback(fs, name);
+    }
+    if (count >= 2 && strcmp(action, "delete") == 0) {
+        return snapshot_delete(fs, name);
+    }
+    if (count >= 3 && strcmp(action, "save") == 0) {
+        char entered[256];
+        if (!password) {
+            fs_printf("Enter password to protect this image: ");
+            if (scanf("%255s", entered) != 1) {
+                return -1;
+            }
+            password = entered;
+        }
+        return snapshot_save(fs, name, filename, password);
+    }
+    fs_printf("Usage: snapshot create|rollback|delete <name> | snapshot list | snapshot save <name> <file>\n");
+    return -1;
+}
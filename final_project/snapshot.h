@@ -0,0 +1,53 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include <time.h>
+#include "filesystem.h"
+
+// 具名快照
+// 建立快照只複製 slab 指標並增加參考計數，之後目前的檔案系統修改項目時才複製該 slab（見 file_mut）
+// 區塊以世代判斷：在最新快照之前配置的區塊不會被就地修改或釋放，改寫時一律搬到新的區塊，
+// 被刪除時則保留到快照刪除後重新計算 bitmask 才回收
+// 快照只存在記憶體中，可以在背景執行緒中存成映像檔，同時繼續修改目前的檔案系統
+
+#define SNAPSHOT_IDLE 0
+#define SNAPSHOT_SAVING 1
+#define SNAPSHOT_SAVED 2      // 背景儲存已結束，等待 join
+
+typedef struct Snapshot {
+    char name[MAX_FILENAME];
+    File **file_slabs;        // 與建立當時的檔案系統共用的 slab
+    int slab_count;
+    int file_count;
+    int live_files;
+    int cwd;
+    int generation;           // 建立時的世代，這之前（含）配置的區塊都可能被它引用
+    time_t created;
+    pthread_t saver;
+    int save_state;           // SNAPSHOT_*，背景執行緒結束時設為 SNAPSHOT_SAVED
+    struct SaveJob *save_job; // 背景儲存的工作，join 之後由主執行緒釋放
+    int save_result;          // 最近一次儲存的結果（0 或 -1）
+    char save_path[MAX_FILENAME];
+} Snapshot;
+
+// 以下指令成功回傳 0，失敗回傳 -1（錯誤訊息會直接印出）
+
+int snapshot_create(FileSystem *fs, const char *name);
+int snapshot_list(FileSystem *fs);
+
+// 把目前的檔案系統回復成快照的內容（快照本身保留）
+int snapshot_rollback(FileSystem *fs, const char *name);
+
+int snapshot_delete(FileSystem *fs, const char *name);
+
+// 在背景把快照存成映像檔，格式與 exit 時相同，可以直接載入
+int snapshot_save(FileSystem *fs, const char *name, const char *filename, const char *password);
+
+// 解析「create|list|rollback|delete|save <name> [file]」並執行，password 為 NULL 時互動詢問
+int snapshot_command(FileSystem *fs, const char *args, const char *password);
+
+// 等待所有背景儲存結束
+void snapshot_wait(FileSystem *fs);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+#include "filesystem.h" // fs_printf
+
+FsStats fs_stats;
+__thread StatsPhaseTotals *stats_totals;
+
+static const char *op_names[FS_OP_COUNT] = {
+    [FS_OP_LS] = "ls",         [FS_OP_MKDIR] = "mkdir",   [FS_OP_RMDIR] = "rmdir",
+    [FS_OP_CD] = "cd",         [FS_OP_PUT] = "put",       [FS_OP_GET] = "get",
+    [FS_OP_RM] = "rm",         [FS_OP_CAT] = "cat",       [FS_OP_STATUS] = "status",
+    [FS_OP_CREATE] = "create", [FS_OP_EDIT] = "edit",     [FS_OP_HELP] = "help",
+    [FS_OP_SAVE] = "save",     [FS_OP_SHUTDOWN] = "shutdown", [FS_OP_GREP] = "grep",
+    [FS_OP_CP] = "cp",         [FS_OP_MV] = "mv",         [FS_OP_SNAPSHOT] = "snapshot",
+    [FS_OP_STATS] = "stats",   [FS_OP_BITMAP] = "bitmap",
+};
+
+const char *stats_op_name(int op) {
+    return op > 0 && op < FS_OP_COUNT && op_names[op] ? op_names[op] : "?";
+}
+
+void stats_record(StatsLatency *latency, uint64_t ns) {
+    int bucket = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+    if (bucket >= STATS_BUCKETS) {
+        bucket = STATS_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&latency->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&latency->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&latency->histogram[bucket], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&latency->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&latency->max_ns, &max, ns, 1,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+int stats_op_from_name(const char *name) {
+    for (int op = 1; op < FS_OP_COUNT; op++) {
+        if (op_names[op] && strcmp(op_names[op], name) == 0) {
+            return op;
+        }
+    }
+    return -1;
+}
+
+#ifdef FS_STATS
+
+static const char *phase_names[STAT_PHASE_COUNT] = {
+    [STAT_SAVE] = "save",            [STAT_SAVE_ENCRYPT] = "save_encrypt",
+    [STAT_SAVE_WRITE] = "save_write", [STAT_SAVE_INDEX] = "save_index",
+    [STAT_LOAD] = "load",            [STAT_LOAD_READ] = "load_read",
+    [STAT_LOAD_DECRYPT] = "load_decrypt", [STAT_LOAD_TABLE] = "load_table",
+    [STAT_LOAD_REFS] = "load_refs",  [STAT_LOAD_INDEX] = "load_index",
+};
+
+void stats_phases_end(StatsPhaseTotals *totals, int first, int last) {
+    stats_totals = NULL;
+    for (int phase = first; phase <= last; phase++) {
+        stats_record(&fs_stats.phases[phase], totals->ns[phase]);
+    }
+}
+
+// 由直方圖估計百分位數（微秒），取所在格子的上界，不超過最大值
+static double percentile_us(const StatsLatency *latency, double fraction) {
+    uint64_t target = (uint64_t)(latency->count * fraction);
+    if (target >= latency->count) {
+        target = latency->count - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += latency->histogram[i];
+        if (seen > target) {
+            uint64_t upper = (uint64_t)1 << (i + 1);
+            return (upper < latency->max_ns ? upper : latency->max_ns) / 1e3;
+        }
+    }
+    return latency->max_ns / 1e3;
+}
+
+static void print_latency_table(const char *title, const StatsLatency *latencies, const char **names, int count) {
+    fs_printf("%-14s %10s %12s %10s %10s %10s %12s\n", title, "count", "total ms", "avg us", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < count; i++) {
+        const StatsLatency *l = &latencies[i];
+        if (!names[i] || l->count == 0) {
+            continue;
+        }
+        fs_printf("%-14s %10llu %12.3f %10.2f %10.2f %10.2f %12.2f\n", names[i],
+               (unsigned long long)l->count, l->total_ns / 1e6, l->total_ns / 1e3 / l->count,
+               percentile_us(l, 0.5), percentile_us(l, 0.99), l->max_ns / 1e3);
+    }
+}
+
+static void print_table(void) {
+    print_latency_table("command", fs_stats.ops, op_names, FS_OP_COUNT);
+    fs_printf("\n");
+    print_latency_table("phase", fs_stats.phases, phase_names, STAT_PHASE_COUNT);
+
+    const uint64_t *c = fs_stats.counters;
+    fs_printf("\nallocator: %llu calls, %llu failed, %llu wrapped, %llu blocks scanned (%.1f per call)\n",
+           (unsigned long long)c[STAT_ALLOC_CALLS], (unsigned long long)c[STAT_ALLOC_FAILS],
+           (unsigned long long)c[STAT_ALLOC_WRAPS], (unsigned long long)c[STAT_ALLOC_SCANNED],
+           c[STAT_ALLOC_CALLS] ? (double)c[STAT_ALLOC_SCANNED] / c[STAT_ALLOC_CALLS] : 0.0);
+    fs_printf("storage: %llu bytes in, %llu bytes out\n",
+           (unsigned long long)c[STAT_BYTES_IN], (unsigned long long)c[STAT_BYTES_OUT]);
+}
+
+static void write_latency_json(FILE *out, const char *key, const StatsLatency *latencies, const char **names, int count) {
+    fprintf(out, "  \"%s\": {", key);
+    int first = 1;
+    for (int i = 0; i < count; i++) {
+        const StatsLatency *l = &latencies[i];
+        if (!names[i] || l->count == 0) {
+            continue;
+        }
+        fprintf(out, "%s\n    \"%s\": {\"count\": %llu, \"total_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, \"histogram_log2_ns\": [",
+                first ? "" : ",", names[i], (unsigned long long)l->count, l->total_ns / 1e3,
+                percentile_us(l, 0.5), percentile_us(l, 0.99), l->max_ns / 1e3);
+        // 只輸出到最後一個非零的格子
+        int last = STATS_BUCKETS - 1;
+        while (last > 0 && l->histogram[last] == 0) {
+            last--;
+        }
+        for (int b = 0; b <= last; b++) {
+            fprintf(out, "%s%llu", b ? ", " : "", (unsigned long long)l->histogram[b]);
+        }
+        fprintf(out, "]}");
+        first = 0;
+    }
+    fprintf(out, "%s}", first ? "" : "\n  ");
+}
+
+static void write_json(FILE *out) {
+    const uint64_t *c = fs_stats.counters;
+    fprintf(out, "{\n");
+    write_latency_json(out, "commands", fs_stats.ops, op_names, FS_OP_COUNT);
+    fprintf(out, ",\n");
+    write_latency_json(out, "phases", fs_stats.phases, phase_names, STAT_PHASE_COUNT);
+    fprintf(out, ",\n  \"allocator\": {\"calls\": %llu, \"failed\": %llu, \"wrapped\": %llu, \"blocks_scanned\": %llu},\n",
+            (unsigned long long)c[STAT_ALLOC_CALLS], (unsigned long long)c[STAT_ALLOC_FAILS],
+            (unsigned long long)c[STAT_ALLOC_WRAPS], (unsigned long long)c[STAT_ALLOC_SCANNED]);
+    fprintf(out, "  \"storage\": {\"bytes_in\": %llu, \"bytes_out\": %llu}\n}\n",
+            (unsigned long long)c[STAT_BYTES_IN], (unsigned long long)c[STAT_BYTES_OUT]);
+}
+
+int stats_command(const char *args) {
+    char action[16] = "", filename[256] = "";
+    sscanf(args, "%15s %255s", action, filename);
+
+    if (action[0] == '\0') {
+        print_table();
+    } else if (strcmp(action, "json") == 0) {
+        if (filename[0] == '\0') {
+            write_json(FS_OUT);
+            return 0;
+        }
+        FILE *file = fopen(filename, "w");
+        if (!file) {
+            fs_printf("Error: Could not create file '%s'.\n", filename);
+            return -1;
+        }
+        write_json(file);
+        fclose(file);
+        fs_printf("Statistics written to '%s'.\n", filename);
+    } else if (strcmp(action, "reset") == 0) {
+        memset(&fs_stats, 0, sizeof(fs_stats));
+        fs_printf("Statistics reset.\n");
+    } else {
+        fs_printf("Usage: stats [json [file] | reset]\n");
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+int stats_command(const char *args) {
+    (void)args;
+    fs_printf("Statistics are not compiled in. Rebuild with 'make clean && make STATS=1'.\n");
+    return -1;
+}
+
+#endif
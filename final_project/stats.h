@@ -0,0 +1,119 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include "protocol.h"
+
+// 熱路徑的統計：各指令的次數與延遲直方圖、配置器掃描的區塊數、進出 storage 的位元組、儲存與載入各階段的時間
+// 只有以 -DFS_STATS 編譯時才會記錄（make STATS=1），關閉時下面的巨集都展開成空的，熱路徑上不留任何程式碼
+// 計數一律以 relaxed atomic 累加，背景儲存快照的執行緒也會記錄
+
+#define STATS_BUCKETS 40 // 第 i 格為 [2^i, 2^(i+1)) 奈秒，第 0 格另含 0
+
+enum {
+    STAT_ALLOC_CALLS,   // find_free_blocks 呼叫次數
+    STAT_ALLOC_FAILS,   // 找不到足夠連續區塊的次數
+    STAT_ALLOC_SCANNED, // 掃描過的區塊數（整個位元組跳過時算 8 個）
+    STAT_ALLOC_WRAPS,   // 從 hint 找不到而繞回開頭的次數
+    STAT_BYTES_IN,      // 寫入 storage 的檔案內容位元組
+    STAT_BYTES_OUT,     // 從 storage 讀出給使用者的位元組
+    STAT_COUNTER_COUNT
+};
+
+enum {
+    STAT_SAVE,          // 整個映像檔的儲存（含快照的背景儲存）
+    STAT_SAVE_ENCRYPT,  // 其中加密的時間，各片段加總（多個執行緒加密時可能超過實際經過的時間）
+    STAT_SAVE_WRITE,    // 其中寫檔的時間，各片段加總
+    STAT_SAVE_INDEX,    // 其中寫出 trigram 索引的時間
+    STAT_LOAD,          // 整個映像檔的載入（密碼確認之後）
+    STAT_LOAD_READ,     // 其中讀檔的時間，各區段加總
+    STAT_LOAD_DECRYPT,  // 其中解密的時間，各片段加總（同 STAT_SAVE_ENCRYPT）
+    STAT_LOAD_TABLE,    // 其中重建檔案雜湊表與子目錄串列的時間
+    STAT_LOAD_REFS,     // 其中重建區段共用計數的時間
+    STAT_LOAD_INDEX,    // 其中讀入或重建 trigram 索引的時間
+    STAT_PHASE_COUNT
+};
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t histogram[STATS_BUCKETS];
+} StatsLatency;
+
+typedef struct {
+    StatsLatency ops[FS_OP_COUNT]; // 以 FS_OP_* 為索引，互動模式的指令也對應到同一個代碼
+    StatsLatency phases[STAT_PHASE_COUNT];
+    uint64_t counters[STAT_COUNTER_COUNT];
+} FsStats;
+
+extern FsStats fs_stats;
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline void stats_add(int counter, uint64_t n) {
+    __atomic_fetch_add(&fs_stats.counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void stats_record(StatsLatency *latency, uint64_t ns);
+
+// 一次儲存或載入中各階段的累計時間，結束時每個階段只記錄一筆，所以 phase 表的次數就是儲存或載入的次數
+typedef struct {
+    uint64_t ns[STAT_PHASE_COUNT];
+} StatsPhaseTotals;
+
+// 目前執行緒正在累計的儲存或載入，沒有時為 NULL，STATS_PHASE 直接記錄
+// 映像檔的加解密執行緒會沿用呼叫者的這個指標
+extern __thread StatsPhaseTotals *stats_totals;
+
+static inline void stats_phase(int phase, uint64_t ns) {
+    if (stats_totals) {
+        __atomic_fetch_add(&stats_totals->ns[phase], ns, __ATOMIC_RELAXED);
+    } else {
+        stats_record(&fs_stats.phases[phase], ns);
+    }
+}
+
+// 把 first 到 last 的各階段各記錄一筆，並結束目前執行緒的累計
+void stats_phases_end(StatsPhaseTotals *totals, int first, int last);
+
+// 互動模式的指令名稱對應到 FS_OP_*，沒有對應時回傳 -1
+int stats_op_from_name(const char *name);
+
+// FS_OP_* 的指令名稱，未知的代碼回傳 "?"
+const char *stats_op_name(int op);
+
+#ifdef FS_STATS
+#define STATS_ADD(counter, n) stats_add((counter), (n))
+#define STATS_TIMER(t) uint64_t t = stats_now()
+#define STATS_OP(op, t) stats_record_op((op), stats_now() - (t))
+#define STATS_PHASE(phase, t) stats_phase((phase), stats_now() - (t))
+#define STATS_PHASES_BEGIN(totals) StatsPhaseTotals totals = {{0}}; stats_totals = &totals
+#define STATS_PHASES_END(totals, first, last) stats_phases_end(&totals, (first), (last))
+#define STATS_PHASES_DISCARD() (stats_totals = NULL) // 失敗的儲存或載入不記錄
+#else
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_TIMER(t) ((void)0)
+#define STATS_OP(op, t) ((void)0)
+#define STATS_PHASE(phase, t) ((void)0)
+#define STATS_PHASES_BEGIN(totals) ((void)0)
+#define STATS_PHASES_END(totals, first, last) ((void)0)
+#define STATS_PHASES_DISCARD() ((void)0)
+#endif
+
+static inline void stats_record_op(int op, uint64_t ns) {
+    if (op > 0 && op < FS_OP_COUNT) {
+        stats_record(&fs_stats.ops[op], ns);
+    }
+}
+
+// stats 指令：「stats」印出表格，「stats json [file]」輸出 JSON，「stats reset」歸零
+// 沒有以 FS_STATS 編譯時只印出提示，成功回傳 0，失敗回傳 -1
+int stats_command(const char *args);
+
+#endif
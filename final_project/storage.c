@@ -0,0 +1,905 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "filesystem.h"
+
+#define STORAGE_CHUNK (64 * 1024) // 與主機檔案之間搬資料時每次的大小
+#define RUN_MAX 256               // 一次讀寫備份檔的最大區塊數
+#define READ_STREAMS 8            // 同時追蹤的循序讀取數
+#define READAHEAD_MIN 4           // 預讀視窗的最小與最大區塊數
+#define READAHEAD_MAX RUN_MAX
+#define READAHEAD_QUEUE 16
+#define VICTIM_SCAN 64            // 淘汰時從 LRU 尾端找乾淨區塊的範圍
+#define FLUSH_INTERVAL_MS 200     // 背景執行緒至少這麼久寫回一次 dirty 區塊
+
+char *storage = NULL; // 依分區需要動態擴充，不再有固定的 1000KB 上限
+static size_t storage_capacity = 0;
+
+// 分層儲存：備份檔前面的區塊快取
+typedef struct {
+    size_t block;       // 快取的區塊編號
+    int valid;
+    int dirty;          // 修改過，還沒寫回備份檔
+    int writing;        // 背景執行緒正在寫回，這段期間不能淘汰
+    int prefetched;     // 由預讀載入，還沒被讀過
+    int prev, next;     // LRU 串列，lru_head 為最近使用
+    int hash_next;
+} CacheFrame;
+
+// 一個循序讀取：下一次讀取從 next 開始（或接著讀同一個檔案）就視為循序，預讀到 ahead 為止
+typedef struct {
+    int file;           // 讀取的檔案（項目索引），-1 表示依位置判斷
+    size_t next;
+    size_t ahead;
+    int window;         // 下一次預讀的區塊數，0 表示還沒確定是循序讀取
+    unsigned long used; // 最後使用的時間，找不到時取代最久沒用的
+} ReadStream;
+
+typedef struct {
+    size_t first;
+    int count;
+} ReadaheadRequest;
+
+static int configured = 0;
+static int backing_fd = -1;
+static char backing_path[MAX_PATH + 1];
+static CacheFrame *frames;
+static char *frame_data;          // 第 f 個 frame 的內容在 frame_data + f * BLOCK_SIZE
+static int frame_count;
+static int frames_used;           // 用過的 frame 數，全部用過之後才開始淘汰
+static int *hash_heads;           // 區塊編號 → frame
+static size_t hash_mask;
+static int lru_head = -1, lru_tail = -1;
+static StorageCacheStats cache_stats;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 預讀與 write-behind 由同一個背景執行緒處理
+static pthread_cond_t worker_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writes_done = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t readahead_done = PTHREAD_COND_INITIALIZER;
+static ReadStream streams[READ_STREAMS];
+static unsigned long stream_clock;
+static int readahead_max;         // 依快取大小限制的最大預讀視窗，0 表示不預讀
+static ReadaheadRequest readahead_queue[READAHEAD_QUEUE];
+static int readahead_head, readahead_count;
+static size_t readahead_first, readahead_end; // 背景執行緒正在預讀的範圍
+static int dirty_count;
+static int flush_threshold;       // dirty 區塊達到這個數量時立刻叫醒背景執行緒
+static int writes_in_flight;      // 背景執行緒正在寫回的區塊數
+static size_t *flush_blocks;      // 背景寫回時排序用
+static uint64_t write_epoch;      // 每次寫入備份檔加一，預讀讀到的內容若在這之前就不採用
+static pthread_t worker;
+static int worker_stop;           // storage_shutdown 要求背景執行緒結束
+
+static void *storage_worker(void *arg);
+
+// 關閉備份檔並釋放快取，回到尚未設定的狀態（背景執行緒必須已經結束）
+static void release_cache(void) {
+    if (backing_fd != -1) {
+        close(backing_fd);
+        backing_fd = -1;
+    }
+    free(frames);
+    free(frame_data);
+    free(hash_heads);
+    free(flush_blocks);
+    frames = NULL;
+    frame_data = NULL;
+    hash_heads = NULL;
+    flush_blocks = NULL;
+    frames_used = 0;
+    lru_head = lru_tail = -1;
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    memset(streams, 0, sizeof(streams));
+    readahead_head = readahead_count = 0;
+    dirty_count = 0;
+    writes_in_flight = 0;
+    storage_capacity = 0;
+    configured = 0;
+}
+
+// 第一次使用時依環境變數決定是否使用分層儲存
+static int configure(void) {
+    configured = 1;
+    const char *path = getenv("FS_BACKING_FILE");
+    if (!path || path[0] == '\0') {
+        return 0;
+    }
+    // 備份檔只是這次執行的分區空間，不覆寫已經有內容的檔案
+    backing_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (backing_fd == -1) {
+        fs_printf("Error: Could not open backing file '%s'.\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(backing_fd, &st) == -1 || st.st_size > 0) {
+        fs_printf("Error: Backing file '%s' already exists and is not empty; remove it or choose another file.\n", path);
+        release_cache();
+        return -1;
+    }
+    snprintf(backing_path, sizeof(backing_path), "%s", path);
+
+    const char *blocks = getenv("FS_CACHE_BLOCKS");
+    frame_count = blocks ? atoi(blocks) : 0;
+    if (frame_count <= 0) {
+        frame_count = STORAGE_CACHE_BLOCKS;
+    }
+    size_t hash_size = 1;
+    while (hash_size < (size_t)frame_count * 2) {
+        hash_size <<= 1;
+    }
+    hash_mask = hash_size - 1;
+    frames = calloc(frame_count, sizeof(CacheFrame));
+    frame_data = malloc((size_t)frame_count * BLOCK_SIZE);
+    hash_heads = malloc(hash_size * sizeof(int));
+    flush_blocks = malloc(frame_count * sizeof(size_t));
+    if (!frames || !frame_data || !hash_heads || !flush_blocks) {
+        fs_printf("Error: Not enough memory for %d cached blocks.\n", frame_count);
+        release_cache();
+        return -1;
+    }
+    memset(hash_heads, -1, hash_size * sizeof(int));
+
+    // 預讀最多佔快取的四分之一，太小的快取不預讀
+    readahead_max = frame_count / 4 < READAHEAD_MAX ? frame_count / 4 : READAHEAD_MAX;
+    if (readahead_max < READAHEAD_MIN) {
+        readahead_max = 0;
+    }
+    flush_threshold = frame_count / 8 > 0 ? frame_count / 8 : 1;
+
+    worker_stop = 0;
+    if (pthread_create(&worker, NULL, storage_worker, NULL) != 0) {
+        fs_printf("Error: Could not start the storage writer thread.\n");
+        release_cache();
+        return -1;
+    }
+    return 0;
+}
+
+int storage_tiered(void) {
+    return backing_fd != -1;
+}
+
+int storage_reserve(size_t size) {
+    if (!configured && configure() == -1) {
+        return -1;
+    }
+    if (size <= storage_capacity) {
+        return 0;
+    }
+    if (storage_tiered()) {
+        // 備份檔是稀疏檔，沒寫過的區塊不佔空間
+        if (ftruncate(backing_fd, size) == -1) {
+            return -1;
+        }
+    } else {
+        char *p = realloc(storage, size);
+        if (!p) {
+            return -1;
+        }
+        storage = p;
+    }
+    storage_capacity = size;
+    return 0;
+}
+
+static size_t hash_block(size_t block) {
+    return (block * 0x9E3779B97F4A7C15ull >> 17) & hash_mask;
+}
+
+static char *frame_at(int f) {
+    return frame_data + (size_t)f * BLOCK_SIZE;
+}
+
+static int lookup(size_t block) {
+    for (int f = hash_heads[hash_block(block)]; f != -1; f = frames[f].hash_next) {
+        if (frames[f].block == block) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+static void lru_unlink(int f) {
+    CacheFrame *frame = &frames[f];
+    if (frame->prev != -1) {
+        frames[frame->prev].next = frame->next;
+    } else {
+        lru_head = frame->next;
+    }
+    if (frame->next != -1) {
+        frames[frame->next].prev = frame->prev;
+    } else {
+        lru_tail = frame->prev;
+    }
+}
+
+static void lru_push_front(int f) {
+    frames[f].prev = -1;
+    frames[f].next = lru_head;
+    if (lru_head != -1) {
+        frames[lru_head].prev = f;
+    } else {
+        lru_tail = f;
+    }
+    lru_head = f;
+}
+
+static void lru_push_back(int f) {
+    frames[f].next = -1;
+    frames[f].prev = lru_tail;
+    if (lru_tail != -1) {
+        frames[lru_tail].next = f;
+    } else {
+        lru_head = f;
+    }
+    lru_tail = f;
+}
+
+static void hash_remove(int f) {
+    int *link = &hash_heads[hash_block(frames[f].block)];
+    while (*link != f) {
+        link = &frames[*link].hash_next;
+    }
+    *link = frames[f].hash_next;
+}
+
+static void mark_dirty(int f) {
+    if (!frames[f].dirty) {
+        frames[f].dirty = 1;
+        if (++dirty_count == flush_threshold) {
+            pthread_cond_signal(&worker_wake);
+        }
+    }
+}
+
+static void mark_clean(int f) {
+    if (frames[f].dirty) {
+        frames[f].dirty = 0;
+        dirty_count--;
+    }
+}
+
+// 命中快取的區塊移到 LRU 前端
+static void touch(int f, int counted) {
+    if (counted) {
+        cache_stats.hits++;
+        if (frames[f].prefetched) {
+            cache_stats.readahead_hits++;
+        }
+    }
+    frames[f].prefetched = 0;
+    if (f != lru_head) {
+        lru_unlink(f);
+        lru_push_front(f);
+    }
+}
+
+// 從備份檔讀 count 個區塊，超過檔案結尾的部分視為零（不印訊息，背景執行緒也會使用）
+static int read_blocks(size_t first, size_t count, char *buf) {
+    size_t len = count * BLOCK_SIZE, done = 0;
+    while (done < len) {
+        ssize_t n = pread(backing_fd, buf + done, len - done, (off_t)(first * BLOCK_SIZE + done));
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            memset(buf + done, 0, len - done);
+            break;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static int write_blocks(size_t first, size_t count, const char *buf) {
+    size_t len = count * BLOCK_SIZE, done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(backing_fd, buf + done, len - done, (off_t)(first * BLOCK_SIZE + done));
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    write_epoch++;
+    return 0;
+}
+
+static int can_write_back(int f) {
+    return f != -1 && frames[f].dirty && !frames[f].writing;
+}
+
+// 淘汰 dirty 區塊時連同前後相鄰的 dirty 區塊一起寫回（呼叫者持有 cache_lock）
+static int write_run(int f) {
+    static char run[RUN_MAX * BLOCK_SIZE];
+    size_t first = frames[f].block, end = first + 1;
+    while (first > 0 && end - first < RUN_MAX && can_write_back(lookup(first - 1))) {
+        first--;
+    }
+    while (end - first < RUN_MAX && can_write_back(lookup(end))) {
+        end++;
+    }
+    for (size_t b = first; b < end; b++) {
+        memcpy(run + (b - first) * BLOCK_SIZE, frame_at(lookup(b)), BLOCK_SIZE);
+    }
+    if (write_blocks(first, end - first, run) == -1) {
+        fs_printf("Error: Could not write blocks %zu-%zu to backing file.\n", first, end - 1);
+        return -1;
+    }
+    for (size_t b = first; b < end; b++) {
+        mark_clean(lookup(b));
+    }
+    cache_stats.writebacks += end - first;
+    return 0;
+}
+
+#define FRAME_BUSY -1    // LRU 尾端的區塊都在背景寫回中，寫回完成後再試
+#define FRAME_FAILED -2  // 同步寫回失敗，再等也不會有可用的 frame
+
+// 取得一個可用的 frame：優先淘汰 LRU 尾端乾淨的區塊，附近都是 dirty 時才同步寫回
+// 回傳的 frame 不在雜湊表與 LRU 串列中，沒有可用的 frame 時回傳 FRAME_BUSY 或 FRAME_FAILED
+static int take_frame(void) {
+    if (frames_used < frame_count) {
+        return frames_used++;
+    }
+    int victim = -1, dirty_victim = -1, scanned = 0;
+    for (int f = lru_tail; f != -1 && scanned < VICTIM_SCAN; f = frames[f].prev, scanned++) {
+        if (frames[f].writing) {
+            continue;
+        }
+        if (!frames[f].valid || !frames[f].dirty) {
+            victim = f;
+            break;
+        }
+        if (dirty_victim == -1) {
+            dirty_victim = f;
+        }
+    }
+    if (victim == -1) {
+        if (dirty_victim == -1) {
+            return FRAME_BUSY;
+        }
+        if (write_run(dirty_victim) == -1) {
+            return FRAME_FAILED;
+        }
+        victim = dirty_victim;
+        pthread_cond_signal(&worker_wake);
+    }
+    lru_unlink(victim);
+    if (frames[victim].valid) {
+        hash_remove(victim);
+        frames[victim].valid = 0;
+        cache_stats.evictions++;
+    }
+    return victim;
+}
+
+static void install(int f, size_t block, int prefetched) {
+    frames[f].block = block;
+    frames[f].valid = 1;
+    frames[f].dirty = 0;
+    frames[f].writing = 0;
+    frames[f].prefetched = prefetched;
+    frames[f].hash_next = hash_heads[hash_block(block)];
+    hash_heads[hash_block(block)] = f;
+    lru_push_front(f);
+}
+
+// 取得區塊在快取中的內容（呼叫者持有 cache_lock），不在快取時淘汰最久沒用的區塊，
+// load 為 0 表示呼叫者會覆寫整個區塊，不必從備份檔讀入
+static char *cache_block(size_t block, int load, int counted) {
+    for (;;) {
+        int f = lookup(block);
+        if (f != -1) {
+            touch(f, counted);
+            return frame_at(f);
+        }
+        f = take_frame();
+        if (f == FRAME_FAILED) {
+            return NULL; // write_run 已印出錯誤
+        }
+        if (f == FRAME_BUSY) {
+            if (writes_in_flight == 0) {
+                fs_printf("Error: No cache block available for block %zu.\n", block);
+                return NULL;
+            }
+            pthread_cond_wait(&writes_done, &cache_lock); // 等背景寫回完成再找一次
+            continue;
+        }
+        if (counted) {
+            cache_stats.misses++;
+        }
+        if (load && read_blocks(block, 1, frame_at(f)) == -1) {
+            fs_printf("Error: Could not read block %zu from backing file.\n", block);
+            lru_push_back(f);
+            return NULL;
+        }
+        install(f, block, 0);
+        return frame_at(f);
+    }
+}
+
+// 把 [first, end) 中不在快取的區塊以連續的大塊讀入，並計算命中率
+// 回傳已計算到的區塊，之後的區塊由呼叫者逐塊處理
+static size_t fill_range(size_t first, size_t end) {
+    static char fill[RUN_MAX * BLOCK_SIZE];
+    if (end - first > (size_t)frame_count / 2) {
+        end = first + frame_count / 2; // 不讓一次讀取把自己剛讀入的區塊擠掉
+    }
+    size_t b = first;
+    while (b < end) {
+        int f = lookup(b);
+        if (f != -1) {
+            touch(f, 1);
+            b++;
+            continue;
+        }
+        size_t run_end = b + 1;
+        while (run_end < end && run_end - b < RUN_MAX && lookup(run_end) == -1) {
+            run_end++;
+        }
+        if (read_blocks(b, run_end - b, fill) == -1) {
+            return b;
+        }
+        for (size_t k = b; k < run_end; k++) {
+            int g = take_frame();
+            if (g < 0) {
+                return k; // 剩下的區塊由 cache_block 處理，寫回失敗時由它回報
+            }
+            memcpy(frame_at(g), fill + (k - b) * BLOCK_SIZE, BLOCK_SIZE);
+            install(g, k, 0);
+            cache_stats.misses++;
+        }
+        b = run_end;
+    }
+    return b;
+}
+
+// 判斷是否為循序讀取，讀到預讀範圍的後半時請背景執行緒預讀下一個視窗
+// file 不是 -1 時依檔案找出它的讀取，continues 表示這次讀取接著檔案上一段內容（換到下一段 extent）
+// 預讀不超過 limit 個區塊，也就是這段範圍的結尾
+static void readahead_check(int file, int continues, size_t first, size_t end, size_t limit) {
+    if (readahead_max == 0) {
+        return;
+    }
+    ReadStream *s = NULL, *oldest = &streams[0];
+    for (int i = 0; i < READ_STREAMS; i++) {
+        ReadStream *t = &streams[i];
+        // 從上次結束的區塊（可能只讀了一部分）或下一個區塊開始都算循序
+        int follows = first == t->next || first + 1 == t->next;
+        if (t->used && t->file == file && (file != -1 || follows)) {
+            s = t;
+            break;
+        }
+        if (t->used < oldest->used) {
+            oldest = t;
+        }
+    }
+    if (!s || !(continues || first == s->next || first + 1 == s->next)) {
+        // 新的讀取（或同一個檔案跳到別的位置），第二次循序讀取才開始預讀
+        if (!s) {
+            s = oldest;
+            s->file = file;
+        }
+        s->window = 0;
+        s->ahead = end;
+    } else if (s->window == 0) {
+        // 初始視窗依讀取的大小決定，之後每次加倍
+        size_t request = end - first;
+        s->window = request * 2 < (size_t)READAHEAD_MIN ? READAHEAD_MIN : (int)(request * 2);
+    }
+    s->next = end;
+    s->used = ++stream_clock;
+    if (s->window == 0) {
+        return;
+    }
+    if (s->window > readahead_max) {
+        s->window = readahead_max;
+    }
+    if (continues || s->ahead < end || s->ahead > limit) {
+        s->ahead = end; // 換到另一段範圍時從這次讀取的結尾開始預讀
+    }
+    if (limit > storage_capacity / BLOCK_SIZE) {
+        limit = storage_capacity / BLOCK_SIZE;
+    }
+    if (end + s->window / 2 < s->ahead || s->ahead >= limit || readahead_count == READAHEAD_QUEUE) {
+        return;
+    }
+    int count = s->ahead + s->window <= limit ? s->window : (int)(limit - s->ahead);
+    ReadaheadRequest *r = &readahead_queue[(readahead_head + readahead_count++) % READAHEAD_QUEUE];
+    r->first = s->ahead;
+    r->count = count;
+    s->ahead += count;
+    s->window = s->window * 2 < readahead_max ? s->window * 2 : readahead_max;
+    pthread_cond_signal(&worker_wake);
+}
+
+// 背景執行緒：處理一個預讀請求，讀備份檔時不持有 cache_lock
+static void run_readahead(void) {
+    static char buffer[READAHEAD_MAX * BLOCK_SIZE];
+    ReadaheadRequest r = readahead_queue[readahead_head];
+    readahead_head = (readahead_head + 1) % READAHEAD_QUEUE;
+    readahead_count--;
+    while (r.count > 0 && lookup(r.first) != -1) {
+        r.first++;
+        r.count--;
+    }
+    while (r.count > 0 && lookup(r.first + r.count - 1) != -1) {
+        r.count--;
+    }
+    if (r.count == 0) {
+        return;
+    }
+
+    uint64_t epoch = write_epoch;
+    readahead_first = r.first;
+    readahead_end = r.first + r.count;
+    pthread_mutex_unlock(&cache_lock);
+    int result = read_blocks(r.first, r.count, buffer);
+    pthread_mutex_lock(&cache_lock);
+    readahead_first = readahead_end = 0;
+    pthread_cond_broadcast(&readahead_done);
+    if (result == -1 || epoch != write_epoch) {
+        return; // 讀取期間備份檔被寫過，讀到的內容可能已經過時
+    }
+    for (int k = 0; k < r.count; k++) {
+        if (lookup(r.first + k) != -1) {
+            continue; // 已經被讀入或寫入，快取中的較新
+        }
+        int f = take_frame();
+        if (f < 0) {
+            break;
+        }
+        memcpy(frame_at(f), buffer + (size_t)k * BLOCK_SIZE, BLOCK_SIZE);
+        install(f, r.first + k, 1);
+        cache_stats.readahead++;
+    }
+}
+
+static int compare_blocks(const void *a, const void *b) {
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 背景執行緒：依區塊編號排序所有 dirty 區塊，把相鄰的合併成一次寫入
+// 寫入期間不持有 cache_lock，區塊標記為 writing，不會被淘汰；寫入期間又被修改的區塊會再次變成 dirty
+static int flush_dirty(void) {
+    static char run[RUN_MAX * BLOCK_SIZE];
+    int count = 0;
+    for (int f = 0; f < frames_used; f++) {
+        if (frames[f].valid && can_write_back(f)) {
+            flush_blocks[count++] = frames[f].block;
+        }
+    }
+    qsort(flush_blocks, count, sizeof(size_t), compare_blocks);
+
+    for (int i = 0; i < count;) {
+        // 上一輪寫入期間沒有持有鎖，區塊可能已被淘汰或寫回，重新確認
+        if (!can_write_back(lookup(flush_blocks[i]))) {
+            i++;
+            continue;
+        }
+        size_t first = flush_blocks[i];
+        int n = 0;
+        while (i + n < count && n < RUN_MAX && flush_blocks[i + n] == first + n &&
+               can_write_back(lookup(first + n))) {
+            int f = lookup(first + n);
+            memcpy(run + (size_t)n * BLOCK_SIZE, frame_at(f), BLOCK_SIZE);
+            mark_clean(f);
+            frames[f].writing = 1;
+            n++;
+        }
+        i += n;
+        writes_in_flight += n;
+
+        pthread_mutex_unlock(&cache_lock);
+        int result = write_blocks(first, n, run);
+        pthread_mutex_lock(&cache_lock);
+
+        for (int k = 0; k < n; k++) {
+            int f = lookup(first + k);
+            frames[f].writing = 0;
+            if (result == -1) {
+                mark_dirty(f); // 之後淘汰時再試一次
+            }
+        }
+        writes_in_flight -= n;
+        if (result == 0) {
+            cache_stats.flushes++;
+            cache_stats.flushed += n;
+        }
+        pthread_cond_broadcast(&writes_done);
+        if (result == -1) {
+            return -1;
+        }
+        if (readahead_count > 0) {
+            break; // 預讀比較急，剩下的下一輪再寫
+        }
+    }
+    return 0;
+}
+
+static void *storage_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&cache_lock);
+    int failed = 0;
+    while (!worker_stop) {
+        if (failed || (readahead_count == 0 && dirty_count < flush_threshold)) {
+            failed = 0; // 寫入失敗時等一段時間再試
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            if (pthread_cond_timedwait(&worker_wake, &cache_lock, &deadline) != ETIMEDOUT) {
+                continue;
+            }
+        }
+        if (readahead_count > 0) {
+            run_readahead();
+        } else if (dirty_count > 0) {
+            failed = flush_dirty() == -1;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return NULL;
+}
+
+int storage_shutdown(void) {
+    if (!storage_tiered()) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache_lock);
+    worker_stop = 1;
+    pthread_cond_signal(&worker_wake);
+    pthread_mutex_unlock(&cache_lock);
+    pthread_join(worker, NULL);
+
+    // 背景執行緒已經結束，剩下的 dirty 區塊在這裡寫回
+    pthread_mutex_lock(&cache_lock);
+    readahead_count = 0;
+    int result = 0;
+    while (dirty_count > 0 && result == 0) {
+        result = flush_dirty();
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (result == -1) {
+        fs_printf("Error: Could not write %d cached blocks to backing file '%s'.\n", dirty_count, backing_path);
+    }
+    release_cache();
+    return result;
+}
+
+// 分層儲存時讀取 [offset, offset + len)，file、continues 與 limit（位元組）的意義同 readahead_check
+static int cache_read(int file, int continues, size_t limit, size_t offset, void *buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    char *out = buf;
+    pthread_mutex_lock(&cache_lock);
+    size_t first = offset / BLOCK_SIZE, end = (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    readahead_check(file, continues, first, end, (limit + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    while (first < readahead_end && end > readahead_first) {
+        pthread_cond_wait(&readahead_done, &cache_lock); // 要讀的區塊正在預讀，等它完成比再讀一次快
+    }
+    size_t counted = fill_range(first, end);
+    while (len > 0) {
+        size_t within = offset % BLOCK_SIZE;
+        size_t n = BLOCK_SIZE - within < len ? BLOCK_SIZE - within : len;
+        char *data = cache_block(offset / BLOCK_SIZE, 1, offset / BLOCK_SIZE >= counted);
+        if (!data) {
+            pthread_mutex_unlock(&cache_lock);
+            return -1;
+        }
+        memcpy(out, data + within, n);
+        out += n;
+        offset += n;
+        len -= n;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+}
+
+int storage_read(size_t offset, void *buf, size_t len) {
+    if (!storage_tiered()) {
+        memcpy(buf, storage + offset, len);
+        return 0;
+    }
+    return cache_read(-1, 0, storage_capacity, offset, buf, len);
+}
+
+int storage_write(size_t offset, const void *buf, size_t len) {
+    if (!storage_tiered()) {
+        memcpy(storage + offset, buf, len);
+        return 0;
+    }
+    const char *in = buf;
+    pthread_mutex_lock(&cache_lock);
+    while (len > 0) {
+        size_t within = offset % BLOCK_SIZE;
+        size_t n = BLOCK_SIZE - within < len ? BLOCK_SIZE - within : len;
+        char *data = cache_block(offset / BLOCK_SIZE, n < BLOCK_SIZE, 1);
+        if (!data) {
+            pthread_mutex_unlock(&cache_lock);
+            return -1;
+        }
+        memcpy(data + within, in, n);
+        mark_dirty((data - frame_data) / BLOCK_SIZE);
+        in += n;
+        offset += n;
+        len -= n;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+}
+
+int storage_zero(size_t offset, size_t len) {
+    if (!storage_tiered()) {
+        memset(storage + offset, 0, len);
+        return 0;
+    }
+    pthread_mutex_lock(&cache_lock);
+    while (writes_in_flight > 0) {
+        pthread_cond_wait(&writes_done, &cache_lock); // 背景寫回完成後才能清除
+    }
+    // 整塊落在範圍內的區塊直接丟掉，頭尾不完整的區塊在快取中清零
+    size_t first = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE, end = (offset + len) / BLOCK_SIZE;
+    for (int f = 0; f < frames_used; f++) {
+        CacheFrame *frame = &frames[f];
+        if (!frame->valid) {
+            continue;
+        }
+        if (frame->block >= first && frame->block < end) {
+            mark_clean(f);
+            hash_remove(f);
+            frame->valid = 0;
+            lru_unlink(f);
+            lru_push_back(f);
+        }
+    }
+    int result = 0;
+    if (offset + len >= storage_capacity) {
+        // 到檔案結尾：截斷再延長，成為稀疏的零
+        if (ftruncate(backing_fd, offset) == -1 || ftruncate(backing_fd, storage_capacity) == -1) {
+            result = -1;
+        }
+    } else {
+        static const char zeros[STORAGE_CHUNK];
+        for (size_t done = 0; done < len && result == 0;) {
+            size_t n = len - done < sizeof(zeros) ? len - done : sizeof(zeros);
+            if (pwrite(backing_fd, zeros, n, (off_t)(offset + done)) != (ssize_t)n) {
+                result = -1;
+            }
+            done += n;
+        }
+    }
+    write_epoch++;
+    pthread_mutex_unlock(&cache_lock);
+    if (result == -1) {
+        fs_printf("Error: Could not clear backing file '%s'.\n", backing_path);
+        return -1;
+    }
+    // 頭尾不完整的區塊可能還在快取中
+    if (offset % BLOCK_SIZE != 0 || (offset + len) % BLOCK_SIZE != 0) {
+        char zeros[BLOCK_SIZE] = {0};
+        size_t head = offset % BLOCK_SIZE ? BLOCK_SIZE - offset % BLOCK_SIZE : 0;
+        if (head > len) {
+            head = len;
+        }
+        size_t tail = (offset + len) % BLOCK_SIZE;
+        if (head > 0) {
+            storage_write(offset, zeros, head);
+        }
+        if (tail > 0 && offset + len - tail >= offset + head) {
+            storage_write(offset + len - tail, zeros, tail);
+        }
+    }
+    return 0;
+}
+
+const char *storage_pin(size_t offset, size_t len) {
+    if (!storage_tiered()) {
+        return storage + offset;
+    }
+    char *copy = malloc(len > 0 ? len : 1);
+    if (copy && storage_read(offset, copy, len) == -1) {
+        free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+void storage_unpin(const char *data) {
+    if (storage_tiered()) {
+        free((char *)data);
+    }
+}
+
+int storage_scan_ranges(int file, const StorageRange *ranges, int count, size_t overlap,
+                        void (*visit)(void *ctx, const char *data, size_t len), void *ctx) {
+    if (!storage_tiered() && (count == 1 || overlap == 0)) {
+        for (int r = 0; r < count; r++) {
+            if (ranges[r].len > 0) {
+                visit(ctx, storage + ranges[r].offset, ranges[r].len);
+            }
+        }
+        return 0;
+    }
+    char *buffer = malloc(overlap + STORAGE_CHUNK);
+    if (!buffer) {
+        fs_printf("Error: Not enough memory to read the partition.\n");
+        return -1;
+    }
+    size_t kept = 0;
+    for (int r = 0; r < count; r++) {
+        size_t offset = ranges[r].offset, len = ranges[r].len, limit = offset + len;
+        while (len > 0) {
+            size_t n = len < STORAGE_CHUNK ? len : STORAGE_CHUNK;
+            int continues = r > 0 && offset == ranges[r].offset;
+            int result = storage_tiered() ? cache_read(file, continues, limit, offset, buffer + kept, n)
+                                          : storage_read(offset, buffer + kept, n);
+            if (result == -1) {
+                free(buffer);
+                return -1;
+            }
+            offset += n;
+            len -= n;
+            visit(ctx, buffer, kept + n);
+            // 保留這一段最後 overlap 個位元組接在下一段前面
+            size_t total = kept + n;
+            kept = total < overlap ? total : overlap;
+            memmove(buffer, buffer + total - kept, kept);
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+int storage_read_from(FILE *in, size_t offset, size_t len) {
+    if (!storage_tiered()) {
+        return fread(storage + offset, 1, len, in) == len ? 0 : -1;
+    }
+    char buffer[STORAGE_CHUNK];
+    while (len > 0) {
+        size_t n = len < sizeof(buffer) ? len : sizeof(buffer);
+        size_t got = fread(buffer, 1, n, in);
+        memset(buffer + got, 0, n - got); // 與整個分區在記憶體時相同，讀不到的部分維持為零
+        if (storage_write(offset, buffer, n) == -1 || got != n) {
+            return -1;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+StorageCacheStats storage_cache_stats(void) {
+    pthread_mutex_lock(&cache_lock);
+    StorageCacheStats stats = cache_stats;
+    pthread_mutex_unlock(&cache_lock);
+    return stats;
+}
+
+void storage_print_status(void) {
+    if (!storage_tiered()) {
+        return;
+    }
+    pthread_mutex_lock(&cache_lock);
+    StorageCacheStats stats = cache_stats;
+    int used = frames_used, dirty = dirty_count;
+    pthread_mutex_unlock(&cache_lock);
+    uint64_t lookups = stats.hits + stats.misses;
+    fs_printf("Cache: %d of %d blocks in use (%.1f MB, %d dirty) in front of '%s'\n",
+           used, frame_count, (double)frame_count * BLOCK_SIZE / (1024 * 1024), dirty, backing_path);
+    fs_printf("Cache hits: %llu, misses: %llu (hit rate %.1f%%), evictions: %llu, written back on eviction: %llu\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           lookups ? 100.0 * stats.hits / lookups : 0.0,
+           (unsigned long long)stats.evictions, (unsigned long long)stats.writebacks);
+    fs_printf("Readahead: %llu blocks prefetched, %llu used; write-behind: %llu blocks in %llu writes (%.1f per write)\n",
+           (unsigned long long)stats.readahead, (unsigned long long)stats.readahead_hits,
+           (unsigned long long)stats.flushed, (unsigned long long)stats.flushes,
+           stats.flushes ? (double)stats.flushed / stats.flushes : 0.0);
+}
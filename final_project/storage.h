@@ -0,0 +1,80 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// 區塊層：所有分區內容的讀寫都經過這裡，位移以位元組計算（區塊 b 從 b * BLOCK_SIZE 開始）
+// 預設整個分區放在記憶體中的 storage 陣列
+// 設定環境變數 FS_BACKING_FILE 時改成分層儲存：分區放在這個檔案中（必須不存在或是空的），記憶體只保留 FS_CACHE_BLOCKS 個
+// 最近使用的區塊（LRU），存取時載入，被淘汰時才把修改過的區塊寫回檔案，分區大小因此不受記憶體限制
+// 快取以一個 mutex 保護，背景儲存快照的執行緒也可以同時讀取
+// 分層儲存時另有一個背景執行緒：
+//   預讀      每個檔案各自追蹤循序讀取（依項目索引），依序讀過檔案的內容時即使跨到另一段 extent 也視為循序，
+//             不屬於檔案的讀取則依位置判斷，接續上次結束處的讀取視為循序；預先以大塊讀入同一段範圍後面的區塊，
+//             視窗從讀取大小的兩倍開始，每次加倍，最多 256 個區塊或快取的四分之一
+//   write-behind  修改過的區塊先留在快取中，dirty 區塊達到快取的八分之一或每隔一段時間，
+//             依區塊編號排序，把相鄰的區塊合併成一次寫入；淘汰 dirty 區塊時也連同相鄰的一起寫回
+
+#define STORAGE_CACHE_BLOCKS 16384 // 沒有設定 FS_CACHE_BLOCKS 時的快取區塊數
+
+// 整個分區都在記憶體中時指向它，分層儲存時為 NULL
+extern char *storage;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;      // 淘汰時寫回檔案的區塊數
+    uint64_t readahead;       // 預讀載入的區塊數
+    uint64_t readahead_hits;  // 其中之後被讀到的區塊數
+    uint64_t flushes;         // 背景寫回的次數
+    uint64_t flushed;         // 背景寫回的區塊數
+} StorageCacheStats;
+
+// 確保 storage 至少有 size 位元組，第一次呼叫時依環境變數決定是否使用分層儲存
+int storage_reserve(size_t size);
+
+// 是否使用分層儲存
+int storage_tiered(void);
+
+// 讀寫 [offset, offset + len)，備份檔讀寫失敗時印出錯誤並回傳 -1
+int storage_read(size_t offset, void *buf, size_t len);
+int storage_write(size_t offset, const void *buf, size_t len);
+
+// 把一段範圍清成零
+int storage_zero(size_t offset, size_t len);
+
+// 取得一段範圍的連續唯讀內容，用完要呼叫 storage_unpin
+// 整個分區在記憶體中時直接回傳 storage 中的位址，分層儲存時複製一份
+const char *storage_pin(size_t offset, size_t len);
+void storage_unpin(const char *data);
+
+typedef struct {
+    size_t offset, len;
+} StorageRange;
+
+// 依序把 count 段範圍的內容交給 visit，就像它們接在一起一樣，分層儲存時每次讀入一段，不會一次配置整個範圍
+// 除了第一段，每段前面都帶著上一段最後 overlap 個位元組（例如 trigram 用 2，跨段的 trigram 不會漏掉）
+// file 為這些範圍所屬的檔案（項目索引），用來追蹤這個檔案的循序讀取，-1 表示依位置判斷
+// 整個分區在記憶體中時直接交出各段範圍（overlap 為 0 或只有一段時），讀取失敗回傳 -1
+int storage_scan_ranges(int file, const StorageRange *ranges, int count, size_t overlap,
+                        void (*visit)(void *ctx, const char *data, size_t len), void *ctx);
+
+// 從主機檔案讀入 [offset, offset + len)，分段進行，不需要一次載入整個範圍
+int storage_read_from(FILE *in, size_t offset, size_t len);
+
+// 快取的命中統計（只有分層儲存時有意義）
+StorageCacheStats storage_cache_stats(void);
+
+// 印出分層儲存的設定與快取命中率，沒有使用分層儲存時不印
+void storage_print_status(void);
+
+// 結束分層儲存：停止並等待背景執行緒，把 dirty 區塊寫回備份檔後關閉並釋放快取
+// 呼叫時不能有其他執行緒在使用 storage，之後要再使用需重新 storage_reserve
+// （備份檔保留分區的內容，已有內容的備份檔不會被重新使用）
+// 沒有使用分層儲存時不做任何事，寫回失敗回傳 -1
+int storage_shutdown(void);
+
+#endif
@@ -0,0 +1,24 @@
+#!/bin/sh
+# piece table 的編輯：經由 FS_OP_EDIT 隨機編輯並比對內容，分別在整個分區在記憶體中與分層儲存（FS_BACKING_FILE）下執行
+set -e
+. "$(dirname "$0")/lib.sh"
+
+run() {
+    rm -f "$WORK/fs.sock"
+    printf '2\n4194304\nserve %s\nexit\n%s\npw\n' "$WORK/fs.sock" "$WORK/exit.img" | ./filesystem > "$WORK/server.log" 2>&1 &
+    SERVER=$!
+    wait_for "$WORK/fs.sock"
+    ./tests/wire_check "$WORK/fs.sock" edit || { cat "$WORK/server.log"; fail "$1"; }
+    ./tests/wire_check "$WORK/fs.sock" shutdown
+    wait $SERVER || fail "server exited with an error"
+}
+
+run "in-memory partition"
+FS_BACKING_FILE="$WORK/backing" FS_CACHE_BLOCKS=64 run "tiered storage"
+
+# 備份檔留著上一次的分區內容，不能被新的分區覆寫
+if printf '2\n4194304\nexit\n%s\npw\n' "$WORK/exit.img" | FS_BACKING_FILE="$WORK/backing" ./filesystem > "$WORK/reuse.log" 2>&1; then
+    fail "reused a non-empty backing file"
+fi
+grep -q "already exists and is not empty" "$WORK/reuse.log" || { cat "$WORK/reuse.log"; fail "no error for a non-empty backing file"; }
+pass
@@ -0,0 +1,18 @@
+#!/bin/sh
+# grep：經由 FS_OP_GREP 檢查 trigram 索引篩選後的結果，分別在整個分區在記憶體中與分層儲存下執行
+set -e
+. "$(dirname "$0")/lib.sh"
+
+run() {
+    rm -f "$WORK/fs.sock"
+    printf '2\n4194304\nserve %s\nexit\n%s\npw\n' "$WORK/fs.sock" "$WORK/exit.img" | ./filesystem > "$WORK/server.log" 2>&1 &
+    SERVER=$!
+    wait_for "$WORK/fs.sock"
+    ./tests/wire_check "$WORK/fs.sock" grep || fail "$1"
+    ./tests/wire_check "$WORK/fs.sock" shutdown
+    wait $SERVER || fail "server exited with an error"
+}
+
+run "in-memory partition"
+FS_BACKING_FILE="$WORK/backing" FS_CACHE_BLOCKS=64 run "tiered storage"
+pass
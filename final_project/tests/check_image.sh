@@ -0,0 +1,43 @@
+#!/bin/sh
+# 映像檔：存檔後重新載入內容不變，截斷或項目損毀的映像檔要被拒絕而不是載入錯誤的內容
+set -e
+. "$(dirname "$0")/lib.sh"
+
+printf 'hello image\n' > "$WORK/host.txt"
+printf '2\n1048576\nmkdir docs\ncd docs\nput %s\ncreate zqzqzqzq\nline one\nline two\n\ncp zqzqzqzq copy.txt\nmkdir inner\ncd ..\nexit\n%s\npw\n' \
+    "$WORK/host.txt" "$WORK/a.img" | ./filesystem > "$WORK/create.log" 2>&1 || { cat "$WORK/create.log"; fail "creating the image"; }
+
+# 載入映像檔，印出內容後另存一份，路徑不同的訊息不比較
+contents() {
+    printf '1\n%s\npw\ncd /\nls\ncd docs\nls\ncat host.txt\ncat zqzqzqzq\ncat copy.txt\ngrep line\ncd inner\nexit\n%s\npw\n' \
+        "$1" "$2" | ./filesystem 2>&1 | grep -v "$WORK" | sed "s|^/[^ ]*\$ ||"
+}
+contents "$WORK/a.img" "$WORK/b.img" > "$WORK/a.txt"
+contents "$WORK/b.img" "$WORK/c.img" > "$WORK/b.txt"
+grep -q "hello image" "$WORK/a.txt" && grep -q "copy.txt:2: line two" "$WORK/a.txt" ||
+    { cat "$WORK/a.txt"; fail "image is missing its contents"; }
+diff "$WORK/a.txt" "$WORK/b.txt" || fail "contents changed after saving and loading again"
+
+# $1 要被拒絕的映像檔
+rejected() {
+    if printf '1\n%s\npw\nexit\n%s\npw\n' "$1" "$WORK/exit.img" | ./filesystem > "$WORK/load.log" 2>&1; then
+        cat "$WORK/load.log"
+        return 1
+    fi
+    grep -q "Error:" "$WORK/load.log"
+}
+
+size=$(wc -c < "$WORK/a.img") # 結尾的 trigram 索引不完整時會重建，只截斷到分區為止
+for keep in 16 1200 2000 $((size / 2)) 1048576; do
+    head -c "$keep" "$WORK/a.img" > "$WORK/short.img"
+    rejected "$WORK/short.img" || fail "loaded an image truncated to $keep bytes"
+done
+
+# 項目以 XOR 0xAA 加密，依加密後的檔名找到項目，把 start_block（名稱 256 位元組之後）改成 -1
+offset=$(LC_ALL=C grep -obUa "$(printf '\320\333\320\333\320\333\320\333')" "$WORK/a.img" | head -1 | cut -d: -f1)
+[ -n "$offset" ] || fail "could not find the file entry in the image"
+cp "$WORK/a.img" "$WORK/bad.img"
+printf '\125\125\125\125' | dd of="$WORK/bad.img" bs=1 seek=$((offset + 260)) conv=notrunc 2> /dev/null
+rejected "$WORK/bad.img" || fail "loaded an image with a corrupt file entry"
+grep -q "is corrupt (file entry" "$WORK/load.log" || { cat "$WORK/load.log"; fail "no error for the corrupt entry"; }
+pass
@@ -0,0 +1,27 @@
+#!/bin/sh
+# 快照：修改後回復，並把快照在背景存成映像檔，再由映像檔啟動 server 檢查內容
+set -e
+. "$(dirname "$0")/lib.sh"
+
+# $1 為啟動時的選單輸入（新分區或載入映像檔）
+start_server() {
+    rm -f "$WORK/fs.sock"
+    printf '%bserve %s\nexit\n%s\npw\n' "$1" "$WORK/fs.sock" "$WORK/exit.img" |
+        FS_SAVE_DIR="$WORK" ./filesystem > "$WORK/server.log" 2>&1 &
+    SERVER=$!
+    wait_for "$WORK/fs.sock"
+}
+
+stop_server() {
+    ./tests/wire_check "$WORK/fs.sock" shutdown
+    wait $SERVER || fail "server exited with an error"
+}
+
+start_server '2\n1048576\n'
+./tests/wire_check "$WORK/fs.sock" snapshot || fail "snapshot and rollback"
+stop_server
+
+start_server "1\n$WORK/snapshot.img\npw\n"
+./tests/wire_check "$WORK/fs.sock" restored || { cat "$WORK/server.log"; fail "image saved from a snapshot"; }
+stop_server
+pass
@@ -0,0 +1,13 @@
+#!/bin/sh
+# 項目表與 cp：大量新增、複製、刪除後查詢與區塊計數仍然正確
+set -e
+. "$(dirname "$0")/lib.sh"
+
+rm -f "$WORK/fs.sock"
+printf '2\n4194304\nserve %s\nexit\n%s\npw\n' "$WORK/fs.sock" "$WORK/exit.img" | ./filesystem > "$WORK/server.log" 2>&1 &
+SERVER=$!
+wait_for "$WORK/fs.sock"
+./tests/wire_check "$WORK/fs.sock" table || fail "file table"
+./tests/wire_check "$WORK/fs.sock" shutdown
+wait $SERVER || fail "server exited with an error"
+pass
@@ -0,0 +1,25 @@
+#!/bin/sh
+# trace 與 fsreplay：互動記錄一段工作負載，重播後存成映像檔，內容要與原本結束時存的映像檔相同
+set -e
+. "$(dirname "$0")/lib.sh"
+
+printf 'first line\nsecond line\n' > "$WORK/host.txt"
+printf '2\n1048576\ntrace start %s\nmkdir d\ncd d\nput %s\ncreate note.txt\nhello\nworld\n\nedit note.txt\nr 1\nHELLO\nw\nw copy.txt\nq\ncp note.txt gone.txt\nrm gone.txt\ncd ..\ntrace stop\nexit\n%s\npw\n' \
+    "$WORK/t.trace" "$WORK/host.txt" "$WORK/recorded.img" | ./filesystem > "$WORK/record.log" 2>&1 ||
+    fail "recording session"
+grep -q "Trace '$WORK/t.trace' closed (9 operations recorded)" "$WORK/record.log" ||
+    { cat "$WORK/record.log"; fail "trace did not record every operation"; }
+
+./fsreplay "$WORK/t.trace" --save "$WORK/replayed.img" pw > "$WORK/replay.log" 2>&1 ||
+    { cat "$WORK/replay.log"; fail "replay reported errors or status mismatches"; }
+
+# 載入映像檔並印出各檔案的內容，路徑不同的訊息不比較
+contents() {
+    printf '1\n%s\npw\ncd d\ncat host.txt\ncat note.txt\ncat copy.txt\ncat gone.txt\nexit\n%s\npw\n' \
+        "$1" "$WORK/exit.img" | ./filesystem 2>&1 | grep -v "$WORK"
+}
+contents "$WORK/recorded.img" > "$WORK/recorded.txt"
+contents "$WORK/replayed.img" > "$WORK/replayed.txt"
+grep -q "HELLO" "$WORK/recorded.txt" || { cat "$WORK/recorded.txt"; fail "recorded image is missing the edit"; }
+diff "$WORK/recorded.txt" "$WORK/replayed.txt" || fail "replayed image differs from the recorded one"
+pass
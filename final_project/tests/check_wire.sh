@@ -0,0 +1,28 @@
+#!/bin/sh
+# 協定往返：在 serve 模式下以 wire_check 送出請求並檢查回應，
+# 另外以很小的描述符上限啟動 server，確認描述符用完時連線會被拒絕而不是讓事件迴圈空轉
+set -e
+. "$(dirname "$0")/lib.sh"
+
+# $1 為 server 的描述符上限
+start_server() {
+    rm -f "$WORK/fs.sock"
+    printf '2\n1048576\nserve %s\nexit\n%s\npw\n' "$WORK/fs.sock" "$WORK/exit.img" |
+        sh -c "ulimit -n $1 && exec ./filesystem" > "$WORK/server.log" 2>&1 &
+    SERVER=$!
+    wait_for "$WORK/fs.sock"
+}
+
+stop_server() {
+    ./tests/wire_check "$WORK/fs.sock" shutdown
+    wait $SERVER || fail "server exited with an error"
+}
+
+start_server 1024
+./tests/wire_check "$WORK/fs.sock"
+stop_server
+
+start_server 24
+./tests/wire_check "$WORK/fs.sock" flood 40
+stop_server
+pass
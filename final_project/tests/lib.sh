@@ -0,0 +1,22 @@
+# check_*.sh 共用的函式，從 final_project 目錄執行
+WORK=$(mktemp -d)
+NAME=$(basename "$0" .sh)
+trap 'rm -rf "$WORK"' EXIT
+
+fail() {
+    echo "$NAME: FAIL: $*"
+    exit 1
+}
+
+pass() {
+    echo "$NAME: ok"
+}
+
+# 等檔案出現（例如 server 的 socket），最多約 5 秒
+wait_for() {
+    for _ in $(seq 50); do
+        [ -e "$1" ] && return 0
+        sleep 0.1
+    done
+    fail "timed out waiting for $1"
+}
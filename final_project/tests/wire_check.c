@@ -0,0 +1,572 @@
+// make check 使用的 client：對 server 送出固定的請求序列並檢查回應
+// 用法：./wire_check <socket>            協定往返（put/get/cat/ls/mkdir/cd/rm 與 pipelining）
+//       ./wire_check <socket> flood <n>  開 n 條連線，超過 server 描述符上限的連線必須被關閉而不是卡住
+//       ./wire_check <socket> edit       隨機編輯並與本地的副本比對，複製的檔案不受影響，刪除後區塊全部歸還
+//       ./wire_check <socket> table      大量新增、複製與刪除檔案，複製的檔案在來源刪除後不變，槽位重用後查詢仍然正確
+//       ./wire_check <socket> grep       trigram 索引篩選候選檔案後比對內容：複本、編輯、刪除、跨段與沒有換行的最後一行
+//       ./wire_check <socket> snapshot   建立快照後修改，在背景存成 <FS_SAVE_DIR>/snapshot.img，回復後內容與區塊數還原
+//       ./wire_check <socket> restored   檢查由 snapshot.img 載入的 server 內容與快照相同
+//       ./wire_check <socket> shutdown   讓 server 結束
+// 任何檢查失敗都印出原因並以 1 結束
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../protocol.h"
+
+static const char *socket_path;
+static uint32_t next_seq = 1;
+
+static void fail(const char *what) {
+    printf("wire_check: FAIL: %s\n", what);
+    exit(1);
+}
+
+static int connect_server(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fail("connect");
+    }
+    return fd;
+}
+
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// 等最多 timeout_ms 毫秒讀滿 len 位元組；連線關閉回傳 0，逾時回傳 -1
+static int recv_all(int fd, void *buf, size_t len, int timeout_ms) {
+    char *p = buf;
+    while (len > 0) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return -1;
+        }
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static uint32_t send_request(int fd, int op, const char *name, const void *data, size_t len) {
+    size_t name_len = strlen(name);
+    FsRequestHeader header = { (uint32_t)(name_len + len), next_seq++, (uint16_t)op, (uint16_t)name_len };
+    if (send_all(fd, &header, sizeof(header)) == -1 || send_all(fd, name, name_len) == -1 ||
+        (len > 0 && send_all(fd, data, len) == -1)) {
+        fail("send");
+    }
+    return header.seq;
+}
+
+// 讀一個回應，body 以 '\0' 結尾，呼叫者負責 free
+static char *read_response(int fd, uint32_t seq, int *status, size_t *len) {
+    FsResponseHeader header;
+    if (recv_all(fd, &header, sizeof(header), 5000) != 1) {
+        fail("response header");
+    }
+    if (header.seq != seq) {
+        fail("response out of order");
+    }
+    char *body = malloc(header.body_len + 1);
+    if (!body) {
+        fail("out of memory");
+    }
+    if (header.body_len > 0 && recv_all(fd, body, header.body_len, 5000) != 1) {
+        fail("response body");
+    }
+    body[header.body_len] = '\0';
+    *status = header.status;
+    if (len) {
+        *len = header.body_len;
+    }
+    return body;
+}
+
+// 送出請求並檢查狀態；contains 不為 NULL 時回應必須包含它
+static void expect(int fd, int op, const char *name, const void *data, size_t len,
+                   int status, const char *contains) {
+    int got;
+    char *body = read_response(fd, send_request(fd, op, name, data, len), &got, NULL);
+    if (got != status || (contains && !strstr(body, contains))) {
+        printf("wire_check: op %d '%s' returned %d: %s", op, name, got, body);
+        fail("unexpected response");
+    }
+    free(body);
+}
+
+static void round_trip(void) {
+    int fd = connect_server();
+    expect(fd, FS_OP_MKDIR, "wire", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_CD, "wire", NULL, 0, 0, NULL);
+
+    // 跨越多個區塊的內容經 put/get 後必須完全相同
+    size_t size = 3000;
+    char *content = malloc(size);
+    if (!content) {
+        fail("out of memory");
+    }
+    for (size_t i = 0; i < size; i++) {
+        content[i] = 'a' + (char)(i * 7 % 26);
+    }
+    expect(fd, FS_OP_PUT, "a.bin", content, size, 0, NULL);
+    int status;
+    size_t len;
+    char *body = read_response(fd, send_request(fd, FS_OP_GET, "a.bin", NULL, 0), &status, &len);
+    if (status != 0 || len != size || memcmp(body, content, size) != 0) {
+        fail("get does not return what put stored");
+    }
+    free(body);
+
+    expect(fd, FS_OP_CREATE, "b.txt", "hello wire\n", 11, 0, NULL);
+    expect(fd, FS_OP_CAT, "b.txt", NULL, 0, 0, "hello wire");
+    expect(fd, FS_OP_LS, "", NULL, 0, 0, "a.bin");
+    expect(fd, FS_OP_GET, "missing", NULL, 0, -1, NULL);
+    expect(fd, FS_OP_CP, "b.txt", "c.txt", 5, 0, NULL);
+    expect(fd, FS_OP_CAT, "c.txt", NULL, 0, 0, "hello wire");
+
+    // pipelining：先送出全部請求再依序讀回應
+    uint32_t seqs[3];
+    seqs[0] = send_request(fd, FS_OP_CAT, "b.txt", NULL, 0);
+    seqs[1] = send_request(fd, FS_OP_CAT, "missing", NULL, 0);
+    seqs[2] = send_request(fd, FS_OP_RM, "c.txt", NULL, 0);
+    int expected[3] = { 0, -1, 0 };
+    for (int i = 0; i < 3; i++) {
+        free(read_response(fd, seqs[i], &status, NULL));
+        if (status != expected[i]) {
+            fail("pipelined request status");
+        }
+    }
+
+    // 每條連線有自己的目前目錄
+    int other = connect_server();
+    expect(other, FS_OP_CAT, "b.txt", NULL, 0, -1, NULL);
+    expect(other, FS_OP_CD, "wire", NULL, 0, 0, NULL);
+    expect(other, FS_OP_CAT, "b.txt", NULL, 0, 0, "hello wire");
+    close(other);
+
+    expect(fd, FS_OP_RM, "a.bin", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RM, "b.txt", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_CD, "..", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RMDIR, "wire", NULL, 0, 0, NULL);
+    free(content);
+    close(fd);
+}
+
+// server 的描述符用完時，多出來的連線要被接受後關閉，其餘連線照常服務，
+// 連線釋放後新的連線又能被接受
+static void flood(int count) {
+    int *fds = malloc(count * sizeof(int));
+    if (!fds) {
+        fail("out of memory");
+    }
+    for (int i = 0; i < count; i++) {
+        fds[i] = connect_server();
+    }
+    int served = 0, refused = 0;
+    for (int i = 0; i < count; i++) {
+        // 被拒絕的連線可能在送出時就發現已關閉
+        FsRequestHeader request = { 0, next_seq++, FS_OP_STATUS, 0 };
+        FsResponseHeader header;
+        int got = 0;
+        if (send_all(fds[i], &request, sizeof(request)) == 0) {
+            got = recv_all(fds[i], &header, sizeof(header), 5000);
+        }
+        if (got == -1) {
+            fail("connection neither served nor closed");
+        }
+        if (got == 0) {
+            refused++;
+            continue;
+        }
+        if (header.seq != request.seq) {
+            fail("response out of order");
+        }
+        char *body = malloc(header.body_len);
+        if (!body || recv_all(fds[i], body, header.body_len, 5000) != 1) {
+            fail("response body");
+        }
+        free(body);
+        served++;
+    }
+    for (int i = 0; i < count; i++) {
+        close(fds[i]);
+    }
+    free(fds);
+    if (served == 0 || refused == 0) {
+        printf("wire_check: %d served, %d refused\n", served, refused);
+        fail("descriptor limit was not exercised");
+    }
+    int fd = connect_server();
+    expect(fd, FS_OP_STATUS, "", NULL, 0, 0, NULL);
+    close(fd);
+}
+
+// status 回應中的已使用區塊數
+static int used_blocks(int fd) {
+    int status, used = -1;
+    char *body = read_response(fd, send_request(fd, FS_OP_STATUS, "", NULL, 0), &status, NULL);
+    char *line = strstr(body, "used blocks: ");
+    if (status != 0 || !line || sscanf(line, "used blocks: %d", &used) != 1) {
+        fail("status does not report used blocks");
+    }
+    free(body);
+    return used;
+}
+
+// 取回檔案並與 expected 比對
+static void expect_content(int fd, const char *name, const char *expected, size_t size) {
+    int status;
+    size_t len;
+    char *body = read_response(fd, send_request(fd, FS_OP_GET, name, NULL, 0), &status, &len);
+    if (status != 0 || len != size || memcmp(body, expected, size) != 0) {
+        printf("wire_check: '%s' has %zu bytes, expected %zu\n", name, len, size);
+        fail("edited content differs");
+    }
+    free(body);
+}
+
+// 對 name 套用一段編輯（刪除 [offset, offset + delete_len) 後插入 text），同時更新本地的副本
+static void apply_edit(int fd, const char *name, char *content, size_t *size,
+                       size_t offset, size_t delete_len, const char *text, size_t len) {
+    char *request = malloc(sizeof(FsEditSpan) + len + 1);
+    if (!request) {
+        fail("out of memory");
+    }
+    FsEditSpan span = { (uint32_t)offset, (uint32_t)delete_len };
+    memcpy(request, &span, sizeof(span));
+    memcpy(request + sizeof(span), text, len);
+    expect(fd, FS_OP_EDIT, name, request, sizeof(span) + len, 0, NULL);
+    free(request);
+    memmove(content + offset + len, content + offset + delete_len, *size - offset - delete_len);
+    memcpy(content + offset, text, len);
+    *size = *size - delete_len + len;
+}
+
+static void random_text(char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        text[i] = (i % 61 == 60) ? '\n' : 'a' + rand() % 26;
+    }
+}
+
+// piece table 的編輯：插入的文字接成新的 extent，刪除只調整 extent，多次編輯後整個檔案重寫；
+// 與 cp 共用區塊的檔案被編輯時另一個檔案不變，全部刪除後已使用的區塊回到原本的數量
+static void edits(void) {
+    int fd = connect_server();
+    int baseline = used_blocks(fd);
+    srand(1);
+
+    size_t size = 20000, capacity = 1 << 20;
+    char *content = malloc(capacity), *original = malloc(size + 64), text[4096];
+    if (!content || !original) {
+        fail("out of memory");
+    }
+    random_text(content, size);
+    memcpy(original, content, size);
+    expect(fd, FS_OP_PUT, "e.txt", content, size, 0, NULL);
+    expect(fd, FS_OP_CP, "e.txt", "f.txt", 5, 0, NULL);
+
+    for (int round = 0; round < 300; round++) {
+        size_t offset = rand() % (size + 1);
+        size_t delete_len = rand() % (round % 10 == 0 ? 4000 : 300);
+        if (delete_len > size - offset) {
+            delete_len = size - offset;
+        }
+        size_t len = rand() % 2000;
+        if (size - delete_len + len == 0 || size - delete_len + len > capacity) {
+            continue;
+        }
+        random_text(text, len);
+        apply_edit(fd, "e.txt", content, &size, offset, delete_len, text, len);
+        expect_content(fd, "e.txt", content, size);
+    }
+    expect_content(fd, "f.txt", original, 20000);
+
+    // 編輯複製出來的檔案也不影響來源
+    size_t copy_size = 20000;
+    memcpy(text, "replaced", 8);
+    apply_edit(fd, "f.txt", original, &copy_size, 5000, 8, text, 8);
+    apply_edit(fd, "f.txt", original, &copy_size, 100, 0, text, 8);
+    expect_content(fd, "f.txt", original, copy_size);
+    expect_content(fd, "e.txt", content, size);
+
+    // 長度不變的修改直接寫回原本的區塊
+    expect(fd, FS_OP_CREATE, "g.txt", "0123456789\n", 11, 0, NULL);
+    expect(fd, FS_OP_EDIT, "g.txt", "\3\0\0\0\2\0\0\0ab", 10, 0, "1 of 1 blocks written");
+    expect(fd, FS_OP_CAT, "g.txt", NULL, 0, 0, "012ab56789");
+
+    expect(fd, FS_OP_RM, "e.txt", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RM, "f.txt", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RM, "g.txt", NULL, 0, 0, NULL);
+    if (used_blocks(fd) != baseline) {
+        printf("wire_check: %d blocks used after removing everything, expected %d\n", used_blocks(fd), baseline);
+        fail("edits leaked blocks");
+    }
+    free(content);
+    free(original);
+    close(fd);
+}
+
+// 跨越數個 slab 的項目表：刪除結尾的項目讓表縮小、刪除中間的項目留下墓碑，
+// 新增的項目重用槽位後其他檔案仍然查得到；cp 共用的區塊在兩邊都刪除後才歸還
+static void table(void) {
+    int fd = connect_server();
+    int baseline = used_blocks(fd);
+    enum { FILES = 700 };
+    char name[32], copy[32], content[64];
+
+    for (int i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        int len = snprintf(content, sizeof(content), "content of file %d\n", i);
+        expect(fd, FS_OP_PUT, name, content, len, 0, NULL);
+        if (i % 2 == 1) {
+            snprintf(copy, sizeof(copy), "c%d", i);
+            expect(fd, FS_OP_CP, name, copy, strlen(copy), 0, NULL);
+        }
+    }
+    // 先刪掉結尾的一半（表縮小），再每三個刪掉一個來源（留下墓碑）
+    for (int i = FILES - 1; i >= FILES / 2; i--) {
+        snprintf(name, sizeof(name), "t%d", i);
+        expect(fd, FS_OP_RM, name, NULL, 0, 0, NULL);
+    }
+    for (int i = 0; i < FILES / 2; i += 3) {
+        snprintf(name, sizeof(name), "t%d", i);
+        expect(fd, FS_OP_RM, name, NULL, 0, 0, NULL);
+    }
+    // 重用槽位的新檔案
+    for (int i = 0; i < FILES / 2; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        int len = snprintf(content, sizeof(content), "new file %d\n", i);
+        expect(fd, FS_OP_CREATE, name, content, len, 0, NULL);
+    }
+
+    for (int i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        snprintf(content, sizeof(content), "content of file %d\n", i);
+        int exists = i < FILES / 2 && i % 3 != 0;
+        expect(fd, FS_OP_CAT, name, NULL, 0, exists ? 0 : -1, exists ? content : NULL);
+        if (i % 2 == 1) {
+            snprintf(copy, sizeof(copy), "c%d", i);
+            expect(fd, FS_OP_CAT, copy, NULL, 0, 0, content);
+        }
+        if (i < FILES / 2) {
+            snprintf(name, sizeof(name), "n%d", i);
+            snprintf(content, sizeof(content), "new file %d\n", i);
+            expect(fd, FS_OP_CAT, name, NULL, 0, 0, content);
+        }
+    }
+
+    for (int i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        if (i < FILES / 2 && i % 3 != 0) {
+            expect(fd, FS_OP_RM, name, NULL, 0, 0, NULL);
+        }
+        if (i % 2 == 1) {
+            snprintf(copy, sizeof(copy), "c%d", i);
+            expect(fd, FS_OP_RM, copy, NULL, 0, 0, NULL);
+        }
+        if (i < FILES / 2) {
+            snprintf(name, sizeof(name), "n%d", i);
+            expect(fd, FS_OP_RM, name, NULL, 0, 0, NULL);
+        }
+    }
+    expect(fd, FS_OP_LS, "", NULL, 0, 0, NULL);
+    if (used_blocks(fd) != baseline) {
+        printf("wire_check: %d blocks used after removing everything, expected %d\n", used_blocks(fd), baseline);
+        fail("shared blocks were not returned");
+    }
+    close(fd);
+}
+
+// 送出 grep 並確認回應包含 contains、不包含 excludes（可以是 NULL）
+static void expect_grep(int fd, const char *pattern, const char *contains, const char *excludes) {
+    int status;
+    char *body = read_response(fd, send_request(fd, FS_OP_GREP, pattern, NULL, 0), &status, NULL);
+    if (!strstr(body, contains) || (excludes && strstr(body, excludes))) {
+        printf("wire_check: grep '%s' returned: %s", pattern, body);
+        fail("unexpected grep result");
+    }
+    free(body);
+}
+
+static void grep_index(void) {
+    int fd = connect_server();
+
+    // 大檔案：一行跨過分段讀取的邊界（64 KB），最後一行沒有換行
+    size_t size = 200000, at = 0;
+    char *big = malloc(size + 64);
+    if (!big) {
+        fail("out of memory");
+    }
+    int line = 1, straddle_line = 0;
+    while (at < size) {
+        if (!straddle_line && at + 40 > 65536) {
+            at += sprintf(big + at, "straddle marker %d\n", line);
+            straddle_line = line;
+        } else {
+            at += sprintf(big + at, "filler line %06d\n", line);
+        }
+        line++;
+    }
+    at += sprintf(big + at, "the tailneedle");
+    expect(fd, FS_OP_PUT, "big.txt", big, at, 0, NULL);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "/big.txt:%d: straddle marker %d\n", straddle_line, straddle_line);
+    expect_grep(fd, "straddle marker", expected, NULL);
+    snprintf(expected, sizeof(expected), "/big.txt:%d: the tailneedle\n", line);
+    expect_grep(fd, "tailneedle", expected, NULL);
+
+    // cp 的複本沿用來源的 posting；來源改寫後只有複本還符合
+    expect(fd, FS_OP_CREATE, "small.txt", "alpha beta\ngamma needle here\n", 28, 0, NULL);
+    expect(fd, FS_OP_CP, "small.txt", "copy.txt", 8, 0, NULL);
+    expect_grep(fd, "needle here", "/small.txt:2: gamma needle here", NULL);
+    expect_grep(fd, "needle here", "/copy.txt:2: gamma needle here", NULL);
+    char edit[sizeof(FsEditSpan) + 3];
+    FsEditSpan span = { 17, 6 };
+    memcpy(edit, &span, sizeof(span));
+    memcpy(edit + sizeof(span), "pin", 3);
+    expect(fd, FS_OP_EDIT, "small.txt", edit, sizeof(edit), 0, NULL);
+    expect_grep(fd, "needle here", "/copy.txt:2:", "/small.txt");
+    expect_grep(fd, "pin here", "/small.txt:2: gamma pin here", "/copy.txt");
+    expect(fd, FS_OP_RM, "copy.txt", NULL, 0, 0, NULL);
+    expect_grep(fd, "needle here", "No matches", NULL);
+
+    // 太短沒有 trigram 的樣式與不存在的樣式
+    expect_grep(fd, "ga", "/small.txt:2: gamma pin here", NULL);
+    expect_grep(fd, "not present anywhere", "No matches", NULL);
+
+    expect(fd, FS_OP_RM, "big.txt", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RM, "small.txt", NULL, 0, 0, NULL);
+    free(big);
+    close(fd);
+}
+
+// 快照中 s.txt 的內容
+static char *snapshot_content(size_t size) {
+    char *content = malloc(size);
+    if (!content) {
+        fail("out of memory");
+    }
+    for (size_t i = 0; i < size; i++) {
+        content[i] = (i % 50 == 49) ? '\n' : 'A' + (char)(i * 11 % 26);
+    }
+    return content;
+}
+
+// 快照當時的內容：s.txt 與 keep.txt 存在，new.txt 不存在
+static void expect_snapshot_state(int fd, const char *content, size_t size) {
+    expect_content(fd, "s.txt", content, size);
+    expect(fd, FS_OP_CAT, "keep.txt", NULL, 0, 0, "keep me");
+    expect(fd, FS_OP_CAT, "new.txt", NULL, 0, -1, NULL);
+    expect_grep(fd, "keep me", "/keep.txt:1: keep me", NULL);
+}
+
+static void snapshot(void) {
+    int fd = connect_server();
+    int baseline = used_blocks(fd);
+    size_t size = 5000;
+    char *content = snapshot_content(size);
+    expect(fd, FS_OP_PUT, "s.txt", content, size, 0, NULL);
+    expect(fd, FS_OP_CREATE, "keep.txt", "keep me\n", 8, 0, NULL);
+    expect(fd, FS_OP_SNAPSHOT, "create s1", NULL, 0, 0, NULL);
+
+    // 修改快照共用的項目與區塊：編輯、刪除、新增
+    char edit[sizeof(FsEditSpan) + 7];
+    FsEditSpan span = { 100, 0 };
+    memcpy(edit, &span, sizeof(span));
+    memcpy(edit + sizeof(span), "CHANGED", 7);
+    expect(fd, FS_OP_EDIT, "s.txt", edit, sizeof(edit), 0, NULL);
+    expect(fd, FS_OP_RM, "keep.txt", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_CREATE, "new.txt", "new\n", 4, 0, NULL);
+    expect(fd, FS_OP_SNAPSHOT, "save s1 snapshot.img", "pw", 2, 0, NULL);
+    expect(fd, FS_OP_CAT, "keep.txt", NULL, 0, -1, NULL);
+
+    expect(fd, FS_OP_SNAPSHOT, "rollback s1", NULL, 0, 0, NULL);
+    expect_snapshot_state(fd, content, size);
+
+    // 背景儲存結束後才能刪除快照
+    for (int tries = 0;; tries++) {
+        int status;
+        char *body = read_response(fd, send_request(fd, FS_OP_SNAPSHOT, "list", NULL, 0), &status, NULL);
+        int saved = strstr(body, "(saved to") != NULL;
+        if (strstr(body, "failed to save")) {
+            fail("snapshot save failed");
+        }
+        free(body);
+        if (saved) {
+            break;
+        }
+        if (tries == 50) {
+            fail("snapshot save did not finish");
+        }
+        usleep(100000);
+    }
+    expect(fd, FS_OP_SNAPSHOT, "delete s1", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RM, "s.txt", NULL, 0, 0, NULL);
+    expect(fd, FS_OP_RM, "keep.txt", NULL, 0, 0, NULL);
+    if (used_blocks(fd) != baseline) {
+        printf("wire_check: %d blocks used after removing everything, expected %d\n", used_blocks(fd), baseline);
+        fail("snapshot blocks were not returned");
+    }
+    free(content);
+    close(fd);
+}
+
+static void restored(void) {
+    int fd = connect_server();
+    size_t size = 5000;
+    char *content = snapshot_content(size);
+    expect_snapshot_state(fd, content, size);
+    free(content);
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <socket> [flood <connections> | edit | table | grep | snapshot | restored | shutdown]\n", argv[0]);
+        return 2;
+    }
+    socket_path = argv[1];
+    if (argc >= 4 && strcmp(argv[2], "flood") == 0) {
+        flood(atoi(argv[3]));
+    } else if (argc >= 3 && strcmp(argv[2], "edit") == 0) {
+        edits();
+    } else if (argc >= 3 && strcmp(argv[2], "table") == 0) {
+        table();
+    } else if (argc >= 3 && strcmp(argv[2], "grep") == 0) {
+        grep_index();
+    } else if (argc >= 3 && strcmp(argv[2], "snapshot") == 0) {
+        snapshot();
+    } else if (argc >= 3 && strcmp(argv[2], "restored") == 0) {
+        restored();
+    } else if (argc >= 3 && strcmp(argv[2], "shutdown") == 0) {
+        int fd = connect_server();
+        expect(fd, FS_OP_SHUTDOWN, "", NULL, 0, 0, NULL);
+        close(fd);
+    } else {
+        round_trip();
+    }
+    return 0;
+}
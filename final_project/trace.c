@@ -0,0 +1,211 @@
+#include <time.h>
+#include "trace.h"
+#include "command.h"
+
+static FILE *trace_file = NULL;
+static char trace_path[MAX_FILENAME];
+static uint64_t trace_origin;   // 開始記錄時的 CLOCK_MONOTONIC
+static long trace_records;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t trace_clock(void) {
+    return trace_file ? monotonic_ns() : 0;
+}
+
+// 寫出記錄的標頭與名稱，資料由呼叫者接著寫，寫入失敗回傳 -1
+static int write_record(int op, const char *name, size_t data_len, int status, uint64_t start) {
+    TraceRecord record = {
+        .start_ns = start - trace_origin,
+        .duration_ns = monotonic_ns() - start,
+        .data_len = (uint32_t)data_len,
+        .op = (uint16_t)op,
+        .name_len = (uint16_t)strlen(name),
+        .status = status,
+    };
+    if (fwrite(&record, sizeof(record), 1, trace_file) != 1 ||
+        fwrite(name, 1, record.name_len, trace_file) != record.name_len) {
+        return -1;
+    }
+    trace_records++;
+    return 0;
+}
+
+// 讀不到要記錄的內容或寫不進 trace 時，之後的記錄也無法重播，直接結束記錄
+static void trace_fail(const char *reason, const char *name) {
+    fs_printf("Error: %s '%s' for the trace; recording stopped.\n", reason, name);
+    trace_close();
+}
+
+void trace_record(int op, const char *name, const void *data, size_t data_len, int status, uint64_t start) {
+    if (!trace_file) {
+        return;
+    }
+    if (write_record(op, name, data_len, status, start) == -1 ||
+        (data_len > 0 && fwrite(data, 1, data_len, trace_file) != data_len)) {
+        trace_fail("Could not write", name);
+    }
+}
+
+void trace_record_file(FileSystem *fs, int op, const char *name, int status, uint64_t start) {
+    if (!trace_file) {
+        return;
+    }
+    // 與 put 相同，以主機路徑的最後一段作為檔名
+    const char *basename = strrchr(name, '/');
+    basename = basename ? basename + 1 : name;
+    int i = status == 0 ? find_file(fs, basename) : -1;
+    if (i == -1) {
+        trace_record(op, basename, NULL, 0, status, start);
+        return;
+    }
+    // 內容分段從區塊層直接寫進 trace，不需要一次載入整個檔案
+    File *file = file_at(fs, i);
+    if (write_record(op, basename, file->size, status, start) == -1 ||
+        file_write_to(fs, i, trace_file) == -1) {
+        trace_fail("Could not record", basename);
+    }
+}
+
+void trace_record_saved_as(FileSystem *fs, const char *name) {
+    trace_record_file(fs, FS_OP_CREATE, name, 0, trace_clock());
+}
+
+char *trace_copy_file(FileSystem *fs, const char *name, int *length) {
+    int i = trace_file ? find_file(fs, name) : -1;
+    if (i == -1 || file_at(fs, i)->is_directory) {
+        return NULL;
+    }
+    File *file = file_at(fs, i);
+    char *copy = malloc(file->size > 0 ? file->size : 1);
+    if (!copy || file_read(fs, i, 0, copy, file->size) == -1) {
+        free(copy);
+        trace_fail("Could not read", name);
+        return NULL;
+    }
+    *length = file->size;
+    return copy;
+}
+
+void trace_record_edit(FileSystem *fs, const char *name, char *before, int before_len, int status, uint64_t start) {
+    if (!trace_file || !before) {
+        free(before);
+        return;
+    }
+    int i = find_file(fs, name);
+    char *after = NULL;
+    int after_len = 0;
+    if (i != -1) {
+        after_len = file_at(fs, i)->size;
+        after = malloc(after_len > 0 ? after_len : 1);
+        if (!after || file_read(fs, i, 0, after, after_len) == -1) {
+            free(after);
+            free(before);
+            trace_fail("Could not read", name);
+            return;
+        }
+    }
+
+    // 去掉相同的開頭與結尾，剩下的就是這次編輯改變的範圍
+    int prefix = 0;
+    while (prefix < before_len && prefix < after_len && before[prefix] == after[prefix]) {
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < before_len - prefix && suffix < after_len - prefix &&
+           before[before_len - 1 - suffix] == after[after_len - 1 - suffix]) {
+        suffix++;
+    }
+    if (prefix == before_len && prefix == after_len) {
+        free(after);
+        free(before);
+        return; // 沒有存檔，或內容沒有改變
+    }
+
+    FsEditSpan span = { .offset = prefix, .delete_len = before_len - prefix - suffix };
+    int insert_len = after_len - prefix - suffix;
+    char *data = malloc(sizeof(span) + insert_len);
+    if (!data) {
+        free(after);
+        free(before);
+        trace_fail("Not enough memory to record", name);
+        return;
+    }
+    memcpy(data, &span, sizeof(span));
+    memcpy(data + sizeof(span), after + prefix, insert_len);
+    free(after);
+    trace_record(FS_OP_EDIT, name, data, sizeof(span) + insert_len, status, start);
+    free(data);
+    free(before);
+}
+
+void trace_close(void) {
+    if (!trace_file) {
+        return;
+    }
+    // 緩衝中的記錄在關閉時才寫出，寫入失敗時 trace 的結尾不完整
+    int result = fclose(trace_file);
+    trace_file = NULL;
+    if (result == EOF) {
+        fs_printf("Error: Could not finish writing trace '%s'; the last operations may be missing.\n", trace_path);
+    }
+    fs_printf("Trace '%s' closed (%ld operations recorded).\n", trace_path, trace_records);
+}
+
+int trace_command(FileSystem *fs, const char *args) {
+    char action[16] = "", filename[MAX_FILENAME] = "";
+    int count = sscanf(args, "%15s %254s", action, filename);
+
+    if (count < 1) {
+        if (trace_file) {
+            fs_printf("Recording to '%s' (%ld operations so far).\n", trace_path, trace_records);
+        } else {
+            fs_printf("Not recording.\n");
+        }
+        return 0;
+    }
+    if (strcmp(action, "stop") == 0) {
+        if (!trace_file) {
+            fs_printf("Error: Not recording.\n");
+            return -1;
+        }
+        trace_close();
+        return 0;
+    }
+    if (count == 2 && strcmp(action, "start") == 0) {
+        if (trace_file) {
+            fs_printf("Error: Already recording to '%s'.\n", trace_path);
+            return -1;
+        }
+        FILE *file = fopen(filename, "wb");
+        if (!file) {
+            fs_printf("Error: Could not create file '%s'.\n", filename);
+            return -1;
+        }
+        TraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.block_size = BLOCK_SIZE;
+        header.partition_size = fs->partition_size;
+        header.started = time(NULL);
+        strcpy(header.cwd, fs->current_path);
+        if (fwrite(&header, sizeof(header), 1, file) != 1) {
+            fclose(file);
+            fs_printf("Error: Could not write file '%s'.\n", filename);
+            return -1;
+        }
+
+        trace_file = file;
+        strcpy(trace_path, filename);
+        trace_origin = monotonic_ns();
+        trace_records = 0;
+        fs_printf("Recording operations to '%s'.\n", filename);
+        return 0;
+    }
+    fs_printf("Usage: trace start <file> | trace stop | trace\n");
+    return -1;
+}
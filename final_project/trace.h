@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "filesystem.h"
+#include "protocol.h"
+
+// 工作負載追蹤：記錄互動指令的操作、參數、資料與時間，之後可以用 fsreplay 重新執行
+// 檔案格式為 TraceHeader 之後接連續的 TraceRecord + 名稱 + 資料，整數使用本機位元組序
+// 操作以 FS_OP_* 表示，名稱與資料的意義和 protocol.h 相同，重播時直接交給 execute_op：
+//   put     記錄存入後的檔案內容，重播不需要原本的主機檔案
+//   create  記錄輸入的文字
+//   edit    記錄存檔前後內容的差異範圍（FsEditSpan + 新文字），互動編輯被壓成一次修改；
+//           編輯中以「w <新檔名>」另存的檔案各記錄成一個 create，資料為新檔案的內容
+// serve 期間的操作與 exit 的儲存不記錄（fsreplay --save 可以在最後存檔）
+
+#define TRACE_MAGIC "FSTRACE1"
+
+typedef struct {
+    char magic[8];
+    uint32_t block_size;
+    int32_t partition_size;     // 開始記錄時的分區大小，重播新的分區時使用
+    int64_t started;            // 開始記錄的時間（epoch 秒）
+    char cwd[MAX_PATH + 1];     // 開始記錄時的目前目錄
+} TraceHeader;
+
+typedef struct {
+    uint64_t start_ns;          // 相對於開始記錄的時間
+    uint64_t duration_ns;       // 指令執行的時間（create 與 edit 包含等待輸入）
+    uint32_t data_len;
+    uint16_t op;                // FS_OP_*
+    uint16_t name_len;          // 名稱長度（不含 '\0'）
+    int32_t status;             // 指令的結果（0 或 -1）
+} TraceRecord;
+
+// 從現在的時間點開始計時，回傳給 trace_record 使用
+uint64_t trace_clock(void);
+
+// 記錄一個操作，start 為 trace_clock() 的值
+void trace_record(int op, const char *name, const void *data, size_t data_len, int status, uint64_t start);
+
+// 記錄 put 或 create：資料為剛存入的檔案內容，name 為主機路徑時只記錄最後一段
+void trace_record_file(FileSystem *fs, int op, const char *name, int status, uint64_t start);
+
+// 記錄 edit：before 為編輯前的內容（由呼叫者配置，這裡會釋放），與目前內容比較出變動的範圍
+void trace_record_edit(FileSystem *fs, const char *name, char *before, int before_len, int status, uint64_t start);
+
+// 記錄 edit 中另存的新檔案（當作 create），傳給 edit 的 saved_as
+void trace_record_saved_as(FileSystem *fs, const char *name);
+
+// 編輯前複製檔案內容給 trace_record_edit，沒有在記錄或找不到檔案時回傳 NULL
+char *trace_copy_file(FileSystem *fs, const char *name, int *length);
+
+// trace 指令：「trace start <file>」開始記錄，「trace stop」結束，「trace」顯示狀態
+int trace_command(FileSystem *fs, const char *args);
+
+// 結束記錄並關閉檔案
+void trace_close(void);
+
+#endif
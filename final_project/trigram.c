@@ -0,0 +1,562 @@
+#include <stdint.h>
+#include "trigram.h"
+#include "filetable.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TRIGRAM_MAGIC 0x32494754u    // "TGI2"（加上別名表）
+#define REBUILD_MIN_STALE 65536      // 過期 posting 至少這麼多且超過一半時才重建
+#define SCAN_FALLBACK_PERCENT 98     // 最短的 posting list 超過存活項目的這個比例時改成掃描所有檔案
+
+TrigramIndex *trigram_index_create(void) {
+    TrigramIndex *ti = calloc(1, sizeof(TrigramIndex));
+    if (!ti) {
+        return NULL;
+    }
+    ti->list_capacity = 1024;
+    ti->lists = malloc(ti->list_capacity * sizeof(PostingList));
+    if (!ti->lists) {
+        free(ti);
+        return NULL;
+    }
+    for (int i = 0; i < ti->list_capacity; i++) {
+        ti->lists[i].key = TRIGRAM_EMPTY;
+    }
+    return ti;
+}
+
+static void clear_lists(TrigramIndex *ti) {
+    for (int i = 0; i < ti->list_capacity; i++) {
+        if (ti->lists[i].key != TRIGRAM_EMPTY) {
+            free(ti->lists[i].files);
+        }
+        ti->lists[i].key = TRIGRAM_EMPTY;
+    }
+    ti->list_count = 0;
+    ti->total_postings = 0;
+    ti->stale_postings = 0;
+}
+
+void trigram_index_destroy(TrigramIndex *ti) {
+    if (!ti) {
+        return;
+    }
+    clear_lists(ti);
+    free(ti->lists);
+    free(ti->file_postings);
+    free(ti->seen);
+    free(ti->seen_keys);
+    free(ti->alias);
+    free(ti);
+}
+
+static unsigned int slot_of(unsigned int key, int capacity) {
+    return (key * 2654435761u) & (capacity - 1);
+}
+
+static PostingList *find_list(TrigramIndex *ti, unsigned int key) {
+    unsigned int slot = slot_of(key, ti->list_capacity);
+    while (ti->lists[slot].key != TRIGRAM_EMPTY) {
+        if (ti->lists[slot].key == key) {
+            return &ti->lists[slot];
+        }
+        slot = (slot + 1) & (ti->list_capacity - 1);
+    }
+    return NULL;
+}
+
+static int grow_lists(TrigramIndex *ti) {
+    PostingList *lists = malloc(ti->list_capacity * 2 * sizeof(PostingList));
+    if (!lists) {
+        return -1;
+    }
+    PostingList *old = ti->lists;
+    int old_capacity = ti->list_capacity;
+    ti->list_capacity *= 2;
+    ti->lists = lists;
+    for (int i = 0; i < ti->list_capacity; i++) {
+        ti->lists[i].key = TRIGRAM_EMPTY;
+    }
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].key != TRIGRAM_EMPTY) {
+            unsigned int slot = slot_of(old[i].key, ti->list_capacity);
+            while (ti->lists[slot].key != TRIGRAM_EMPTY) {
+                slot = (slot + 1) & (ti->list_capacity - 1);
+            }
+            ti->lists[slot] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// 找出或新增 key 的 posting list，記憶體不足回傳 NULL
+static PostingList *get_list(TrigramIndex *ti, unsigned int key) {
+    PostingList *list = find_list(ti, key);
+    if (list) {
+        return list;
+    }
+    if ((ti->list_count + 1) * 2 > ti->list_capacity && grow_lists(ti) == -1) {
+        return NULL;
+    }
+    unsigned int slot = slot_of(key, ti->list_capacity);
+    while (ti->lists[slot].key != TRIGRAM_EMPTY) {
+        slot = (slot + 1) & (ti->list_capacity - 1);
+    }
+    list = &ti->lists[slot];
+    list->key = key;
+    list->count = 0;
+    list->capacity = 0;
+    list->files = NULL;
+    ti->list_count++;
+    return list;
+}
+
+static int append_posting(PostingList *list, int index) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 4;
+        int *files = realloc(list->files, capacity * sizeof(int));
+        if (!files) {
+            return -1;
+        }
+        list->files = files;
+        list->capacity = capacity;
+    }
+    list->files[list->count++] = index;
+    return 0;
+}
+
+static int ensure_file_capacity(TrigramIndex *ti, int count) {
+    if (count <= ti->file_capacity) {
+        return 0;
+    }
+    int capacity = ti->file_capacity ? ti->file_capacity : 256;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    int *postings = realloc(ti->file_postings, capacity * sizeof(int));
+    if (!postings) {
+        return -1;
+    }
+    ti->file_postings = postings;
+    memset(ti->file_postings + ti->file_capacity, 0, (capacity - ti->file_capacity) * sizeof(int));
+    int *alias = realloc(ti->alias, capacity * sizeof(int));
+    if (!alias) {
+        return -1; // file_postings 已經變大，file_capacity 維持原值仍然正確
+    }
+    ti->alias = alias;
+    memset(ti->alias + ti->file_capacity, 0xFF, (capacity - ti->file_capacity) * sizeof(int));
+    ti->file_capacity = capacity;
+    return 0;
+}
+
+// 記憶體不足讓索引不完整時放棄整個索引，之後 grep 直接掃描所有檔案
+static void drop_index(FileSystem *fs) {
+    fs_printf("Warning: Not enough memory for the search index; grep will scan every file.\n");
+    trigram_index_destroy(fs->trigram_index);
+    fs->trigram_index = NULL;
+}
+
+#define TRIGRAM_AT(p) (((unsigned int)(p)[0] << 16) | ((unsigned int)(p)[1] << 8) | (unsigned int)(p)[2])
+
+// 加入一個檔案時 storage_scan 的狀態
+typedef struct {
+    TrigramIndex *ti;
+    int index;
+    int added;               // 加入的 posting 數（有 seen 時也是 seen_keys 的數量）
+    int keys_lost;           // seen_keys 配置失敗，最後要清整個 seen
+    int failed;              // posting 配置失敗，索引已經不完整
+} AddScan;
+
+// 處理一段內容中起點在這一段的 trigram（storage_scan 帶著上一段最後 2 個位元組）
+static void add_trigrams(void *ctx, const char *chunk, size_t len) {
+    AddScan *scan = ctx;
+    TrigramIndex *ti = scan->ti;
+    unsigned char *seen = ti->seen;
+    const unsigned char *data = (const unsigned char *)chunk;
+    for (size_t i = 0; !scan->failed && i + 3 <= len; i++) {
+        unsigned int key = TRIGRAM_AT(data + i);
+        // 配置不到 seen 時每次出現都加入，重複的 posting 查詢時會過濾
+        if (!seen || !(seen[key >> 3] & (1 << (key & 7)))) {
+            if (seen) {
+                seen[key >> 3] |= 1 << (key & 7);
+                if (scan->added == ti->seen_key_capacity && !scan->keys_lost) {
+                    int capacity = ti->seen_key_capacity ? ti->seen_key_capacity * 2 : 4096;
+                    unsigned int *keys = realloc(ti->seen_keys, capacity * sizeof(unsigned int));
+                    if (keys) {
+                        ti->seen_keys = keys;
+                        ti->seen_key_capacity = capacity;
+                    } else {
+                        scan->keys_lost = 1;
+                    }
+                }
+                if (!scan->keys_lost) {
+                    ti->seen_keys[scan->added] = key;
+                }
+            }
+            PostingList *list = get_list(ti, key);
+            if (!list || append_posting(list, scan->index) == -1) {
+                scan->failed = 1;
+            }
+            scan->added++;
+        }
+    }
+}
+
+// 記憶體不足時回傳 -1，呼叫者放棄整個索引
+static int add_file(TrigramIndex *ti, FileSystem *fs, int index) {
+    File *file = file_at(fs, index);
+    if (file->is_directory || file->size < 3) {
+        return 0;
+    }
+    if (!ti->seen) {
+        ti->seen = calloc(1 << 21, 1);
+    }
+    // 分段讀取內容，分層儲存時不需要一次把整個檔案載入記憶體
+    AddScan scan = { .ti = ti, .index = index };
+    if (file_scan(fs, index, 2, add_trigrams, &scan) == -1) {
+        fs_printf("Warning: Could not read '%s' for the search index; grep may miss it.\n", file->name);
+    }
+    // 只清掉這次用到的位元，避免每個檔案都清整個 2MB
+    if (ti->seen && scan.keys_lost) {
+        memset(ti->seen, 0, 1 << 21);
+    }
+    for (int i = 0; ti->seen && !scan.keys_lost && i < scan.added; i++) {
+        unsigned int key = ti->seen_keys[i];
+        ti->seen[key >> 3] &= ~(1 << (key & 7));
+    }
+    if (scan.failed || ensure_file_capacity(ti, index + 1) == -1) {
+        return -1;
+    }
+    ti->file_postings[index] = scan.added;
+    ti->total_postings += scan.added;
+    return 0;
+}
+
+void trigram_index_rebuild(FileSystem *fs) {
+    TrigramIndex *ti = fs->trigram_index;
+    if (!ti) {
+        return;
+    }
+    clear_lists(ti);
+    if (ensure_file_capacity(ti, fs->file_count) == -1) {
+        drop_index(fs);
+        return;
+    }
+    memset(ti->file_postings, 0, ti->file_capacity * sizeof(int));
+    memset(ti->alias, 0xFF, ti->file_capacity * sizeof(int)); // 別名也依內容各自加入
+    ti->alias_count = 0;
+    for (int i = 0; i < fs->file_count; i++) {
+        if (file_at(fs, i)->in_use == 1 && add_file(ti, fs, i) == -1) {
+            drop_index(fs);
+            return;
+        }
+    }
+}
+
+// 過期的 posting 太多時重建，回傳 1 表示已重建
+static int maybe_rebuild(FileSystem *fs) {
+    TrigramIndex *ti = fs->trigram_index;
+    if (ti->stale_postings >= REBUILD_MIN_STALE && ti->stale_postings * 2 > ti->total_postings) {
+        trigram_index_rebuild(fs);
+        return 1;
+    }
+    return 0;
+}
+
+void trigram_index_add(FileSystem *fs, int index) {
+    if (!fs->trigram_index || maybe_rebuild(fs)) {
+        return; // 重建時已經包含這個檔案
+    }
+    if (add_file(fs->trigram_index, fs, index) == -1) {
+        drop_index(fs);
+    }
+}
+
+void trigram_index_copy(FileSystem *fs, int index, int source) {
+    TrigramIndex *ti = fs->trigram_index;
+    if (!ti) {
+        return;
+    }
+    if (ensure_file_capacity(ti, (index > source ? index : source) + 1) == -1) {
+        drop_index(fs);
+        return;
+    }
+    int root = ti->alias[source] != -1 ? ti->alias[source] : source;
+    // 重用的槽位可能正好是來源已刪除的舊槽位，那些 posting 本來就記在 index 下
+    if (root != index) {
+        ti->alias[index] = root;
+        ti->alias_count++;
+    }
+    ti->file_postings[index] = 0;
+}
+
+void trigram_index_remove(FileSystem *fs, int index) {
+    TrigramIndex *ti = fs->trigram_index;
+    if (!ti || index >= ti->file_capacity) {
+        return;
+    }
+    if (ti->alias[index] != -1) {
+        ti->alias[index] = -1;
+        ti->alias_count--;
+    }
+    ti->stale_postings += ti->file_postings[index];
+    ti->file_postings[index] = 0;
+}
+
+void trigram_index_update(FileSystem *fs, int index) {
+    trigram_index_remove(fs, index);
+    trigram_index_add(fs, index);
+}
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_list_length(const void *a, const void *b) {
+    int x = (*(PostingList *const *)a)->count, y = (*(PostingList *const *)b)->count;
+    return (x > y) - (x < y);
+}
+
+// 所有存活的檔案都是候選
+static void all_files(FileSystem *fs, int *result, int *count) {
+    for (int i = 0; i < fs->file_count; i++) {
+        File *file = file_at(fs, i);
+        if (file->in_use == 1 && !file->is_directory) {
+            result[(*count)++] = i;
+        }
+    }
+}
+
+int trigram_index_candidates(FileSystem *fs, const char *pattern, int len, int **files, int *count) {
+    TrigramIndex *ti = fs->trigram_index;
+    int *result = malloc((fs->file_count > 0 ? fs->file_count : 1) * sizeof(int));
+    if (!result) {
+        return -1;
+    }
+    *files = result;
+    *count = 0;
+
+    // 太短的字串沒有 trigram 可用，所有檔案都是候選
+    if (!ti || len < 3) {
+        all_files(fs, result, count);
+        return 0;
+    }
+    maybe_rebuild(fs);
+    if (!fs->trigram_index) {
+        all_files(fs, result, count); // 重建時記憶體不足，索引已經放棄
+        return 0;
+    }
+
+    // 找出樣式中每個 trigram 的 posting list，任何一個不存在就不可能有結果
+    int list_count = 0;
+    PostingList **lists = malloc((len - 2) * sizeof(PostingList *));
+    if (!lists) {
+        free(result);
+        return -1;
+    }
+    for (int i = 0; i + 3 <= len; i++) {
+        PostingList *list = find_list(ti, TRIGRAM_AT((const unsigned char *)pattern + i));
+        if (!list) {
+            free(lists);
+            return 0;
+        }
+        int duplicate = 0;
+        for (int j = 0; j < list_count; j++) {
+            duplicate |= lists[j] == list;
+        }
+        if (!duplicate) {
+            lists[list_count++] = list;
+        }
+    }
+
+    // 由短到長求交集：mark[f] == t 代表檔案 f 出現在前 t 個 list 中（list 內的重複不影響）
+    qsort(lists, list_count, sizeof(PostingList *), compare_list_length);
+
+    // 常見的字串每個 trigram 幾乎都出現在所有檔案中，求交集也篩不掉檔案，直接掃描所有檔案
+    if ((long)lists[0]->count * 100 > (long)fs->live_files * SCAN_FALLBACK_PERCENT) {
+        all_files(fs, result, count);
+        free(lists);
+        return 0;
+    }
+    // 別名借用的項目可能已經刪除並被項目表從結尾去掉，它的 posting 仍然要算進來
+    int marks = fs->file_count > ti->file_capacity ? fs->file_count : ti->file_capacity;
+    int *mark = calloc(marks > 0 ? marks : 1, sizeof(int));
+    if (!mark) {
+        free(lists);
+        free(result);
+        return -1;
+    }
+    for (int t = 0; t < list_count; t++) {
+        for (int j = 0; j < lists[t]->count; j++) {
+            int f = lists[t]->files[j];
+            if (f < marks && mark[f] == t) {
+                mark[f] = t + 1;
+            }
+        }
+    }
+    for (int j = 0; j < lists[0]->count; j++) {
+        int f = lists[0]->files[j];
+        if (f < fs->file_count && mark[f] == list_count) {
+            mark[f] = -1; // 避免重複加入
+            File *file = file_at(fs, f);
+            if (file->in_use == 1 && !file->is_directory) {
+                result[(*count)++] = f;
+            }
+        }
+    }
+    // 別名的內容與它借用的項目（建立別名當時）相同
+    for (int f = 0; ti->alias_count > 0 && f < fs->file_count && f < ti->file_capacity; f++) {
+        int root = ti->alias[f];
+        if (root != -1 && mark[f] != -1 && (mark[root] == -1 || mark[root] == list_count)) {
+            File *file = file_at(fs, f);
+            if (file->in_use == 1 && !file->is_directory) {
+                result[(*count)++] = f;
+            }
+        }
+    }
+    qsort(result, *count, sizeof(int), compare_int);
+    free(mark);
+    free(lists);
+    return 0;
+}
+
+int trigram_index_save(FileSystem *fs, FILE *file) {
+    TrigramIndex *ti = fs->trigram_index;
+    if (!ti) {
+        return 0;
+    }
+    // 先算出大小再序列化到同一塊緩衝區，加密後一次寫出
+    size_t size = 4 * sizeof(int) + 2 * sizeof(int64_t) + 2 * (size_t)fs->file_count * sizeof(int);
+    for (int i = 0; i < ti->list_capacity; i++) {
+        if (ti->lists[i].key != TRIGRAM_EMPTY) {
+            size += 2 * sizeof(int) + (size_t)ti->lists[i].count * sizeof(int);
+        }
+    }
+    char *buffer = malloc(size);
+    if (!buffer || ensure_file_capacity(ti, fs->file_count) == -1) {
+        free(buffer);
+        fs_printf("Error: Not enough memory to save the search index.\n");
+        return -1;
+    }
+    // long 的大小依平台而不同，映像檔中固定用 64 位元
+    int64_t total = ti->total_postings, stale = ti->stale_postings;
+    char *p = buffer;
+    unsigned int magic = TRIGRAM_MAGIC;
+    memcpy(p, &magic, sizeof(int)); p += sizeof(int);
+    memcpy(p, &ti->list_count, sizeof(int)); p += sizeof(int);
+    memcpy(p, &total, sizeof(int64_t)); p += sizeof(int64_t);
+    memcpy(p, &stale, sizeof(int64_t)); p += sizeof(int64_t);
+    memcpy(p, &fs->file_count, sizeof(int)); p += sizeof(int);
+    memcpy(p, ti->file_postings, fs->file_count * sizeof(int)); p += fs->file_count * sizeof(int);
+    memcpy(p, ti->alias, fs->file_count * sizeof(int)); p += fs->file_count * sizeof(int);
+    for (int i = 0; i < ti->list_capacity; i++) {
+        PostingList *list = &ti->lists[i];
+        if (list->key != TRIGRAM_EMPTY) {
+            memcpy(p, &list->key, sizeof(int)); p += sizeof(int);
+            memcpy(p, &list->count, sizeof(int)); p += sizeof(int);
+            memcpy(p, list->files, list->count * sizeof(int)); p += list->count * sizeof(int);
+        }
+    }
+    memcpy(p, &magic, sizeof(int)); // 結尾再放一次 magic，讀取時用來確認完整
+    p += sizeof(int);
+
+    encrypt(buffer, p - buffer);
+    int result = fwrite(buffer, p - buffer, 1, file) == 1 ? 0 : -1;
+    free(buffer);
+    return result;
+}
+
+// 讀取並解密 size 個位元組
+static int read_decrypted(FILE *file, void *buffer, size_t size) {
+    if (fread(buffer, 1, size, file) != size) {
+        return -1;
+    }
+    encrypt(buffer, size);
+    return 0;
+}
+
+int trigram_index_load(FileSystem *fs, FILE *file) {
+    TrigramIndex *ti = fs->trigram_index;
+    unsigned int magic;
+    int list_count, file_count;
+    int64_t total, stale;
+    if (!ti || read_decrypted(file, &magic, sizeof(int)) == -1 || magic != TRIGRAM_MAGIC ||
+        read_decrypted(file, &list_count, sizeof(int)) == -1 ||
+        read_decrypted(file, &total, sizeof(int64_t)) == -1 ||
+        read_decrypted(file, &stale, sizeof(int64_t)) == -1 ||
+        read_decrypted(file, &file_count, sizeof(int)) == -1 || file_count != fs->file_count) {
+        return -1;
+    }
+    ti->total_postings = total;
+    ti->stale_postings = stale;
+    if (ensure_file_capacity(ti, file_count) == -1 ||
+        read_decrypted(file, ti->file_postings, file_count * sizeof(int)) == -1 ||
+        read_decrypted(file, ti->alias, file_count * sizeof(int)) == -1) {
+        return -1;
+    }
+    ti->alias_count = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (ti->alias[i] < -1 || ti->alias[i] >= file_count) {
+            return -1;
+        }
+        ti->alias_count += ti->alias[i] != -1;
+    }
+    for (int i = 0; i < list_count; i++) {
+        unsigned int key;
+        int count;
+        if (read_decrypted(file, &key, sizeof(int)) == -1 || read_decrypted(file, &count, sizeof(int)) == -1) {
+            return -1;
+        }
+        PostingList *list = get_list(ti, key);
+        if (!list || count < 0) {
+            return -1;
+        }
+        list->files = malloc((count > 0 ? count : 1) * sizeof(int));
+        if (!list->files) {
+            return -1;
+        }
+        list->count = list->capacity = count;
+        if (read_decrypted(file, list->files, count * sizeof(int)) == -1) {
+            return -1;
+        }
+    }
+    return read_decrypted(file, &magic, sizeof(int)) == 0 && magic == TRIGRAM_MAGIC ? 0 : -1;
+}
+
+const char *find_substring(const char *data, size_t size, const char *needle, size_t len) {
+    if (len == 0) {
+        return data;
+    }
+    if (len > size) {
+        return NULL;
+    }
+    size_t i = 0;
+#ifdef __SSE2__
+    // 一次比對 16 個起點：第一個和最後一個字元都相符的位置才做完整比較
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[len - 1]);
+    for (; i + len - 1 + 16 <= size; i += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i tail = _mm_loadu_si128((const __m128i *)(data + i + len - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                                                            _mm_cmpeq_epi8(tail, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit, needle, len) == 0) {
+                return data + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + len <= size; i++) {
+        if (data[i] == needle[0] && memcmp(data + i, needle, len) == 0) {
+            return data + i;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,66 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include "filesystem.h"
+
+// 檔案內容的 trigram 索引
+// 每個出現過的 3 位元組序列對應一串包含它的檔案索引（posting list）
+// put/create/edit 會把檔案加進索引；rm 與改寫只把舊的 posting 記為過期，
+// 查詢時以實際內容驗證，過期的 posting 累積過多時才整個重建
+// cp 的複本與來源共用區塊，內容相同，所以不讀內容，只記成來源的別名：來源通過篩選時複本也是候選
+// 來源之後被改寫或刪除時舊的 posting 仍留在 list 中（只記為過期），重建時才依內容各自加入
+
+typedef struct {
+    unsigned int key;        // 3 個位元組組成的 24-bit 值，空槽為 TRIGRAM_EMPTY
+    int count, capacity;
+    int *files;              // 可能重複或過期，查詢時會過濾
+} PostingList;
+
+typedef struct TrigramIndex {
+    PostingList *lists;      // 以 key 做 open addressing 的雜湊表
+    int list_capacity;       // 2 的次方
+    int list_count;
+    long total_postings;
+    long stale_postings;     // 已刪除或已改寫的檔案留下的 posting
+    int *file_postings;      // 每個項目目前有效的 posting 數，刪除時用來累計過期數
+    int file_capacity;
+    unsigned char *seen;     // 2^24 bits，計算單一檔案有哪些不重複的 trigram，第一次加入檔案時配置
+    unsigned int *seen_keys; // 這次在 seen 中設定的位元，加完一個檔案後依此清除
+    int seen_key_capacity;
+    int *alias;              // 每個項目借用哪個項目的 posting（cp 的複本），-1 表示沒有
+    int alias_count;
+} TrigramIndex;
+
+#define TRIGRAM_EMPTY 0xFFFFFFFFu
+
+TrigramIndex *trigram_index_create(void);
+void trigram_index_destroy(TrigramIndex *ti);
+
+// 檔案內容寫入後呼叫，把它的 trigram 加進索引
+void trigram_index_add(FileSystem *fs, int index);
+
+// cp 之後呼叫：index 與 source 共用區塊，直接沿用 source 的 posting，成本與檔案大小無關
+void trigram_index_copy(FileSystem *fs, int index, int source);
+
+// 檔案刪除前呼叫
+void trigram_index_remove(FileSystem *fs, int index);
+
+// 檔案內容被改寫後呼叫（等同 remove + add）
+void trigram_index_update(FileSystem *fs, int index);
+
+// 依目前所有檔案重建索引
+void trigram_index_rebuild(FileSystem *fs);
+
+// 可能包含 pattern 的檔案索引（已排序、不重複，需 free）寫入 *files，*count 為數量
+// 最短的 posting list 也涵蓋大部分檔案時索引幫不上忙，不求交集，直接回傳所有檔案
+// 記憶體不足時回傳 -1，呼叫者改為掃描所有檔案
+int trigram_index_candidates(FileSystem *fs, const char *pattern, int len, int **files, int *count);
+
+// 把索引寫入映像檔（失敗回傳 -1）/ 從映像檔讀回（讀不到索引區段時回傳 -1）
+int trigram_index_save(FileSystem *fs, FILE *file);
+int trigram_index_load(FileSystem *fs, FILE *file);
+
+// 在 data 中尋找 needle，回傳第一個出現的位置或 NULL（有 SSE2 時使用 SIMD 比對）
+const char *find_substring(const char *data, size_t size, const char *needle, size_t len);
+
+#endif